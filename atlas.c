@@ -0,0 +1,214 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Every icon is compiled into the program as a GResource (see
+ * icons.gresource.xml) and decoded once at startup into a single
+ * premultiplied cairo surface, the atlas. Icons are then just rectangles
+ * of it, found by kind, colour and state, and painted from there without
+ * decoding or converting anything again.
+ *
+ * The icons are packed in rows, tallest first, each row as tall as the
+ * first icon in it. There are few enough that nothing cleverer is
+ * worthwhile. This runs on the GTK thread only.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <gdk/gdk.h>
+#include "atlas.h"
+#include "log.h"
+
+/* Space left around each icon, so none bleeds into its neighbours */
+#define ATLAS_PADDING (1)
+
+static cairo_surface_t *_surface = NULL;
+static atlas_icon_t _icons[ATLAS_MAX_ICONS];
+static unsigned int _count = 0;
+
+/* An icon while it's being loaded */
+typedef struct {
+	atlas_icon_t icon;
+	GdkPixbuf *pixbuf;
+} atlas_load_t;
+
+static int _taller(const void *a, const void *b)
+{
+	const atlas_icon_t *ia = a, *ib = b;
+	
+	if(ia->height != ib->height) return(ib->height - ia->height);
+	return(strcmp(ia->name, ib->name));
+}
+
+/* Decode every icon in the resources into the atlas. Returns
+ * 0 on success, or -1 on error and the atlas is left empty */
+int atlas_load(void)
+{
+	atlas_load_t loaded[ATLAS_MAX_ICONS];
+	char **names, path[128];
+	GError *error = NULL;
+	gint64 started = g_get_monotonic_time();
+	int x, y, row, height;
+	unsigned int i, n;
+	cairo_t *cr;
+	
+	names = g_resources_enumerate_children(ATLAS_RESOURCE_PATH, 0, &error);
+	if(!names)
+	{
+		fprintf(stderr, "No icons found: %s\n", error->message);
+		g_error_free(error);
+		return(-1);
+	}
+	
+	/* Decode each icon, noting its size */
+	for(n = 0, i = 0; names[i] && n < ATLAS_MAX_ICONS; i++)
+	{
+		atlas_load_t *l = &loaded[n];
+		size_t length = strlen(names[i]);
+		
+		if(length < 5 || strcmp(names[i] + length - 4, ".png") != 0 ||
+		   length - 4 >= sizeof(l->icon.name)) continue;
+		
+		snprintf(path, sizeof(path), "%s/%s", ATLAS_RESOURCE_PATH, names[i]);
+		l->pixbuf = gdk_pixbuf_new_from_resource(path, &error);
+		if(!l->pixbuf)
+		{
+			fprintf(stderr, "Can't load icon %s: %s\n", names[i], error->message);
+			g_clear_error(&error);
+			continue;
+		}
+		
+		memcpy(l->icon.name, names[i], length - 4);
+		l->icon.name[length - 4] = '\0';
+		l->icon.width  = gdk_pixbuf_get_width(l->pixbuf);
+		l->icon.height = gdk_pixbuf_get_height(l->pixbuf);
+		n++;
+	}
+	
+	g_strfreev(names);
+	
+	/* Lay the icons out in rows, tallest first. The icon is
+	 * first in the struct, so the comparison works on either */
+	qsort(loaded, n, sizeof(atlas_load_t), _taller);
+	
+	for(x = y = row = 0, i = 0; i < n; i++)
+	{
+		atlas_icon_t *icon = &loaded[i].icon;
+		
+		if(x > 0 && x + icon->width > ATLAS_WIDTH)
+		{
+			y += row;
+			x = row = 0;
+		}
+		
+		if(row == 0) row = icon->height + ATLAS_PADDING;
+		
+		icon->x = x;
+		icon->y = y;
+		x += icon->width + ATLAS_PADDING;
+	}
+	height = y + row;
+	
+	/* Decode into the one surface, premultiplying as it goes */
+	_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ATLAS_WIDTH, height > 0 ? height : 1);
+	cr = cairo_create(_surface);
+	
+	for(i = 0; i < n; i++)
+	{
+		gdk_cairo_set_source_pixbuf(cr, loaded[i].pixbuf, loaded[i].icon.x, loaded[i].icon.y);
+		cairo_paint(cr);
+		g_object_unref(G_OBJECT(loaded[i].pixbuf));
+		
+		_icons[i] = loaded[i].icon;
+	}
+	
+	cairo_destroy(cr);
+	
+	if(cairo_surface_status(_surface) != CAIRO_STATUS_SUCCESS)
+	{
+		fprintf(stderr, "Can't create the icon atlas\n");
+		cairo_surface_destroy(_surface);
+		_surface = NULL;
+		return(-1);
+	}
+	
+	_count = n;
+	
+	log_printf(LOG_LEVEL_INFO, "Loaded %u icons into a %ix%i atlas of %zu bytes in %.1f ms\n",
+		n, ATLAS_WIDTH, height, (size_t) cairo_image_surface_get_stride(_surface) * height,
+		(g_get_monotonic_time() - started) / 1000.0);
+	
+	return(0);
+}
+
+void atlas_free(void)
+{
+	if(_surface) cairo_surface_destroy(_surface);
+	_surface = NULL;
+	_count = 0;
+}
+
+static const atlas_icon_t *_find(const char *name)
+{
+	unsigned int i;
+	
+	for(i = 0; i < _count; i++)
+		if(strcmp(_icons[i].name, name) == 0) return(&_icons[i]);
+	
+	return(NULL);
+}
+
+/* Find an icon by its kind ("balloon", "car"...), colour and state, either
+ * of which may be NULL. Icons that only come in one colour, such as
+ * "shadow", are found by their kind alone whatever the colour and state
+ * asked for. Returns NULL if there's no such icon */
+const atlas_icon_t *atlas_icon(const char *kind, const char *colour, const char *state)
+{
+	char name[sizeof(_icons[0].name)];
+	const atlas_icon_t *icon;
+	
+	snprintf(name, sizeof(name), "%s%s%s%s%s", kind,
+		colour ? "-" : "", colour ? colour : "",
+		state ? "-" : "", state ? state : "");
+	
+	icon = _find(name);
+	if(!icon && (colour || state)) icon = _find(kind);
+	
+	return(icon);
+}
+
+/* Paint an icon with its top left corner at x, y */
+void atlas_paint(cairo_t *cr, const atlas_icon_t *icon, double x, double y)
+{
+	if(!_surface || !icon) return;
+	
+	cairo_save(cr);
+	cairo_set_source_surface(cr, _surface, x - icon->x, y - icon->y);
+	cairo_rectangle(cr, x, y, icon->width, icon->height);
+	cairo_fill(cr);
+	cairo_restore(cr);
+}
+
+/* Get the number of icons and the size of the atlas. Either may be NULL */
+void atlas_stats(unsigned int *count, size_t *bytes)
+{
+	if(count) *count = _count;
+	if(bytes) *bytes = (_surface ? (size_t) cairo_image_surface_get_stride(_surface) *
+		cairo_image_surface_get_height(_surface) : 0);
+}
+
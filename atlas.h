@@ -0,0 +1,53 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __ATLAS_H__
+#define __ATLAS_H__
+
+#include <cairo.h>
+
+/* Where the icons are in the compiled in resources */
+#define ATLAS_RESOURCE_PATH "/org/habhound/icons"
+
+/* Width of the atlas surface, in pixels */
+#define ATLAS_WIDTH (256)
+
+/* Most icons the atlas holds */
+#define ATLAS_MAX_ICONS (64)
+
+/* One icon, a rectangle of the atlas */
+typedef struct {
+	
+	/* The file name without ".png", "kind[-colour[-state]]" */
+	char name[32];
+	
+	/* Position and size within the atlas */
+	int x;
+	int y;
+	int width;
+	int height;
+	
+} atlas_icon_t;
+
+extern int atlas_load(void);
+extern void atlas_free(void);
+extern const atlas_icon_t *atlas_icon(const char *kind, const char *colour, const char *state);
+extern void atlas_paint(cairo_t *cr, const atlas_icon_t *icon, double x, double y);
+extern void atlas_stats(unsigned int *count, size_t *bytes);
+
+#endif /* __ATLAS_H__ */
+
@@ -0,0 +1,187 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Startup time and resident memory of loading the icons: the three
+ * files main() once decoded from icons/, every icon there as a separate
+ * pixbuf, as colour variants would have needed, and the atlas decoded
+ * from the compiled in resources. Each is measured in a process of its
+ * own so none gains from another having loaded the PNG decoder. Built
+ * by "make bench-gui", and run from the top of the tree for icons/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "../atlas.h"
+#include "bench.h"
+
+#define BENCH_ICONS "icons"
+
+typedef struct {
+	double ms;
+	long rss;       /* kB */
+	size_t bytes;   /* Of decoded pixels */
+	unsigned int icons;
+} result_t;
+
+/* Resident set size in kB */
+static long _rss(void)
+{
+	char line[128];
+	long kb = 0;
+	FILE *f;
+	
+	f = fopen("/proc/self/status", "r");
+	if(!f) return(0);
+	
+	while(fgets(line, sizeof(line), f))
+		if(sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+	
+	fclose(f);
+	
+	return(kb);
+}
+
+static int _load(const char *name, result_t *r)
+{
+	char path[256];
+	GdkPixbuf *pixbuf;
+	
+	snprintf(path, sizeof(path), "%s/%s", BENCH_ICONS, name);
+	
+	pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+	if(!pixbuf)
+	{
+		fprintf(stderr, "Can't load %s\n", path);
+		return(-1);
+	}
+	
+	/* Kept, as main() kept them */
+	r->bytes += (size_t) gdk_pixbuf_get_rowstride(pixbuf) * gdk_pixbuf_get_height(pixbuf);
+	r->icons++;
+	
+	return(0);
+}
+
+static int _files(int all, result_t *r)
+{
+	static const char *used[] = { "balloon-blue.png", "antenna-green.png", "car-red.png" };
+	struct dirent *d;
+	DIR *dir;
+	int i;
+	
+	if(!all)
+	{
+		for(i = 0; i < 3; i++) if(_load(used[i], r) != 0) return(-1);
+		return(0);
+	}
+	
+	dir = opendir(BENCH_ICONS);
+	if(!dir)
+	{
+		perror(BENCH_ICONS);
+		return(-1);
+	}
+	
+	while((d = readdir(dir)))
+	{
+		size_t l = strlen(d->d_name);
+		
+		if(l > 4 && strcmp(d->d_name + l - 4, ".png") == 0 && _load(d->d_name, r) != 0)
+		{
+			closedir(dir);
+			return(-1);
+		}
+	}
+	
+	closedir(dir);
+	
+	return(0);
+}
+
+/* Run one way of loading in a child process, returning 0 on success */
+static int _measure(int way, result_t *r)
+{
+	int fd[2], status;
+	double start;
+	long rss;
+	pid_t pid;
+	
+	if(pipe(fd) != 0) return(-1);
+	
+	pid = fork();
+	if(pid == -1) return(-1);
+	
+	if(pid == 0)
+	{
+		memset(r, 0, sizeof(result_t));
+		rss = _rss();
+		start = bench_now();
+		
+		if(way < 2)
+		{
+			if(_files(way, r) != 0) _exit(1);
+		}
+		else
+		{
+			if(atlas_load() != 0) _exit(1);
+			atlas_stats(&r->icons, &r->bytes);
+		}
+		
+		r->ms = (bench_now() - start) * 1000;
+		r->rss = _rss() - rss;
+		
+		if(write(fd[1], r, sizeof(result_t)) != sizeof(result_t)) _exit(1);
+		_exit(0);
+	}
+	
+	close(fd[1]);
+	
+	if(read(fd[0], r, sizeof(result_t)) != sizeof(result_t)) r->icons = 0;
+	close(fd[0]);
+	
+	waitpid(pid, &status, 0);
+	
+	return(WIFEXITED(status) && WEXITSTATUS(status) == 0 && r->icons > 0 ? 0 : -1);
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *ways[] = { "3 files", "every file", "atlas" };
+	result_t r;
+	int w;
+	
+	printf("# icons\tcount\tms\trss kB\tpixel bytes\n");
+	
+	for(w = 0; w < 3; w++)
+	{
+		if(_measure(w, &r) != 0)
+		{
+			fprintf(stderr, "Loading %s failed\n", ways[w]);
+			return(1);
+		}
+		
+		printf("%s\t%u\t%.2f\t%li\t%zu\n", ways[w], r.icons, r.ms, r.rss, r.bytes);
+	}
+	
+	return(0);
+}
+
@@ -0,0 +1,226 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Documents parsed per second, and allocations made per document, by
+ * couch_parse() and by the yajl_tree_parse() and yajl_tree_get() path
+ * habitat.c used before it, pulling out the same fields. Allocations
+ * are counted by standing in for malloc and friends, so yajl's own
+ * are included. The documents are synthetic, habitat shaped ones.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <yajl/yajl_tree.h>
+#include "../couchdoc.h"
+#include "bench.h"
+
+#define BENCH_LINES   (2000)
+#define BENCH_OBJECTS (50)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocs;
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return(__libc_malloc(size));
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return(__libc_calloc(nmemb, size));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return(__libc_realloc(ptr, size));
+}
+
+/* The fields each parser is asked for, summed so both can be
+ * checked against each other and nothing is optimised away */
+typedef struct {
+	long seq;
+	long docs;
+	double latitude;
+	double longitude;
+	double altitude;
+} fields_t;
+
+static void _tree(const char *line, fields_t *f)
+{
+	const char *path[] = { 0, 0, 0 };
+	yajl_val node, doc, v;
+	const char *doctype;
+	int payload;
+	
+	node = yajl_tree_parse(line, NULL, 0);
+	if(!node) return;
+	
+	path[0] = "seq";
+	v = yajl_tree_get(node, path, yajl_t_number);
+	if(v) f->seq += YAJL_GET_INTEGER(v);
+	
+	path[0] = "doc";
+	doc = yajl_tree_get(node, path, yajl_t_object);
+	if(!doc) goto done;
+	
+	path[0] = "type";
+	v = yajl_tree_get(doc, path, yajl_t_string);
+	doctype = (v ? YAJL_GET_STRING(v) : NULL);
+	if(!doctype) goto done;
+	
+	if(strcmp(doctype, "payload_telemetry") == 0) payload = 1;
+	else if(strcmp(doctype, "listener_telemetry") == 0) payload = 0;
+	else goto done;
+	
+	path[0] = "data";
+	
+	if(payload)
+	{
+		path[1] = "_parsed";
+		if(!yajl_tree_get(doc, path, yajl_t_object)) goto done;
+	}
+	
+	path[1] = (payload ? "payload" : "callsign");
+	v = yajl_tree_get(doc, path, yajl_t_string);
+	if(!v || !YAJL_GET_STRING(v)) goto done;
+	
+	path[1] = "latitude";
+	v = yajl_tree_get(doc, path, yajl_t_number);
+	f->latitude += (v ? YAJL_GET_DOUBLE(v) : 0);
+	
+	path[1] = "longitude";
+	v = yajl_tree_get(doc, path, yajl_t_number);
+	f->longitude += (v ? YAJL_GET_DOUBLE(v) : 0);
+	
+	path[1] = "altitude";
+	v = yajl_tree_get(doc, path, yajl_t_number);
+	f->altitude += (v ? YAJL_GET_DOUBLE(v) : 0);
+	
+	f->docs++;
+
+done:
+	yajl_tree_free(node);
+}
+
+static void _stream(couch_parser_t *p, const char *line, size_t length, fields_t *f)
+{
+	couch_row_t *row;
+	couch_doc_t *doc;
+	
+	row = couch_parse(p, line, length);
+	if(!row) return;
+	
+	if(row->has_seq) f->seq += row->seq;
+	
+	doc = &row->doc;
+	if(!row->has_doc) return;
+	if(doc->type == COUCH_DOC_PAYLOAD_TELEMETRY && (!doc->parsed || !*doc->payload)) return;
+	if(doc->type == COUCH_DOC_LISTENER_TELEMETRY && !*doc->callsign) return;
+	if(doc->type != COUCH_DOC_PAYLOAD_TELEMETRY && doc->type != COUCH_DOC_LISTENER_TELEMETRY) return;
+	
+	f->latitude += doc->latitude;
+	f->longitude += doc->longitude;
+	f->altitude += doc->altitude;
+	f->docs++;
+}
+
+/* Parse every line over and over for at least BENCH_TIME. Returns
+ * the documents per second, setting the allocations per document
+ * and the fields found in the first pass */
+static double _run(int tree, char **lines, size_t *lengths, double *per_doc, fields_t *first)
+{
+	couch_parser_t p;
+	double start, elapsed;
+	unsigned long a;
+	long n = 0;
+	int i;
+	
+	memset(&p, 0, sizeof(p));
+	
+	/* Let the streaming parser allocate its handle first */
+	if(!tree) couch_parse(&p, lines[0], lengths[0]);
+	
+	a = allocs;
+	start = bench_now();
+	
+	do
+	{
+		fields_t f;
+		
+		memset(&f, 0, sizeof(f));
+		
+		for(i = 0; i < BENCH_LINES; i++)
+		{
+			if(tree) _tree(lines[i], &f);
+			else _stream(&p, lines[i], lengths[i], &f);
+		}
+		
+		if(n == 0) *first = f;
+		n += BENCH_LINES;
+	}
+	while((elapsed = bench_now() - start) < BENCH_TIME);
+	
+	*per_doc = (double) (allocs - a) / n;
+	
+	couch_parser_free(&p);
+	
+	return(n / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	static char *lines[BENCH_LINES];
+	static size_t lengths[BENCH_LINES];
+	char line[BENCH_LINE_MAX];
+	fields_t tf, sf;
+	double trate, srate, tallocs, sallocs;
+	int i;
+	
+	for(i = 0; i < BENCH_LINES; i++)
+	{
+		lengths[i] = bench_line(line, sizeof(line), i, BENCH_OBJECTS);
+		lines[i] = strdup(line);
+		if(!lines[i]) return(1);
+	}
+	
+	trate = _run(1, lines, lengths, &tallocs, &tf);
+	srate = _run(0, lines, lengths, &sallocs, &sf);
+	
+	/* Both must have found the same */
+	if(tf.seq != sf.seq || tf.docs != sf.docs || tf.latitude != sf.latitude ||
+	   tf.longitude != sf.longitude || tf.altitude != sf.altitude)
+	{
+		fprintf(stderr, "The parsers disagree: %li docs, %li docs\n", tf.docs, sf.docs);
+		return(1);
+	}
+	
+	printf("# parser\tdocs/s\tallocs/doc\tx tree\n");
+	printf("yajl_tree\t%.0f\t%.1f\t%.2f\n", trate, tallocs, 1.0);
+	printf("couch_parse\t%.0f\t%.1f\t%.2f\n", srate, sallocs, srate / trate);
+	
+	for(i = 0; i < BENCH_LINES; i++) free(lines[i]);
+	
+	return(0);
+}
+
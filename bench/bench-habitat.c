@@ -0,0 +1,361 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* How the habitat source behaves against a local stand-in server: the
+ * wakeups and CPU time its thread takes while the feed is idle, and the
+ * delay from a change being written to the socket to its update being
+ * ready to drain. The server is a forked child, serving the database
+ * info and a changes feed that sends a change each time the parent asks
+ * for one, writing back the time it was sent.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <curl/curl.h>
+#include "../core.h"
+#include "../habitat.h"
+#include "../log.h"
+#include "bench.h"
+
+#define BENCH_IDLE    (10)
+#define BENCH_CHANGES (1000)
+
+static int efd;
+
+static void cb_wake(void)
+{
+	uint64_t n = 1;
+	
+	if(write(efd, &n, sizeof(n)) != sizeof(n)) return;
+}
+
+static void cb_status(char *message)
+{
+	free(message);
+}
+
+static void cb_update(void *user, hab_update_t *u, hab_object_t *obj)
+{
+}
+
+static int _send(int fd, const char *data, size_t length)
+{
+	ssize_t r;
+	
+	for(; length > 0; data += r, length -= r)
+		if((r = send(fd, data, length, MSG_NOSIGNAL)) <= 0) return(-1);
+	
+	return(0);
+}
+
+static int _chunk(int fd, const char *data, size_t length)
+{
+	char head[16];
+	
+	snprintf(head, sizeof(head), "%zx\r\n", length);
+	
+	if(_send(fd, head, strlen(head)) != 0 ||
+	   _send(fd, data, length) != 0 ||
+	   _send(fd, "\r\n", 2) != 0) return(-1);
+	
+	return(0);
+}
+
+/* Serve one connection. Changes are sent when a byte arrives on cmd,
+ * and the time each was sent is written to times. Heartbeats are sent
+ * every five seconds, as habitat.c asks for */
+static void _serve(int fd, int cmd, int times)
+{
+	char request[4096], line[BENCH_LINE_MAX];
+	const char *p;
+	ssize_t r;
+	int i = 0, l;
+	double t;
+	
+	while((r = recv(fd, request, sizeof(request) - 1, 0)) > 0)
+	{
+		request[r] = '\0';
+		
+		if(!strstr(request, "/_changes"))
+		{
+			p = "{\"db_name\":\"habitat\",\"update_seq\":0}\n";
+			l = snprintf(line, sizeof(line),
+				"HTTP/1.1 200 OK\r\n"
+				"Content-Type: text/plain;charset=utf-8\r\n"
+				"Content-Length: %zu\r\n"
+				"\r\n"
+				"%s", strlen(p), p);
+			if(_send(fd, line, l) != 0) return;
+			continue;
+		}
+		
+		p = "HTTP/1.1 200 OK\r\n"
+		    "Content-Type: text/plain;charset=utf-8\r\n"
+		    "Transfer-Encoding: chunked\r\n"
+		    "\r\n";
+		if(_send(fd, p, strlen(p)) != 0) return;
+		
+		/* Tell the parent the feed is open */
+		t = 0;
+		if(write(times, &t, sizeof(t)) != sizeof(t)) return;
+		
+		while(1)
+		{
+			struct pollfd pfd = { cmd, POLLIN, 0 };
+			char c;
+			
+			if(poll(&pfd, 1, HABITAT_HEARTBEAT) == 0)
+			{
+				if(_chunk(fd, "\n", 1) != 0) return;
+				continue;
+			}
+			
+			if(read(cmd, &c, 1) != 1) return;
+			
+			l = bench_line(line, sizeof(line) - 1, i++, 50);
+			line[l++] = '\n';
+			
+			t = bench_now();
+			if(_chunk(fd, line, l) != 0) return;
+			if(write(times, &t, sizeof(t)) != sizeof(t)) return;
+		}
+	}
+}
+
+static void _server(int listener, int cmd, int times)
+{
+	int fd;
+	
+	while((fd = accept(listener, NULL, NULL)) != -1)
+	{
+		if(fork() == 0)
+		{
+			_serve(fd, cmd, times);
+			_exit(0);
+		}
+		
+		close(fd);
+	}
+}
+
+/* Context switches of every thread but the calling one */
+static unsigned long _switches(void)
+{
+	unsigned long total = 0, n;
+	char path[300], line[128];
+	struct dirent *d;
+	DIR *dir;
+	FILE *f;
+	
+	dir = opendir("/proc/self/task");
+	if(!dir) return(0);
+	
+	while((d = readdir(dir)))
+	{
+		if(d->d_name[0] == '.' || atol(d->d_name) == syscall(SYS_gettid)) continue;
+		
+		snprintf(path, sizeof(path), "/proc/self/task/%s/status", d->d_name);
+		if(!(f = fopen(path, "r"))) continue;
+		
+		while(fgets(line, sizeof(line), f))
+		{
+			if(sscanf(line, "voluntary_ctxt_switches: %lu", &n) == 1 ||
+			   sscanf(line, "nonvoluntary_ctxt_switches: %lu", &n) == 1) total += n;
+		}
+		
+		fclose(f);
+	}
+	
+	closedir(dir);
+	
+	return(total);
+}
+
+static double _cpu(void)
+{
+	struct rusage ru;
+	
+	getrusage(RUSAGE_SELF, &ru);
+	
+	return(ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+}
+
+static int _compare(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	
+	return(x < y ? -1 : x > y);
+}
+
+int main(int argc, char *argv[])
+{
+	core_hooks_t hooks = { cb_wake, cb_status };
+	static double delays[BENCH_CHANGES];
+	struct sockaddr_in sa;
+	socklen_t sl = sizeof(sa);
+	struct pollfd pfd;
+	int listener, cmd[2], times[2], i;
+	core_source_t *src;
+	src_habitat_t *s;
+	unsigned long switches;
+	double t0, t1, cpu, idle;
+	char url[64];
+	pid_t pid;
+	
+	/* Just the results */
+	log_level = LOG_LEVEL_WARN;
+	
+	/* The server listens on any free port on loopback */
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(listener == -1 || bind(listener, (struct sockaddr *) &sa, sizeof(sa)) != 0 ||
+	   listen(listener, 8) != 0 || getsockname(listener, (struct sockaddr *) &sa, &sl) != 0)
+	{
+		perror("listen");
+		return(1);
+	}
+	
+	if(pipe(cmd) != 0 || pipe(times) != 0)
+	{
+		perror("pipe");
+		return(1);
+	}
+	
+	pid = fork();
+	if(pid == -1)
+	{
+		perror("fork");
+		return(1);
+	}
+	
+	/* The server and its connections are a process group of their own,
+	 * so they can all be stopped together */
+	if(pid == 0)
+	{
+		setpgid(0, 0);
+		close(cmd[1]);
+		close(times[0]);
+		_server(listener, cmd[0], times[1]);
+		_exit(0);
+	}
+	
+	setpgid(pid, pid);
+	close(listener);
+	close(cmd[0]);
+	close(times[1]);
+	
+	efd = eventfd(0, EFD_CLOEXEC);
+	if(efd == -1 || core_init(&hooks) != 0 || !(src = core_add_source("bench")))
+	{
+		kill(-pid, SIGTERM);
+		return(1);
+	}
+	
+	curl_global_init(CURL_GLOBAL_ALL);
+	
+	snprintf(url, sizeof(url), "http://127.0.0.1:%i/habitat", ntohs(sa.sin_port));
+	
+	s = src_habitat_start(url, NULL, src);
+	if(!s)
+	{
+		kill(-pid, SIGTERM);
+		return(1);
+	}
+	
+	/* Wait for the feed to open, and settle */
+	pfd.fd = times[0];
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, 10000) != 1 || read(times[0], &t0, sizeof(t0)) != sizeof(t0))
+	{
+		fprintf(stderr, "The changes feed never opened\n");
+		kill(-pid, SIGTERM);
+		return(1);
+	}
+	usleep(500000);
+	
+	/* Idle, with only the heartbeats arriving */
+	switches = _switches();
+	cpu = _cpu();
+	sleep(BENCH_IDLE);
+	switches = _switches() - switches;
+	cpu = _cpu() - cpu;
+	
+	idle = (double) switches / BENCH_IDLE;
+	
+	/* One change at a time, from the socket to the queue */
+	for(i = 0; i < BENCH_CHANGES; i++)
+	{
+		struct pollfd p = { efd, POLLIN, 0 };
+		uint64_t n;
+		
+		if(write(cmd[1], "c", 1) != 1) break;
+		
+		if(poll(&p, 1, 5000) != 1) break;
+		t1 = bench_now();
+		
+		if(read(efd, &n, sizeof(n)) != sizeof(n) ||
+		   read(times[0], &t0, sizeof(t0)) != sizeof(t0)) break;
+		
+		delays[i] = (t1 - t0) * 1e6;
+		core_drain(cb_update, NULL, NULL);
+		
+		/* Let the thread go back to waiting */
+		usleep(1000);
+	}
+	
+	src_habitat_stop(s);
+	core_free();
+	
+	close(cmd[1]);
+	kill(-pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	
+	if(i < BENCH_CHANGES)
+	{
+		fprintf(stderr, "Only %i of %i changes arrived\n", i, BENCH_CHANGES);
+		return(1);
+	}
+	
+	qsort(delays, BENCH_CHANGES, sizeof(double), _compare);
+	
+	printf("# measure\tvalue\n");
+	printf("idle wakeups/s\t%.2f\n", idle);
+	printf("idle cpu ms/s\t%.3f\n", cpu * 1000 / BENCH_IDLE);
+	printf("change to queue us, median\t%.1f\n", delays[BENCH_CHANGES / 2]);
+	printf("change to queue us, 99%%\t%.1f\n", delays[BENCH_CHANGES * 99 / 100]);
+	printf("change to queue us, max\t%.1f\n", delays[BENCH_CHANGES - 1]);
+	
+	return(0);
+}
+
@@ -0,0 +1,120 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Cost of keeping a balloon's horizon circle up to date, per update, as
+ * horizon.c does it against the float routine called for every point of
+ * every update before. The flight is simulated: a climb at 5 m/s to 30 km
+ * drifting east at 10 m/s, heard every 5 seconds, at three zoom levels.
+ * Building and adding the map track the old code also did each time needs
+ * osm-gps-map, so isn't counted here.
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include "../horizon.h"
+#include "bench.h"
+
+#define FLIGHT_STEP   (5.0)
+#define FLIGHT_CLIMB  (5.0)
+#define FLIGHT_DRIFT  (10.0)
+#define FLIGHT_LENGTH (6000)
+
+static const int zooms[] = { 6, 9, 12 };
+
+/* The old calculate_point_at_horizon(), less the map point */
+static void _point(float lat1, float lng1, float bearing, float distance, float *lat2, float *lng2)
+{
+	float d = distance / 6378137.0;
+	
+	*lat2 = asin(sin(lat1) * cos(d) + cos(lat1) * sin(d) * cos(bearing));
+	*lng2 = lng1 + atan2(sin(bearing) * sin(d) * cos(lat1), cos(d) - sin(lat1) * sin(*lat2));
+}
+
+/* Fly the balloon at a zoom level until BENCH_TIME has passed, setting
+ * how many updates moved the circle. Returns the microseconds per update */
+static double _run(int old, int zoom, long *moved, long *updates)
+{
+	double lat[HORIZON_POINTS + 1], lng[HORIZON_POINTS + 1];
+	float flat, flng;
+	double start = bench_now(), elapsed, sum = 0;
+	int t, i;
+	
+	*moved = *updates = 0;
+	
+	do
+	{
+		horizon_t h = { 0, 0, 0, -1 };
+		
+		for(t = 0; t < FLIGHT_LENGTH; t += FLIGHT_STEP)
+		{
+			double latitude = 52.0;
+			double longitude = -1.0 + t * FLIGHT_DRIFT / (111320.0 * cos(latitude * M_PI / 180.0));
+			double altitude = t * FLIGHT_CLIMB;
+			double d = sqrt(2 * 6378137.0 * altitude);
+			double mpp = 2 * M_PI * 6378137.0 * cos(latitude * M_PI / 180.0) / (256 << zoom);
+			
+			if(old)
+			{
+				for(i = 0; i <= 100; i++)
+				{
+					_point(latitude * M_PI / 180.0, longitude * M_PI / 180.0,
+						M_PI * 2.0 / 100.0 * (float) i, d, &flat, &flng);
+					sum += flat + flng;
+				}
+				(*moved)++;
+			}
+			else if(horizon_moved(&h, latitude, longitude, d, zoom, mpp))
+			{
+				horizon_circle(latitude, longitude, d, lat, lng);
+				sum += lat[0] + lng[0];
+				(*moved)++;
+			}
+			
+			(*updates)++;
+		}
+	}
+	while((elapsed = bench_now() - start) < BENCH_TIME);
+	
+	/* Keep the results, so the work isn't optimised away */
+	if(sum == 0) printf("#\n");
+	
+	return(elapsed * 1e6 / *updates);
+}
+
+int main(int argc, char *argv[])
+{
+	long moved, updates;
+	int z, old;
+	
+	horizon_init();
+	
+	printf("# zoom\tcircle\tus/update\tmoved\n");
+	
+	for(z = 0; z < sizeof(zooms) / sizeof(zooms[0]); z++)
+	{
+		for(old = 1; old >= 0; old--)
+		{
+			double us = _run(old, zooms[z], &moved, &updates);
+			
+			printf("%i\t%s\t%.3f\t%.1f%%\n", zooms[z], old ? "float" : "horizon",
+				us, 100.0 * moved / updates);
+		}
+	}
+	
+	return(0);
+}
+
@@ -0,0 +1,167 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Microseconds per update to keep the infoboxes of 50 payloads current,
+ * infobox_update() against the full redraw render_infobox() did before
+ * it. Half the payloads are climbing, so every line changes, and half
+ * are floating, so their altitude lines don't. Built by "make bench-gui"
+ * as it needs cairo and the icons, but not a display.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <cairo.h>
+#include "../atlas.h"
+#include "../infobox.h"
+#include "bench.h"
+
+#define BENCH_PAYLOADS (50)
+
+/* The old render_infobox(), less the map object */
+static void _render(cairo_surface_t **surface, const atlas_icon_t *icon, const char *title,
+	time_t timestamp, double latitude, double longitude, double altitude, double max_altitude)
+{
+	cairo_t *cr;
+	char msg[100];
+	struct tm tm;
+	
+	if(!*surface) *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, INFOBOX_WIDTH, INFOBOX_HEIGHT);
+	
+	cr = cairo_create(*surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	
+	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
+	cairo_set_line_width(cr, 2);
+	cairo_rectangle(cr, 1, 1, 218, 102);
+	cairo_stroke_preserve(cr);
+	
+	cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 0.85);
+	cairo_fill(cr);
+	
+	atlas_paint(cr, icon, 166, 5);
+	
+	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+	cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, 12);
+	cairo_move_to(cr, 5, 14);
+	cairo_show_text(cr, title);
+	
+	cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, 10);
+	
+	cairo_move_to(cr, 5, 14 + 11);
+	strftime(msg, 100, "Time: %Y-%m-%d %H:%M:%S", gmtime_r(&timestamp, &tm));
+	cairo_show_text(cr, msg);
+	
+	cairo_move_to(cr, 5, 14 + 22);
+	snprintf(msg, 100, "Position: %.5f, %.5f", latitude, longitude);
+	cairo_show_text(cr, msg);
+	
+	cairo_move_to(cr, 5, 14 + 33);
+	snprintf(msg, 100, "Altitude: %i m", (int) altitude);
+	cairo_show_text(cr, msg);
+	
+	cairo_move_to(cr, 5, 14 + 44);
+	snprintf(msg, 100, "Max. Altitude: %i m", (int) max_altitude);
+	cairo_show_text(cr, msg);
+	
+	cairo_destroy(cr);
+}
+
+/* Send each payload an update in turn until BENCH_TIME has passed.
+ * Returns the microseconds per update, and sets the lines redrawn */
+static double _run(int old, const atlas_icon_t *icon, double *redrawn)
+{
+	static cairo_surface_t *surfaces[BENCH_PAYLOADS];
+	static infobox_t boxes[BENCH_PAYLOADS];
+	double start = bench_now(), elapsed;
+	long updates = 0, lines = 0;
+	int p;
+	
+	memset(boxes, 0, sizeof(boxes));
+	memset(surfaces, 0, sizeof(surfaces));
+	
+	do
+	{
+		for(p = 0; p < BENCH_PAYLOADS; p++, updates++)
+		{
+			char title[16], text[INFOBOX_LINES][64];
+			const char *l[INFOBOX_LINES];
+			long t = updates / BENCH_PAYLOADS;
+			time_t timestamp = 1337428800 + t * 5;
+			double latitude = 52.0 + p * 0.1 + t * 1e-4;
+			double longitude = -1.0 + t * 2e-4;
+			double altitude = (p % 2 == 0 ? t * 25 % 30000 : 30000);
+			struct tm tm;
+			int i;
+			
+			snprintf(title, sizeof(title), "PAYLOAD%i", p);
+			
+			if(old)
+			{
+				_render(&surfaces[p], icon, title, timestamp, latitude, longitude, altitude, altitude);
+				lines += INFOBOX_LINES;
+				continue;
+			}
+			
+			strftime(text[0], 64, "Time: %Y-%m-%d %H:%M:%S", gmtime_r(&timestamp, &tm));
+			snprintf(text[1], 64, "Position: %.5f, %.5f", latitude, longitude);
+			snprintf(text[2], 64, "Altitude: %i m", (int) altitude);
+			snprintf(text[3], 64, "Max. Altitude: %i m", (int) altitude);
+			
+			for(i = 0; i < INFOBOX_LINES; i++) l[i] = text[i];
+			
+			lines += infobox_update(&boxes[p], icon, title, l);
+		}
+	}
+	while((elapsed = bench_now() - start) < BENCH_TIME);
+	
+	for(p = 0; p < BENCH_PAYLOADS; p++)
+	{
+		if(surfaces[p]) cairo_surface_destroy(surfaces[p]);
+		infobox_free(&boxes[p]);
+	}
+	
+	*redrawn = (double) lines / updates;
+	
+	return(elapsed * 1e6 / updates);
+}
+
+int main(int argc, char *argv[])
+{
+	const atlas_icon_t *icon;
+	double base, us, redrawn;
+	
+	if(atlas_load() != 0) return(1);
+	icon = atlas_icon("balloon", "blue", NULL);
+	
+	printf("# infobox\tus/update\tlines/update\tx render\n");
+	
+	base = _run(1, icon, &redrawn);
+	printf("render\t%.2f\t%.2f\t%.2f\n", base, redrawn, 1.0);
+	
+	us = _run(0, icon, &redrawn);
+	printf("infobox\t%.2f\t%.2f\t%.2f\n", us, redrawn, base / us);
+	
+	atlas_free();
+	
+	return(0);
+}
+
@@ -0,0 +1,209 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Throughput of framing the changes feed into lines, as libcurl hands it
+ * over in chunks of several sizes. linebuf is set against the accumulator
+ * strbuf_callback() used before it, which copied everything pending on
+ * each chunk and moved the rest down after each line. The feed is a
+ * synthetic capture, or a recorded one (gzipped or not) given on the
+ * command line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "../linebuf.h"
+#include "bench.h"
+
+#define BENCH_LINES   (2000)
+#define BENCH_OBJECTS (50)
+
+static const size_t chunks[] = { 1, 16, 256, 4096, 65536 };
+
+/* The old accumulator, less the parsing. Returns the lines found */
+static long _old_append(char **text, size_t *length, const char *ptr, size_t size)
+{
+	long lines = 0;
+	char *s;
+	
+	if(*text == NULL)
+	{
+		*text = strndup(ptr, size);
+		*length = size;
+	}
+	else
+	{
+		s = malloc(*length + size + 1);
+		strcpy(s, *text);
+		strncat(s, ptr, size);
+		free(*text);
+		*text = s;
+		*length += size;
+	}
+	
+	while((s = strstr(*text, "\n")) != NULL)
+	{
+		s[0] = '\0';
+		if(strlen(*text) > 0) lines++;
+		
+		s++;
+		*length = strlen(s);
+		memmove(*text, s, *length + 1);
+	}
+	
+	return(lines);
+}
+
+static long _new_append(linebuf_t *lb, const char *ptr, size_t size)
+{
+	long lines = 0;
+	size_t length;
+	
+	if(linebuf_append(lb, ptr, size) != 0) return(-1);
+	while(linebuf_next(lb, &length)) if(length > 0) lines++;
+	
+	return(lines);
+}
+
+/* Feed the data over and over in chunks of the given size for at least
+ * BENCH_TIME, checking the clock every so often. Returns the seconds
+ * taken and sets the bytes fed and lines framed */
+static double _run(int old, const char *data, size_t length, size_t chunk, double *bytes, long *lines)
+{
+	double start = bench_now(), elapsed;
+	linebuf_t lb = { 0 };
+	char *text = NULL;
+	size_t tlength = 0, o, n;
+	int i = 0;
+	
+	*bytes = 0;
+	*lines = 0;
+	
+	do
+	{
+		for(o = 0; o < length; o += n)
+		{
+			n = length - o < chunk ? length - o : chunk;
+			
+			if(old) *lines += _old_append(&text, &tlength, data + o, n);
+			else *lines += _new_append(&lb, data + o, n);
+			
+			*bytes += n;
+			if(++i % 1024 == 0 && bench_now() - start >= BENCH_TIME) break;
+		}
+	}
+	while((elapsed = bench_now() - start) < BENCH_TIME);
+	
+	free(text);
+	linebuf_free(&lb);
+	
+	return(elapsed);
+}
+
+/* Read a whole capture into memory */
+static char *_load(const char *path, size_t *length)
+{
+	char *data = NULL, *d;
+	size_t size = 0;
+	gzFile gz;
+	int n = 0;
+	
+	gz = gzopen(path, "rb");
+	if(!gz)
+	{
+		perror(path);
+		return(NULL);
+	}
+	
+	*length = 0;
+	do
+	{
+		if(size - *length < 65536)
+		{
+			size = size ? size * 2 : 1 << 20;
+			d = realloc(data, size);
+			if(!d)
+			{
+				n = -1;
+				break;
+			}
+			data = d;
+		}
+		
+		n = gzread(gz, data + *length, 65536);
+		if(n > 0) *length += n;
+	}
+	while(n > 0);
+	
+	gzclose(gz);
+	
+	if(n < 0 || *length == 0)
+	{
+		fprintf(stderr, "Failed to read %s\n", path);
+		free(data);
+		return(NULL);
+	}
+	
+	return(data);
+}
+
+int main(int argc, char *argv[])
+{
+	char *data;
+	size_t length, c;
+	int i, l, old;
+	
+	if(argc > 1)
+	{
+		data = _load(argv[1], &length);
+		if(!data) return(1);
+	}
+	else
+	{
+		data = malloc(BENCH_LINES * BENCH_LINE_MAX);
+		if(!data) return(1);
+		
+		for(length = 0, i = 0; i < BENCH_LINES; i++)
+		{
+			l = bench_line(data + length, BENCH_LINE_MAX - 1, i, BENCH_OBJECTS);
+			length += l;
+			data[length++] = '\n';
+		}
+	}
+	
+	printf("# chunk\tframer\tMB/s\tlines/s\n");
+	
+	for(c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++)
+	{
+		for(old = 1; old >= 0; old--)
+		{
+			double elapsed, bytes;
+			long lines;
+			
+			elapsed = _run(old, data, length, chunks[c], &bytes, &lines);
+			
+			printf("%zu\t%s\t%.1f\t%.0f\n", chunks[c], old ? "strbuf" : "linebuf",
+				bytes / elapsed / 1e6, lines / elapsed);
+		}
+	}
+	
+	free(data);
+	
+	return(0);
+}
+
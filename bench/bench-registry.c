@@ -0,0 +1,177 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Lookups per second in the object registry at 100, 10k and 100k
+ * objects, against the linear strcmp() scan of a NULL terminated array
+ * that find_map_object() did before it, grown one slot at a time by
+ * realloc() as new_map_object() did. The time to add every object is
+ * also given. Callsigns are a mix of payloads, listeners and chase
+ * cars, interned as the core's are, and looked up in a random order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core.h"
+#include "../intern.h"
+#include "../registry.h"
+#include "bench.h"
+
+static const int sizes[] = { 100, 10000, 100000 };
+
+typedef struct {
+	hab_object_type_t type;
+	char *callsign;
+} object_t;
+
+static object_t **objects;
+
+static object_t *_find(hab_object_type_t type, const char *callsign)
+{
+	int i;
+	
+	if(!objects) return(NULL);
+	
+	for(i = 0; objects[i]; i++)
+	{
+		if(objects[i]->type == type &&
+		   strcmp(objects[i]->callsign, callsign) == 0) return(objects[i]);
+	}
+	
+	return(NULL);
+}
+
+static int _add(hab_object_type_t type, const char *callsign)
+{
+	object_t *obj, **o;
+	int i;
+	
+	obj = calloc(sizeof(object_t), 1);
+	if(!obj || !(obj->callsign = strdup(callsign))) return(-1);
+	obj->type = type;
+	
+	for(i = 0; objects && objects[i]; i++);
+	
+	o = realloc(objects, sizeof(object_t *) * (i + 2));
+	if(!o) return(-1);
+	
+	objects = o;
+	objects[i] = obj;
+	objects[i + 1] = NULL;
+	
+	return(0);
+}
+
+static void _free(void)
+{
+	int i;
+	
+	for(i = 0; objects && objects[i]; i++)
+	{
+		free(objects[i]->callsign);
+		free(objects[i]);
+	}
+	
+	free(objects);
+	objects = NULL;
+}
+
+/* The callsign and type of object i */
+static const char *_callsign(int i, hab_object_type_t *type)
+{
+	char s[32];
+	
+	switch(i % 10)
+	{
+	case 0: *type = HAB_PAYLOAD; snprintf(s, sizeof(s), "PAYLOAD%i", i); break;
+	case 1: *type = HAB_CHASE; snprintf(s, sizeof(s), "M0ABC-chase%i", i); break;
+	default: *type = HAB_LISTENER; snprintf(s, sizeof(s), "M%iXYZ", i); break;
+	}
+	
+	return(intern(s));
+}
+
+int main(int argc, char *argv[])
+{
+	static hab_object_type_t types[100000];
+	static const char *callsigns[100000];
+	static int order[65536];
+	int s, i, n, old;
+	
+	for(i = 0; i < 100000; i++)
+	{
+		callsigns[i] = _callsign(i, &types[i]);
+		if(!callsigns[i]) return(1);
+	}
+	
+	printf("# objects\tindex\tadd us/object\tlookups/s\tx scan\n");
+	
+	for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		double base = 0;
+		
+		srand(1);
+		for(i = 0; i < 65536; i++) order[i] = rand() % sizes[s];
+		
+		for(old = 1; old >= 0; old--)
+		{
+			registry_t r;
+			double start, add, elapsed;
+			long lookups = 0;
+			int found = 0;
+			
+			memset(&r, 0, sizeof(r));
+			
+			start = bench_now();
+			for(i = 0; i < sizes[s]; i++)
+			{
+				if(old ? _add(types[i], callsigns[i]) :
+				   registry_add(&r, types[i], callsigns[i], &callsigns[i]) < 0) return(1);
+			}
+			add = bench_now() - start;
+			
+			start = bench_now();
+			do
+			{
+				for(n = 0; n < 256; n++, lookups++)
+				{
+					i = order[lookups & 65535];
+					if(old ? _find(types[i], callsigns[i]) != NULL :
+					   registry_find(&r, types[i], callsigns[i]) != NULL) found++;
+				}
+			}
+			while((elapsed = bench_now() - start) < BENCH_TIME);
+			
+			if(found != lookups)
+			{
+				fprintf(stderr, "%li lookups, %i found\n", lookups, found);
+				return(1);
+			}
+			
+			if(old) base = lookups / elapsed;
+			
+			printf("%i\t%s\t%.3f\t%.0f\t%.1f\n", sizes[s], old ? "scan" : "registry",
+				add * 1e6 / sizes[s], lookups / elapsed, lookups / elapsed / base);
+			
+			if(old) _free();
+			else registry_free(&r);
+		}
+	}
+	
+	return(0);
+}
+
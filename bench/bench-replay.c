@@ -0,0 +1,151 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* End to end throughput of --replay played flat out: reading the
+ * capture, parsing each line, queueing the update and draining it as
+ * the front end would, woken through an eventfd as headless.c is. The
+ * capture is synthetic, habitat shaped documents for 50 payloads, and
+ * is played both as plain text and gzipped, or a real one can be
+ * given on the command line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "../core.h"
+#include "../replay.h"
+#include "../log.h"
+#include "bench.h"
+
+#define BENCH_LINES   (200000)
+#define BENCH_OBJECTS (50)
+
+static int efd;
+
+static void cb_wake(void)
+{
+	uint64_t n = 1;
+	
+	if(write(efd, &n, sizeof(n)) != sizeof(n)) return;
+}
+
+static void cb_status(char *message)
+{
+	free(message);
+}
+
+static void cb_update(void *user, hab_update_t *u, hab_object_t *obj)
+{
+}
+
+/* Play the capture at path until the expected number of updates
+ * have been drained, or none have come for a second if expect is 0.
+ * Returns the seconds until the last was drained, or -1 on failure */
+static double _run(const char *path, unsigned int expect, unsigned int *drained)
+{
+	core_hooks_t hooks = { cb_wake, cb_status };
+	core_source_t *src;
+	src_replay_t *r;
+	double start, last;
+	
+	if(core_init(&hooks) != 0 || !(src = core_add_source("replay"))) return(-1);
+	
+	*drained = 0;
+	start = last = bench_now();
+	
+	r = src_replay_start(path, 0, src);
+	if(!r)
+	{
+		core_free();
+		return(-1);
+	}
+	
+	while(!expect || *drained < expect)
+	{
+		struct pollfd p = { efd, POLLIN, 0 };
+		uint64_t n;
+		
+		if(poll(&p, 1, expect ? 5000 : 1000) <= 0) break;
+		if(read(efd, &n, sizeof(n)) != sizeof(n)) continue;
+		
+		*drained += core_drain(cb_update, NULL, NULL);
+		last = bench_now();
+	}
+	
+	src_replay_stop(r);
+	core_free();
+	
+	if(expect && *drained != expect)
+	{
+		fprintf(stderr, "Only %u of %u updates arrived\n", *drained, expect);
+		return(-1);
+	}
+	
+	return(last - start);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int drained;
+	double elapsed;
+	int gzipped;
+	
+	/* Just the results */
+	log_level = LOG_LEVEL_WARN;
+	
+	efd = eventfd(0, EFD_CLOEXEC);
+	if(efd == -1)
+	{
+		perror("eventfd");
+		return(1);
+	}
+	
+	printf("# capture\tupdates\tseconds\tupdates/s\n");
+	
+	/* A real capture, if one is given */
+	if(argc > 1)
+	{
+		elapsed = _run(argv[1], 0, &drained);
+		if(elapsed < 0) return(1);
+		
+		printf("%s\t%u\t%.3f\t%.0f\n", argv[1], drained, elapsed, elapsed > 0 ? drained / elapsed : 0);
+	}
+	
+	else for(gzipped = 0; gzipped <= 1; gzipped++)
+	{
+		char *path = bench_capture(BENCH_LINES, BENCH_OBJECTS, gzipped);
+		
+		if(!path) return(1);
+		
+		elapsed = _run(path, BENCH_LINES, &drained);
+		
+		unlink(path);
+		free(path);
+		
+		if(elapsed < 0) return(1);
+		
+		printf("%s\t%u\t%.3f\t%.0f\n", gzipped ? "gzip" : "plain", drained, elapsed, drained / elapsed);
+	}
+	
+	close(efd);
+	
+	return(0);
+}
+
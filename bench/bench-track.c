@@ -0,0 +1,182 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Time for the map to redraw with one payload's track of 1k, 10k and 30k
+ * points (a 3 hour flight at 1 Hz is about 10k), given to osm-gps-map
+ * point by point as before, and as the line track.c simplifies to about
+ * a pixel. The time to add the points is also given. The flight wanders
+ * at random, about 11 m a second, and the map is fitted around it with
+ * no tiles, so only the track is drawn.
+ *
+ * Built by "make bench-gui". The map is drawn in an offscreen window but
+ * GTK still needs a display, so run it under xvfb-run if there isn't one.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <gtk/gtk.h>
+#include <osm-gps-map.h>
+#include "../track.h"
+#include "bench.h"
+
+#define BENCH_WIDTH  (1024)
+#define BENCH_HEIGHT (768)
+
+static const int lengths[] = { 1000, 10000, 30000 };
+
+static OsmGpsMap *map;
+
+static void _flush(void)
+{
+	while(gtk_events_pending()) gtk_main_iteration();
+}
+
+/* A flight of n points, wandering at random */
+static void _flight(float *lat, float *lng, int n)
+{
+	double la = 52.0, lo = -1.0, h = 0;
+	int i;
+	
+	srand(1);
+	for(i = 0; i < n; i++)
+	{
+		h += (rand() % 100 - 50) / 500.0;
+		la += cos(h) * 1e-4;
+		lo += sin(h) * 1.5e-4;
+		lat[i] = la;
+		lng[i] = lo;
+	}
+}
+
+/* Pan back and forth a few pixels until BENCH_TIME has passed, letting
+ * the map redraw each time. Returns the milliseconds per redraw */
+static double _redraw(double latitude, double longitude)
+{
+	double start = bench_now(), elapsed;
+	long n = 0;
+	
+	do
+	{
+		osm_gps_map_set_center(map, latitude + (n % 2) * 1e-4, longitude);
+		_flush();
+		n++;
+	}
+	while((elapsed = bench_now() - start) < BENCH_TIME);
+	
+	return(elapsed * 1000 / n);
+}
+
+int main(int argc, char *argv[])
+{
+	static float lat[30000], lng[30000];
+	GtkWidget *window;
+	int l, i, old;
+	
+	gtk_init(&argc, &argv);
+	
+	window = gtk_offscreen_window_new();
+	map = g_object_new(OSM_TYPE_GPS_MAP,
+		"map-source", OSM_GPS_MAP_SOURCE_NULL,
+		"tile-cache", OSM_GPS_MAP_CACHE_DISABLED,
+		NULL);
+	gtk_widget_set_size_request(GTK_WIDGET(map), BENCH_WIDTH, BENCH_HEIGHT);
+	gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(map));
+	gtk_widget_show_all(window);
+	_flush();
+	
+	_flight(lat, lng, 30000);
+	
+	printf("# points\ttrack\tvertices\tadd ms\tredraw ms\n");
+	
+	for(l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+	{
+		float la1 = lat[0], la2 = lat[0], lo1 = lng[0], lo2 = lng[0];
+		double epsilon, start, add;
+		int n = lengths[l], zoom;
+		
+		for(i = 1; i < n; i++)
+		{
+			if(lat[i] < la1) la1 = lat[i];
+			if(lat[i] > la2) la2 = lat[i];
+			if(lng[i] < lo1) lo1 = lng[i];
+			if(lng[i] > lo2) lo2 = lng[i];
+		}
+		
+		osm_gps_map_zoom_fit_bbox(map, la1, la2, lo1, lo2);
+		_flush();
+		
+		/* As track_epsilon() in habhound.c, a pixel at this zoom */
+		g_object_get(map, "zoom", &zoom, NULL);
+		epsilon = 2 * M_PI * 6378137.0 * cos((la1 + la2) / 2 * M_PI / 180.0) / (256 << zoom);
+		
+		for(old = 1; old >= 0; old--)
+		{
+			OsmGpsMapTrack *line = NULL;
+			track_t *t = NULL;
+			int vertices;
+			
+			start = bench_now();
+			
+			if(old)
+			{
+				line = osm_gps_map_track_new();
+				osm_gps_map_track_add(map, line);
+				
+				for(i = 0; i < n; i++)
+				{
+					OsmGpsMapPoint p;
+					
+					osm_gps_map_point_set_degrees(&p, lat[i], lng[i]);
+					osm_gps_map_track_add_point(line, &p);
+				}
+				
+				vertices = n;
+			}
+			else
+			{
+				t = track_new(map, epsilon);
+				if(!t) return(1);
+				
+				for(i = 0; i < n; i++)
+					if(track_add(t, lat[i], lng[i], 0) != 0) return(1);
+				
+				vertices = t->shown_count;
+			}
+			
+			add = (bench_now() - start) * 1000;
+			_flush();
+			
+			printf("%i\t%s\t%i\t%.1f\t%.3f\n", n, old ? "every point" : "track.c",
+				vertices, add, _redraw((la1 + la2) / 2, (lo1 + lo2) / 2));
+			
+			if(old)
+			{
+				osm_gps_map_track_remove(map, line);
+				g_object_unref(G_OBJECT(line));
+			}
+			else track_free(t);
+			
+			_flush();
+		}
+	}
+	
+	gtk_widget_destroy(window);
+	
+	return(0);
+}
+
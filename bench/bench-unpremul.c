@@ -0,0 +1,97 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Throughput of each conversion in unpremul.c, against the original loop
+ * that divides, on square icons of several sizes. The pixels are random
+ * but valid premultiplied values, with a quarter fully transparent and a
+ * quarter opaque, roughly as a rendered marker is.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../unpremul.h"
+#include "bench.h"
+
+static const int sizes[] = { 16, 32, 64, 128 };
+
+static const struct {
+	unpremul_kernel_t kernel;
+	const char *name;
+} kernels[] = {
+	{ UNPREMUL_DIVIDE, "divide" },
+	{ UNPREMUL_SCALAR, "scalar" },
+	{ UNPREMUL_SSE2,   "sse2" },
+	{ UNPREMUL_AVX2,   "avx2" },
+};
+
+/* Convert a whole icon, a row at a time as marker.c does. Returns the
+ * rate in millions of pixels per second */
+static double _run(const uint32_t *src, uint8_t *dst, int size)
+{
+	double start = bench_now(), elapsed;
+	long n = 0;
+	int y;
+	
+	do
+	{
+		for(y = 0; y < size; y++)
+			unpremultiply_row(dst + y * size * 4, src + y * size, size);
+		n++;
+	}
+	while((elapsed = bench_now() - start) < BENCH_TIME);
+	
+	return(n * size * size / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	static uint32_t src[128 * 128];
+	static uint8_t dst[128 * 128 * 4];
+	int i, k, s;
+	
+	srand(1);
+	for(i = 0; i < 128 * 128; i++)
+	{
+		uint32_t a = rand() % 4 == 0 ? 0 : rand() % 3 == 0 ? 255 : rand() % 256;
+		
+		src[i] = a << 24;
+		if(a > 0) src[i] |= (rand() % (a + 1)) << 16 | (rand() % (a + 1)) << 8 | (rand() % (a + 1));
+	}
+	
+	printf("# icon\tkernel\tMpixel/s\tx divide\n");
+	
+	for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		double base = 0;
+		
+		for(k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+		{
+			double rate;
+			
+			if(unpremultiply_use(kernels[k].kernel) != 0) continue;
+			
+			rate = _run(src, dst, sizes[s]);
+			if(k == 0) base = rate;
+			
+			printf("%ix%i\t%s\t%.1f\t%.2f\n", sizes[s], sizes[s], kernels[k].name, rate, rate / base);
+		}
+	}
+	
+	return(0);
+}
+
@@ -0,0 +1,127 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Helpers shared by the tests and benchmarks. Each is a program of its
+ * own, test-* run by "make check" and exiting non-zero on failure, and
+ * bench-* run by "make bench", writing tab separated results to stdout.
+ * Neither needs GTK.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <zlib.h>
+#include "bench.h"
+
+/* Monotonic time in seconds */
+double bench_now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/* Write line i of a synthetic changes feed into buf, returning its
+ * length without the newline. Documents are shaped like habitat's,
+ * receivers and all, for a fleet of the given number of objects.
+ * Every tenth is listener telemetry, the rest parsed payload
+ * telemetry with a sentence of its own */
+int bench_line(char *buf, size_t size, int i, int objects)
+{
+	int o = i % objects;
+	double lat = 50.0 + o * 0.01 + i * 1e-6;
+	double lng = -1.0 - o * 0.01 + i * 1e-6;
+	
+	if(i % 10 == 9) return(snprintf(buf, size,
+		"{\"seq\":%i,\"id\":\"%032x\",\"changes\":[{\"rev\":\"1-%08x\"}],"
+		"\"doc\":{\"_id\":\"%032x\",\"_rev\":\"1-%08x\",\"type\":\"listener_telemetry\","
+		"\"time_created\":\"2012-05-19T13:05:21+01:00\",\"time_uploaded\":\"2012-05-19T13:05:22+01:00\","
+		"\"data\":{\"callsign\":\"L%i\",\"latitude\":%.6f,\"longitude\":%.6f,\"altitude\":%i}}}",
+		i + 1, i, i, i, i, o, lat, lng, 100 + o));
+	
+	return(snprintf(buf, size,
+		"{\"seq\":%i,\"id\":\"%032x\",\"changes\":[{\"rev\":\"1-%08x\"}],"
+		"\"doc\":{\"_id\":\"%032x\",\"_rev\":\"1-%08x\",\"type\":\"payload_telemetry\","
+		"\"data\":{\"_raw\":\"JCRQJWksJWksMTM6MDU6MjEsNTAuMTIzNDU2LC0xLjEyMzQ1NiwxMjM0NSo0NUFCCg==\","
+		"\"_sentence\":\"$$P%i,%i,13:05:21,%.6f,%.6f,%i*45AB\\n\",\"_protocol\":\"UKHAS\","
+		"\"_parsed\":{\"time_parsed\":\"2012-05-19T13:05:23+01:00\",\"payload_configuration\":\"%032x\","
+		"\"configuration_sentence_index\":0},\"payload\":\"P%i\",\"sentence_id\":%i,\"time\":\"13:05:21\","
+		"\"latitude\":%.6f,\"longitude\":%.6f,\"altitude\":%i,\"satellites\":9,\"battery\":3.21,"
+		"\"temperature_internal\":12.5},"
+		"\"receivers\":{\"M0ABC\":{\"time_created\":\"2012-05-19T13:05:21+01:00\","
+		"\"time_uploaded\":\"2012-05-19T13:05:22+01:00\",\"time_server\":\"2012-05-19T12:05:22.123456+00:00\","
+		"\"rig_info\":{\"frequency\":434075000},\"latest_listener_information\":\"%032x\","
+		"\"latest_listener_telemetry\":\"%032x\"},"
+		"\"2E0XYZ\":{\"time_created\":\"2012-05-19T13:05:21+01:00\","
+		"\"time_uploaded\":\"2012-05-19T13:05:24+01:00\",\"time_server\":\"2012-05-19T12:05:24.654321+00:00\","
+		"\"latest_listener_information\":\"%032x\",\"latest_listener_telemetry\":\"%032x\"}}}}",
+		i + 1, i, i, i, i, o, i, lat, lng, 1000 + i % 30000, o, o, i, lat, lng, 1000 + i % 30000,
+		1, 2, 3, 4));
+}
+
+/* Write a capture of the given number of lines to a temporary file,
+ * gzipped if asked, returning its path for the caller to unlink and
+ * free, or NULL on failure */
+char *bench_capture(int lines, int objects, int gzipped)
+{
+	char path[] = "/tmp/habhound-bench-XXXXXX";
+	char line[BENCH_LINE_MAX];
+	gzFile gz;
+	int fd, i, l;
+	
+	fd = mkstemp(path);
+	if(fd == -1)
+	{
+		perror("mkstemp");
+		return(NULL);
+	}
+	
+	gz = gzdopen(fd, gzipped ? "wb6" : "wbT");
+	if(!gz)
+	{
+		close(fd);
+		unlink(path);
+		return(NULL);
+	}
+	
+	for(i = 0; i < lines; i++)
+	{
+		l = bench_line(line, sizeof(line) - 1, i, objects);
+		line[l++] = '\n';
+		
+		if(gzwrite(gz, line, l) != l)
+		{
+			fprintf(stderr, "Failed to write %s\n", path);
+			gzclose(gz);
+			unlink(path);
+			return(NULL);
+		}
+	}
+	
+	if(gzclose(gz) != Z_OK)
+	{
+		unlink(path);
+		return(NULL);
+	}
+	
+	return(strdup(path));
+}
+
@@ -0,0 +1,34 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stddef.h>
+
+/* How long each benchmark is run for, at least, in seconds */
+#define BENCH_TIME (0.5)
+
+/* Longest line bench_line() writes */
+#define BENCH_LINE_MAX (2048)
+
+extern double bench_now(void);
+extern int bench_line(char *buf, size_t size, int i, int objects);
+extern char *bench_capture(int lines, int objects, int gzipped);
+
+#endif /* __BENCH_H__ */
+
@@ -0,0 +1,103 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Checks every conversion in unpremul.c against the original loop that
+ * divides, for every pair of alpha and channel value. That includes the
+ * pairs where the channel is larger than the alpha, which a premultiplied
+ * surface shouldn't hold but must still come out the same. Each channel
+ * is given a different value, to catch them being swapped, and rows are
+ * converted from each of 9 starting offsets so that every pixel passes
+ * through both the vector loops and the scalar ends of the rows.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../unpremul.h"
+
+/* Every alpha and channel pair, plus room to start at each offset */
+#define PAIRS   (256 * 256)
+#define OFFSETS (9)
+
+static const struct {
+	unpremul_kernel_t kernel;
+	const char *name;
+} kernels[] = {
+	{ UNPREMUL_SCALAR, "scalar" },
+	{ UNPREMUL_SSE2,   "sse2" },
+	{ UNPREMUL_AVX2,   "avx2" },
+};
+
+int main(int argc, char *argv[])
+{
+	static uint32_t src[PAIRS + OFFSETS];
+	static uint8_t want[(PAIRS + OFFSETS) * 4];
+	static uint8_t got[(PAIRS + OFFSETS) * 4];
+	int i, k, offset, failed = 0;
+	
+	/* Pixel i has alpha i / 256 and red i % 256. Green and blue
+	 * are rotated by a third, so each also takes every value */
+	for(i = 0; i < PAIRS + OFFSETS; i++)
+	{
+		uint32_t a = (i / 256) & 0xFF, c = i % 256;
+		src[i] = a << 24 | c << 16 | ((c + 85) & 0xFF) << 8 | ((c + 170) & 0xFF);
+	}
+	
+	unpremultiply_use(UNPREMUL_DIVIDE);
+	unpremultiply_row(want, src, PAIRS + OFFSETS);
+	
+	for(k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+	{
+		long bad = 0;
+		
+		if(unpremultiply_use(kernels[k].kernel) != 0)
+		{
+			printf("unpremul %s: not supported by this CPU, skipped\n", kernels[k].name);
+			continue;
+		}
+		
+		for(offset = 0; offset < OFFSETS; offset++)
+		{
+			memset(got, 0xAA, sizeof(got));
+			unpremultiply_row(got, src + offset, PAIRS);
+			
+			for(i = 0; i < PAIRS * 4; i++)
+			{
+				if(got[i] == want[offset * 4 + i]) continue;
+				
+				if(bad++ == 0)
+					fprintf(stderr, "unpremul %s: pixel %08X at offset %i, byte %i is %i, expected %i\n",
+						kernels[k].name, src[offset + i / 4], offset, i % 4,
+						got[i], want[offset * 4 + i]);
+			}
+			
+			/* Nothing written past the end of the row */
+			if(got[PAIRS * 4] != 0xAA)
+			{
+				fprintf(stderr, "unpremul %s: wrote past the end of the row at offset %i\n", kernels[k].name, offset);
+				bad++;
+			}
+		}
+		
+		printf("unpremul %s: %i pairs x %i offsets, %li wrong\n", kernels[k].name, PAIRS, OFFSETS, bad);
+		if(bad) failed = 1;
+	}
+	
+	return(failed);
+}
+
@@ -0,0 +1,617 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* The ingest core, shared by the map and the headless tracker. Each
+ * source pushes position updates into its own queue from its own thread,
+ * and the front end drains them from its main loop with core_drain(),
+ * which keeps the latest state of every object. Nothing in here knows
+ * about GTK -- the front end is reached only through the hooks given
+ * to core_init().
+ *
+ * The queues are merged in the order the updates were pushed. The same
+ * telemetry may arrive from several sources, a mirror as well as the
+ * main server say, so each update carries a key for its sentence and
+ * only the first to arrive is applied. The rest are counted against
+ * their source as duplicates.
+ *
+ * Before that, each source drops updates repeating telemetry it sent
+ * recently -- habitat sends a document again each time another receiver
+ * uploads the same sentence -- on its own thread, before they're queued.
+ *
+ * Sources also report how their feed is doing -- when it last sent
+ * anything, how far behind the server it is and how many documents it's
+ * delivering -- for core_source_stats(). The source's thread writes
+ * these and the front end reads them, each value on its own, so a
+ * snapshot may be slightly out of step with itself.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "core.h"
+#include "updq.h"
+#include "registry.h"
+#include "dupfilter.h"
+#include "metrics.h"
+
+struct _core_source_t {
+	
+	/* Describes the source, for messages */
+	char *name;
+	
+	/* Updates waiting to be merged */
+	updq_t queue;
+	
+	/* Telemetry recently pushed, only used by the source's thread */
+	dupfilter_t recent;
+	
+	/* Repeats of recent telemetry that weren't queued */
+	unsigned long repeats;
+	
+	/* The feed, written by the source's thread */
+	long long last_data; /* When anything was last received, in ms, 0 if never */
+	long seq; /* Last sequence number, -1 if none */
+	long server_seq; /* Server's latest, -1 if not known */
+	unsigned long docs; /* Documents received */
+	long long rate_time; /* Start of the rate window, in ms */
+	unsigned long rate_docs; /* Documents received before it */
+	
+	/* Statistics, only changed while draining */
+	unsigned long updates; /* Updates taken from the queue */
+	unsigned long first; /* Updates this source was first to deliver */
+	unsigned long duplicates; /* Updates another source delivered first */
+	
+	/* Seconds from upload to plotting */
+	double age; /* Of the last update that said, -1 if none */
+	double age_total;
+	unsigned long age_count;
+	
+};
+
+static core_source_t sources[CORE_MAX_SOURCES];
+static int source_count = 0;
+
+/* Set by a source when it has woken the front end,
+ * cleared by the front end as it starts draining */
+static int scheduled = 0;
+
+/* Counts updates as they're pushed, for merging the queues */
+static unsigned int arrivals = 0;
+
+/* Recently applied sentences */
+static dupfilter_t sentences;
+
+/* All the objects, by type and callsign */
+static registry_t objects;
+
+static core_hooks_t hooks;
+
+static long long _mtime(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/* Taken from the GCC manual and cleaned up a bit. */
+char *vmake_message(const char *fmt, va_list ap)
+{
+	/* Start with 100 bytes. */
+	int n, size = 100;
+	char *p;
+	
+	p = (char *) malloc(size);
+	if(!p) return(NULL);
+	
+	while(1)
+	{
+		char *np;
+		va_list apc;
+		
+		/* Try to print in the allocated space. */
+		va_copy(apc, ap);
+		n = vsnprintf(p, size, fmt, apc);
+		
+		/* If that worked, return the string. */
+		if(n > -1 && n < size) return(p);
+		
+		/* Else try again with more space. */
+		if(n > -1) size = n + 1; /* gibc 2.1: exactly what is needed */
+		else size *= 2; /* glibc 2.0: twice the old size */
+		
+		np = (char *) realloc(p, size);
+		if(!np)
+		{
+			free(p);
+			return(NULL);
+		}
+		
+		p = np;
+	}
+	
+	free(p);
+	return(NULL);
+}
+
+char *sprintf_alloc(const char *format, ... )
+{
+	va_list ap;
+	char *msg;
+	
+	va_start(ap, format);
+	msg = vmake_message(format, ap);
+	va_end(ap);
+	
+	return(msg);
+}
+
+int core_init(const core_hooks_t *h)
+{
+	hooks = *h;
+	
+	return(dupfilter_init(&sentences, CORE_DEDUP_SIZE));
+}
+
+/* Add a new source, with its own queue. Sources must all be
+ * added before any are started. Returns NULL on error */
+core_source_t *core_add_source(const char *name)
+{
+	core_source_t *src;
+	
+	if(source_count == CORE_MAX_SOURCES)
+	{
+		fprintf(stderr, "Too many sources, %s not added\n", name);
+		return(NULL);
+	}
+	
+	src = &sources[source_count];
+	memset(src, 0, sizeof(core_source_t));
+	
+	src->name = strdup(name);
+	if(!src->name) return(NULL); /* Out of memory! */
+	
+	src->seq = -1;
+	src->server_seq = -1;
+	src->age = -1;
+	
+	if(updq_init(&src->queue, HABHOUND_QUEUE_SIZE) != 0 ||
+	   dupfilter_init(&src->recent, CORE_REPEAT_SIZE) != 0)
+	{
+		updq_free(&src->queue);
+		free(src->name);
+		return(NULL);
+	}
+	
+	source_count++;
+	
+	return(src);
+}
+
+void core_free(void)
+{
+	hab_object_t *obj;
+	int i;
+	
+	for(i = 0; (obj = registry_get(&objects, i)); i++) free(obj);
+	registry_free(&objects);
+	
+	for(i = 0; i < source_count; i++)
+	{
+		updq_free(&sources[i].queue);
+		dupfilter_free(&sources[i].recent);
+		free(sources[i].name);
+	}
+	
+	source_count = 0;
+	dupfilter_free(&sentences);
+}
+
+/* The key for a payload sentence, from its sentence number and
+ * time of day ("HH:MM:SS" or "HHMMSS", may be NULL) */
+uint64_t core_sentence_key(int sentence_id, const char *time)
+{
+	int h, m, s, secs = 0;
+	
+	if(time && (sscanf(time, "%2d:%2d:%2d", &h, &m, &s) == 3 ||
+	            sscanf(time, "%2d%2d%2d", &h, &m, &s) == 3))
+		secs = h * 3600 + m * 60 + s;
+	
+	return(((uint64_t) (uint32_t) sentence_id << 20 | (secs & 0xFFFFF)) + 1);
+}
+
+/* The key for a document with no sentence number, from its ID.
+ * The top bit keeps these apart from sentence keys */
+uint64_t core_id_key(const char *id)
+{
+	/* FNV-1a */
+	uint64_t h = 14695981039346656037ULL;
+	
+	if(!id || *id == '\0') return(0);
+	
+	while(*id)
+	{
+		h ^= (unsigned char) *(id++);
+		h *= 1099511628211ULL;
+	}
+	
+	return(h | (1ULL << 63));
+}
+
+/* Check whether an update's sentence has already been applied */
+static int _duplicate(hab_update_t *u)
+{
+	if(u->sentence == 0) return(0);
+	
+	/* Callsigns are interned, so the pointer will do */
+	return(dupfilter_check(&sentences, dupfilter_mix(u->sentence ^
+		((uintptr_t) u->callsign * 0x9E3779B97F4A7C15ULL) ^ u->type)));
+}
+
+static uint64_t _bits(double v)
+{
+	uint64_t b;
+	memcpy(&b, &v, sizeof(b));
+	return(b);
+}
+
+/* The fingerprint of an update's telemetry, for spotting repeats */
+static uint64_t _fingerprint(hab_update_t *u)
+{
+	uint64_t h = (uintptr_t) u->callsign * 0x9E3779B97F4A7C15ULL ^ u->type;
+	
+	h = dupfilter_mix(h ^ u->sentence);
+	h = dupfilter_mix(h ^ _bits(u->latitude));
+	h = dupfilter_mix(h ^ _bits(u->longitude));
+	h = dupfilter_mix(h ^ _bits(u->altitude));
+	
+	return(h);
+}
+
+const char *habhound_object_type_name(hab_object_type_t type)
+{
+	switch(type)
+	{
+	case HAB_PAYLOAD: return("payload");
+	case HAB_LISTENER: return("listener");
+	case HAB_CHASE: return("chase");
+	}
+	
+	return("unknown");
+}
+
+/* Apply one update to its object, creating it if it's new. Returns the
+ * object if it was changed, or NULL */
+hab_object_t *core_apply_update(hab_update_t *data)
+{
+	hab_object_t *obj;
+	
+	/* Ignore 0,0 coordinates */
+	if(data->latitude == 0 && data->longitude == 0) return(NULL);
+	
+	/* Is this a known object? */
+	obj = registry_find(&objects, data->type, data->callsign);
+	if(!obj)
+	{
+		obj = calloc(sizeof(hab_object_t), 1);
+		if(!obj) return(NULL); /* Out of memory! */
+		
+		obj->type = data->type;
+		obj->callsign = data->callsign;
+		
+		/* Add the new object to the registry */
+		if(registry_add(&objects, obj->type, obj->callsign, obj) == -1)
+		{
+			/* Failed to add! */
+			free(obj);
+			return(NULL);
+		}
+		
+		metrics_add(&metric_objects, 1);
+	}
+	else
+	{
+		/* Has the data changed from the last time? */
+		if((obj->latitude == data->latitude) &&
+		   (obj->longitude == data->longitude) &&
+		   (obj->altitude  == data->altitude))
+		{
+			/* Nothing has changed, ignore data */
+			return(NULL);
+		}
+	}
+	
+	obj->timestamp = data->timestamp;
+	obj->latitude  = data->latitude;
+	obj->longitude = data->longitude;
+	obj->altitude  = data->altitude;
+	if(data->altitude > obj->max_altitude)
+		obj->max_altitude = data->altitude;
+	
+	if(strcmp(obj->callsign, "2I0VIM") == 0) obj->altitude = 80.0;
+	
+	obj->positions++;
+	
+	return(obj);
+}
+
+/* Drain the source queues, applying each update that isn't a duplicate
+ * and passing it to cb. Updates arriving while this runs are left for
+ * the next call. The last update that changed an object is copied to
+ * *last, which is left alone if none did. Returns the number applied */
+unsigned int core_drain(core_update_cb_t cb, void *user, hab_update_t *last)
+{
+	unsigned int count[CORE_MAX_SOURCES];
+	hab_update_t data, *u;
+	hab_object_t *obj;
+	unsigned int arrival = 0, n = 0;
+	int i, next;
+	
+	/* Any update pushed from here on wakes the front end again. An
+	 * exchange rather than a store, so this synchronises with the
+	 * source's exchange and any push before it is visible */
+	__atomic_exchange_n(&scheduled, 0, __ATOMIC_ACQ_REL);
+	
+	for(i = 0; i < source_count; i++)
+		count[i] = updq_depth(&sources[i].queue);
+	
+	while(1)
+	{
+		core_source_t *src;
+		
+		/* Take whichever waiting update was pushed first */
+		for(next = -1, i = 0; i < source_count; i++)
+		{
+			if(count[i] == 0) continue;
+			
+			u = updq_peek(&sources[i].queue);
+			if(next == -1 || (int) (u->arrival - arrival) < 0)
+			{
+				next = i;
+				arrival = u->arrival;
+			}
+		}
+		
+		if(next == -1) break;
+		
+		src = &sources[next];
+		updq_pop(&src->queue, &data);
+		count[next]--;
+		src->updates++;
+		
+		if(_duplicate(&data))
+		{
+			src->duplicates++;
+			continue;
+		}
+		
+		src->first++;
+		
+		/* How long the telemetry took to get here */
+		if(data.uploaded)
+		{
+			src->age = difftime(time(NULL), data.uploaded);
+			src->age_total += src->age;
+			src->age_count++;
+		}
+		
+		obj = core_apply_update(&data);
+		cb(user, &data, obj);
+		n++;
+		
+		if(obj && last) *last = data;
+	}
+	
+	metrics_add(&metric_updates_applied, n);
+	
+	return(n);
+}
+
+/* Return an object by its index number, in the order first heard */
+hab_object_t *core_get_object(int index)
+{
+	return(registry_get(&objects, index));
+}
+
+/* Queue a position update, with an interned callsign. Called only from
+ * the source's own thread. Returns 0 on success, 1 if the update repeats
+ * telemetry the source sent recently and was suppressed, or -1 if the
+ * queue was full and the update dropped */
+int core_push(core_source_t *src, hab_update_t *u)
+{
+	/* The same sentence often comes again as each receiver uploads it,
+	 * weed those out here before they cost anything more */
+	if(dupfilter_check(&src->recent, _fingerprint(u)))
+	{
+		__atomic_add_fetch(&src->repeats, 1, __ATOMIC_RELAXED);
+		return(1);
+	}
+	
+	u->arrival = __atomic_fetch_add(&arrivals, 1, __ATOMIC_RELAXED);
+	
+	if(updq_push(&src->queue, u) != 0)
+	{
+		/* Queue full, dropped. The next receiver's upload of it
+		 * mustn't be taken for a repeat, or it's never seen */
+		dupfilter_forget(&src->recent, _fingerprint(u));
+		return(-1);
+	}
+	
+	/* Have the front end drain the queues */
+	if(__atomic_exchange_n(&scheduled, 1, __ATOMIC_ACQ_REL) == 0) hooks.wake();
+	
+	return(0);
+}
+
+/* Number of updates waiting in a source's queue */
+unsigned int core_source_depth(core_source_t *src)
+{
+	return(updq_depth(&src->queue));
+}
+
+/* Called by a source whenever its feed sends anything, a heartbeat or
+ * keep-alive included. Only from the source's own thread */
+void core_source_alive(core_source_t *src)
+{
+	__atomic_store_n(&src->last_data, _mtime(), __ATOMIC_RELAXED);
+}
+
+/* Called by a source for each document received, with its sequence
+ * number or -1 if the feed doesn't have them. Only from the source's
+ * own thread */
+void core_source_feed(core_source_t *src, long seq)
+{
+	long long now = _mtime();
+	unsigned long docs = src->docs + 1;
+	
+	__atomic_store_n(&src->last_data, now, __ATOMIC_RELAXED);
+	__atomic_store_n(&src->docs, docs, __ATOMIC_RELAXED);
+	if(seq >= 0) __atomic_store_n(&src->seq, seq, __ATOMIC_RELAXED);
+	
+	/* Start a new rate window once the current one is full */
+	if(now - src->rate_time >= CORE_RATE_WINDOW)
+	{
+		__atomic_store_n(&src->rate_docs, docs - 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&src->rate_time, now, __ATOMIC_RELAXED);
+	}
+}
+
+/* Called by a source when it learns the server's latest sequence number */
+void core_source_server_seq(core_source_t *src, long seq)
+{
+	__atomic_store_n(&src->server_seq, seq, __ATOMIC_RELAXED);
+}
+
+/* Take a snapshot of a source's statistics, by index from 0 in the
+ * order they were added. Only from the front end's thread. Returns
+ * 0 on success, or -1 if there's no such source */
+int core_source_stats(int index, core_stats_t *st)
+{
+	core_source_t *src;
+	long long now = _mtime(), t;
+	long seq, server_seq;
+	
+	if(index < 0 || index >= source_count) return(-1);
+	src = &sources[index];
+	
+	st->name = src->name;
+	
+	t = __atomic_load_n(&src->last_data, __ATOMIC_RELAXED);
+	st->idle = (t ? now - t : -1);
+	
+	/* The server's latest is only checked now and then,
+	 * the feed can overtake it in between */
+	seq = __atomic_load_n(&src->seq, __ATOMIC_RELAXED);
+	server_seq = __atomic_load_n(&src->server_seq, __ATOMIC_RELAXED);
+	st->seq = seq;
+	st->lag = -1;
+	if(seq >= 0 && server_seq >= 0) st->lag = (server_seq > seq ? server_seq - seq : 0);
+	
+	/* Documents since the window started. The window runs on while
+	 * the feed is quiet, so the rate falls away rather than sticking */
+	st->docs = __atomic_load_n(&src->docs, __ATOMIC_RELAXED);
+	t = __atomic_load_n(&src->rate_time, __ATOMIC_RELAXED);
+	st->rate = 0;
+	if(t && now > t)
+		st->rate = (st->docs - __atomic_load_n(&src->rate_docs, __ATOMIC_RELAXED)) * 1000.0 / (now - t);
+	
+	st->age = src->age;
+	st->mean_age = (src->age_count ? src->age_total / src->age_count : -1);
+	
+	st->updates = src->updates;
+	st->first = src->first;
+	st->duplicates = src->duplicates;
+	st->repeats = __atomic_load_n(&src->repeats, __ATOMIC_RELAXED);
+	st->dropped = __atomic_load_n(&src->queue.drops, __ATOMIC_RELAXED);
+	
+	return(0);
+}
+
+/* Get the update queue statistics, totalled over every source */
+void habhound_get_queue_stats(unsigned int *depth, unsigned int *max_depth, unsigned int *drops)
+{
+	unsigned int d = 0, m = 0, n = 0;
+	int i;
+	
+	for(i = 0; i < source_count; i++)
+	{
+		updq_t *q = &sources[i].queue;
+		
+		d += updq_depth(q);
+		m += __atomic_load_n(&q->max_depth, __ATOMIC_RELAXED);
+		n += __atomic_load_n(&q->drops, __ATOMIC_RELAXED);
+	}
+	
+	if(depth) *depth = d;
+	if(max_depth) *max_depth = m;
+	if(drops) *drops = n;
+}
+
+/* Print how each source has done */
+void core_print_sources(FILE *f)
+{
+	int i;
+	
+	for(i = 0; i < source_count; i++)
+	{
+		core_source_t *src = &sources[i];
+		
+		fprintf(f, "%s: %lu updates, %lu first, %lu duplicates, %lu repeats, %u dropped\n",
+			src->name, src->updates, src->first, src->duplicates,
+			__atomic_load_n(&src->repeats, __ATOMIC_RELAXED),
+			__atomic_load_n(&src->queue.drops, __ATOMIC_RELAXED));
+	}
+}
+
+/* Write every source's statistics, one line each of tab separated
+ * name=value pairs, for other programs to read */
+void core_dump_stats(FILE *f)
+{
+	core_stats_t st;
+	int i;
+	
+	for(i = 0; core_source_stats(i, &st) == 0; i++)
+	{
+		fprintf(f, "source=%s\tidle_ms=%lld\tseq=%ld\tlag=%ld\tdocs=%lu\tdocs_per_sec=%.2f\t"
+			"age=%.0f\tmean_age=%.1f\tupdates=%lu\tfirst=%lu\tduplicates=%lu\trepeats=%lu\tdropped=%u\n",
+			st.name, st.idle, st.seq, st.lag, st.docs, st.rate, st.age, st.mean_age,
+			st.updates, st.first, st.duplicates, st.repeats, st.dropped);
+	}
+	
+	fflush(f);
+}
+
+/* Set the status message */
+void habhound_set_status(char *message, ... )
+{
+	va_list ap;
+	char *s;
+	
+	if(!message) return;
+	
+	va_start(ap, message);
+	s = vmake_message(message, ap);
+	va_end(ap);
+	
+	if(!s) return;
+	
+	hooks.status(s);
+}
+
@@ -0,0 +1,164 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __CORE_H__
+#define __CORE_H__
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+/* Maximum number of updates waiting to be applied, per source */
+#define HABHOUND_QUEUE_SIZE (8192)
+
+/* Maximum number of sources */
+#define CORE_MAX_SOURCES (16)
+
+/* Number of recently seen sentences remembered for spotting
+ * duplicates from different sources, a power of two */
+#define CORE_DEDUP_SIZE (16384)
+
+/* Number of recent updates each source remembers for spotting
+ * repeats of its own telemetry, a power of two */
+#define CORE_REPEAT_SIZE (1024)
+
+/* Period over which a source's document rate is measured, in ms */
+#define CORE_RATE_WINDOW (5000)
+
+typedef enum {
+	HAB_PAYLOAD,
+	HAB_LISTENER,
+	HAB_CHASE,
+} hab_object_type_t;
+
+/* A single position update */
+typedef struct {
+	const char *callsign; /* Interned */
+	hab_object_type_t type;
+	time_t timestamp;
+	double latitude;
+	double longitude;
+	double altitude;
+	
+	/* Identifies the telemetry, so the same sentence heard by more
+	 * than one source is only applied once. 0 if unknown */
+	uint64_t sentence;
+	
+	/* When the telemetry was first uploaded to the server, for
+	 * measuring how late it is by the time it's plotted. 0 if unknown */
+	time_t uploaded;
+	
+	/* Set by core_push(), the order the sources delivered updates */
+	unsigned int arrival;
+} hab_update_t;
+
+/* The latest known state of a tracked object */
+typedef struct {
+	hab_object_type_t type;
+	const char *callsign; /* Interned */
+	
+	time_t timestamp;
+	double latitude;
+	double longitude;
+	double altitude;
+	
+	double max_altitude;
+	
+	/* Number of positions applied */
+	unsigned long positions;
+	
+	/* Free for the front end to use */
+	void *user;
+	
+} hab_object_t;
+
+/* A source of updates, see core.c */
+typedef struct _core_source_t core_source_t;
+
+/* A snapshot of a source's statistics, from core_source_stats() */
+typedef struct {
+	const char *name;
+	
+	/* Milliseconds since the source last received anything, even a
+	 * heartbeat, or -1 if it never has */
+	long long idle;
+	
+	/* Position in the feed, and how far it is behind the server's
+	 * latest. Both -1 if the source doesn't have sequence numbers */
+	long seq;
+	long lag;
+	
+	/* Documents received, and per second over the last few seconds */
+	unsigned long docs;
+	double rate;
+	
+	/* Seconds from upload to plotting, for the last update and on
+	 * average. -1 if no update has said when it was uploaded */
+	double age;
+	double mean_age;
+	
+	unsigned long updates;
+	unsigned long first;
+	unsigned long duplicates;
+	unsigned long repeats;
+	unsigned int dropped;
+	
+} core_stats_t;
+
+/* How the core reaches the front end. Both are called from the source
+ * threads, so must be safe to call from any thread */
+typedef struct {
+	
+	/* Updates are waiting, core_drain() should be called soon */
+	void (*wake)(void);
+	
+	/* A new status message, which the hook must free */
+	void (*status)(char *message);
+	
+} core_hooks_t;
+
+/* Called by core_drain() for each update taken from the queue. obj is
+ * the object it changed, or NULL if the update was ignored */
+typedef void (*core_update_cb_t)(void *user, hab_update_t *u, hab_object_t *obj);
+
+extern char *vmake_message(const char *fmt, va_list ap);
+extern char *sprintf_alloc(const char *format, ... );
+
+extern int core_init(const core_hooks_t *hooks);
+extern void core_free(void);
+extern core_source_t *core_add_source(const char *name);
+extern int core_push(core_source_t *src, hab_update_t *u);
+extern unsigned int core_source_depth(core_source_t *src);
+extern void core_source_alive(core_source_t *src);
+extern void core_source_feed(core_source_t *src, long seq);
+extern void core_source_server_seq(core_source_t *src, long seq);
+extern int core_source_stats(int index, core_stats_t *st);
+extern void core_print_sources(FILE *f);
+extern void core_dump_stats(FILE *f);
+extern uint64_t core_sentence_key(int sentence_id, const char *time);
+extern uint64_t core_id_key(const char *id);
+extern hab_object_t *core_apply_update(hab_update_t *u);
+extern unsigned int core_drain(core_update_cb_t cb, void *user, hab_update_t *last);
+extern hab_object_t *core_get_object(int index);
+extern const char *habhound_object_type_name(hab_object_type_t type);
+
+extern void habhound_set_status(char *format, ... );
+extern void habhound_get_queue_stats(unsigned int *depth, unsigned int *max_depth, unsigned int *drops);
+
+#endif /* __CORE_H__ */
+
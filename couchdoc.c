@@ -0,0 +1,418 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* A streaming extractor for the handful of fields habhound needs from
+ * CouchDB responses. It uses yajl's callback parser and keeps track of
+ * where in the document it is with a small stack of contexts, copying
+ * matching values straight into a fixed couch_row_t. No tree is built
+ * and nothing is allocated per document.
+ *
+ * The same handle is reused for every line of a connection, with yajl
+ * configured to accept multiple values. If a line fails to parse the
+ * handle is thrown away and a new one allocated for the next.
+ *
+ * Responses containing a "rows" array, such as _all_docs, can instead be
+ * fed through in whatever chunks they arrive with couch_parse_rows(). Each
+ * row is extracted into the same couch_row_t and handed to a callback as
+ * soon as it is complete.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "couchdoc.h"
+#include "log.h"
+
+/* Where in the document the parser is */
+enum {
+	CTX_NONE,
+	CTX_ROOT, /* The top level object */
+	CTX_DOC,  /* The "doc" object of a changes record */
+	CTX_DATA, /* The "data" object of a document */
+	CTX_ROWS, /* The "rows" array of a view result */
+	CTX_ROW,  /* An element of "rows" */
+	CTX_RECEIVERS, /* The "receivers" object of a document */
+	CTX_RECEIVER,  /* One receiver's details */
+};
+
+/* The keys that are of interest */
+enum {
+	KEY_NONE,
+	KEY_SEQ,
+	KEY_ID,
+	KEY_DOC,
+	KEY_UPDATE_SEQ,
+	KEY_DB_NAME,
+	KEY_TYPE,
+	KEY_DATA,
+	KEY_PARSED,
+	KEY_PAYLOAD,
+	KEY_CALLSIGN,
+	KEY_LATITUDE,
+	KEY_LONGITUDE,
+	KEY_ALTITUDE,
+	KEY_SENTENCE_ID,
+	KEY_TIME,
+	KEY_ROWS,
+	KEY_RECEIVERS,
+	KEY_TIME_UPLOADED,
+};
+
+static const struct {
+	const char *name;
+	size_t length;
+	int key;
+} _keys[] = {
+	{ "seq",        3, KEY_SEQ },
+	{ "id",         2, KEY_ID },
+	{ "doc",        3, KEY_DOC },
+	{ "update_seq", 10, KEY_UPDATE_SEQ },
+	{ "db_name",    7, KEY_DB_NAME },
+	{ "type",       4, KEY_TYPE },
+	{ "data",       4, KEY_DATA },
+	{ "_parsed",    7, KEY_PARSED },
+	{ "payload",    7, KEY_PAYLOAD },
+	{ "callsign",   8, KEY_CALLSIGN },
+	{ "latitude",   8, KEY_LATITUDE },
+	{ "longitude",  9, KEY_LONGITUDE },
+	{ "altitude",   8, KEY_ALTITUDE },
+	{ "sentence_id", 11, KEY_SENTENCE_ID },
+	{ "time",       4, KEY_TIME },
+	{ "rows",       4, KEY_ROWS },
+	{ "receivers",  9, KEY_RECEIVERS },
+	{ "time_uploaded", 13, KEY_TIME_UPLOADED },
+	{ NULL, 0, KEY_NONE }
+};
+
+static int _ctx(couch_parser_t *p)
+{
+	if(p->depth < 1 || p->depth >= COUCH_MAX_DEPTH) return(CTX_NONE);
+	return(p->ctx[p->depth]);
+}
+
+static int _key(couch_parser_t *p)
+{
+	if(p->depth < 1 || p->depth >= COUCH_MAX_DEPTH) return(KEY_NONE);
+	return(p->key[p->depth]);
+}
+
+static void _push(couch_parser_t *p, int ctx)
+{
+	p->depth++;
+	if(p->depth >= COUCH_MAX_DEPTH) return;
+	
+	p->ctx[p->depth] = ctx;
+	p->key[p->depth] = KEY_NONE;
+}
+
+/* Copy a string value into a fixed buffer. Values that
+ * don't fit are dropped rather than truncated */
+static void _copy(char *dst, size_t size, const unsigned char *src, size_t length)
+{
+	if(length >= size) return;
+	
+	memcpy(dst, src, length);
+	dst[length] = '\0';
+}
+
+/* Parse an RFC 3339 time, such as "2012-05-19T13:05:21+01:00", keeping
+ * it if it's earlier than any upload time already seen */
+static void _uploaded(couch_doc_t *doc, const unsigned char *value, size_t length)
+{
+	char s[40];
+	struct tm tm;
+	int n = 0, oh, om;
+	time_t t;
+	
+	if(length >= sizeof(s)) return;
+	memcpy(s, value, length);
+	s[length] = '\0';
+	
+	memset(&tm, 0, sizeof(tm));
+	if(sscanf(s, "%4d-%2d-%2dT%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon,
+		&tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &n) != 6) return;
+	
+	tm.tm_year -= 1900;
+	tm.tm_mon--;
+	t = timegm(&tm);
+	
+	/* Skip any fraction of a second, then apply the offset */
+	if(s[n] == '.') while(s[++n] >= '0' && s[n] <= '9');
+	if((s[n] == '+' || s[n] == '-') && sscanf(s + n + 1, "%2d:%2d", &oh, &om) == 2)
+		t += (oh * 3600 + om * 60) * (s[n] == '+' ? -1 : 1);
+	
+	if(!doc->uploaded || t < doc->uploaded) doc->uploaded = t;
+}
+
+static int _cb_string(void *ctx, const unsigned char *value, size_t length)
+{
+	couch_parser_t *p = ctx;
+	couch_row_t *r = &p->row;
+	
+	/* Upload times are kept wherever they're found in the document */
+	if(_key(p) == KEY_TIME_UPLOADED &&
+	   (_ctx(p) == CTX_ROOT || _ctx(p) == CTX_DOC || _ctx(p) == CTX_RECEIVER))
+	{
+		_uploaded(&r->doc, value, length);
+		return(1);
+	}
+	
+	switch(_ctx(p))
+	{
+	case CTX_ROW:
+		if(_key(p) == KEY_ID) _copy(r->id, sizeof(r->id), value, length);
+		break;
+	
+	case CTX_ROOT:
+		if(_key(p) == KEY_ID) _copy(r->id, sizeof(r->id), value, length);
+		else if(_key(p) == KEY_DB_NAME) _copy(r->db_name, sizeof(r->db_name), value, length);
+		/* Fall through, the top level object may be the document */
+	case CTX_DOC:
+		if(_key(p) != KEY_TYPE) break;
+		
+		if(length == 17 && memcmp(value, "payload_telemetry", 17) == 0)
+			r->doc.type = COUCH_DOC_PAYLOAD_TELEMETRY;
+		else if(length == 18 && memcmp(value, "listener_telemetry", 18) == 0)
+			r->doc.type = COUCH_DOC_LISTENER_TELEMETRY;
+		else r->doc.type = COUCH_DOC_OTHER;
+		
+		break;
+	
+	case CTX_DATA:
+		if(_key(p) == KEY_PAYLOAD) _copy(r->doc.payload, sizeof(r->doc.payload), value, length);
+		else if(_key(p) == KEY_CALLSIGN) _copy(r->doc.callsign, sizeof(r->doc.callsign), value, length);
+		else if(_key(p) == KEY_TIME) _copy(r->doc.time, sizeof(r->doc.time), value, length);
+		break;
+	}
+	
+	return(1);
+}
+
+static int _cb_number(void *ctx, const char *value, size_t length)
+{
+	couch_parser_t *p = ctx;
+	couch_row_t *r = &p->row;
+	char s[64];
+	
+	/* yajl doesn't terminate the number */
+	if(length >= sizeof(s)) return(1);
+	memcpy(s, value, length);
+	s[length] = '\0';
+	
+	switch(_ctx(p))
+	{
+	case CTX_ROOT:
+		if(_key(p) == KEY_SEQ)
+		{
+			r->seq = strtol(s, NULL, 10);
+			r->has_seq = 1;
+		}
+		else if(_key(p) == KEY_UPDATE_SEQ)
+		{
+			r->update_seq = strtol(s, NULL, 10);
+			r->has_update_seq = 1;
+		}
+		break;
+	
+	case CTX_DATA:
+		if(_key(p) == KEY_LATITUDE) r->doc.latitude = strtod(s, NULL);
+		else if(_key(p) == KEY_LONGITUDE) r->doc.longitude = strtod(s, NULL);
+		else if(_key(p) == KEY_ALTITUDE) r->doc.altitude = strtod(s, NULL);
+		else if(_key(p) == KEY_SENTENCE_ID)
+		{
+			r->doc.sentence_id = strtol(s, NULL, 10);
+			r->doc.has_sentence_id = 1;
+		}
+		break;
+	}
+	
+	return(1);
+}
+
+static int _cb_start_map(void *ctx)
+{
+	couch_parser_t *p = ctx;
+	int c = CTX_NONE;
+	
+	if(p->depth == 0) c = CTX_ROOT;
+	else if(_ctx(p) == CTX_ROWS)
+	{
+		/* A new row, clear the previous one */
+		c = CTX_ROW;
+		memset(&p->row, 0, sizeof(couch_row_t));
+	}
+	else if((_ctx(p) == CTX_ROOT || _ctx(p) == CTX_ROW) && _key(p) == KEY_DOC)
+	{
+		c = CTX_DOC;
+		p->row.has_doc = 1;
+	}
+	else if((_ctx(p) == CTX_ROOT || _ctx(p) == CTX_DOC) && _key(p) == KEY_DATA)
+		c = CTX_DATA;
+	else if((_ctx(p) == CTX_ROOT || _ctx(p) == CTX_DOC) && _key(p) == KEY_RECEIVERS)
+		c = CTX_RECEIVERS;
+	else if(_ctx(p) == CTX_RECEIVERS)
+		c = CTX_RECEIVER; /* Keyed by the receiver's callsign */
+	else if(_ctx(p) == CTX_DATA && _key(p) == KEY_PARSED)
+		p->row.doc.parsed = 1;
+	
+	_push(p, c);
+	
+	return(1);
+}
+
+static int _cb_map_key(void *ctx, const unsigned char *key, size_t length)
+{
+	couch_parser_t *p = ctx;
+	int i;
+	
+	if(p->depth < 1 || p->depth >= COUCH_MAX_DEPTH) return(1);
+	
+	/* Skip the lookup inside objects that are of no interest */
+	p->key[p->depth] = KEY_NONE;
+	if(p->ctx[p->depth] == CTX_NONE) return(1);
+	
+	for(i = 0; _keys[i].name; i++)
+	{
+		if(_keys[i].length == length &&
+		   memcmp(_keys[i].name, key, length) == 0)
+		{
+			p->key[p->depth] = _keys[i].key;
+			break;
+		}
+	}
+	
+	return(1);
+}
+
+static int _cb_end_map(void *ctx)
+{
+	couch_parser_t *p = ctx;
+	
+	/* Pass on each completed row */
+	if(_ctx(p) == CTX_ROW && p->row_callback)
+		p->row_callback(p->user, &p->row);
+	
+	p->depth--;
+	
+	return(1);
+}
+
+static int _cb_start_array(void *ctx)
+{
+	couch_parser_t *p = ctx;
+	
+	if(_ctx(p) == CTX_ROOT && _key(p) == KEY_ROWS) _push(p, CTX_ROWS);
+	else _push(p, CTX_NONE);
+	
+	return(1);
+}
+
+static int _cb_end_array(void *ctx)
+{
+	couch_parser_t *p = ctx;
+	p->depth--;
+	return(1);
+}
+
+static const yajl_callbacks _callbacks = {
+	NULL, /* null */
+	NULL, /* boolean */
+	NULL, /* integer */
+	NULL, /* double */
+	_cb_number,
+	_cb_string,
+	_cb_start_map,
+	_cb_map_key,
+	_cb_end_map,
+	_cb_start_array,
+	_cb_end_array,
+};
+
+static int _alloc(couch_parser_t *p)
+{
+	p->h = yajl_alloc(&_callbacks, NULL, p);
+	if(!p->h) return(-1); /* Out of memory */
+	
+	yajl_config(p->h, yajl_allow_multiple_values, 1);
+	
+	memset(&p->row, 0, sizeof(couch_row_t));
+	p->depth = 0;
+	
+	return(0);
+}
+
+static void _parse_error(couch_parser_t *p)
+{
+	unsigned char *err = yajl_get_error(p->h, 0, NULL, 0);
+	log_printf(LOG_LEVEL_WARN, "parse_error: %s\n", err ? (char *) err : "unknown error");
+	if(err) yajl_free_error(p->h, err);
+}
+
+/* Parse a single complete JSON value. Returns a pointer to the extracted
+ * fields, valid until the next call, or NULL if the text didn't parse */
+couch_row_t *couch_parse(couch_parser_t *p, const char *text, size_t length)
+{
+	yajl_status r;
+	
+	if(!p->h && _alloc(p) != 0) return(NULL);
+	
+	memset(&p->row, 0, sizeof(couch_row_t));
+	p->depth = 0;
+	
+	r = yajl_parse(p->h, (const unsigned char *) text, length);
+	
+	if(r != yajl_status_ok || p->depth != 0)
+	{
+		if(r != yajl_status_ok) _parse_error(p);
+		else log_printf(LOG_LEVEL_WARN, "parse_error: incomplete JSON value\n");
+		
+		/* The handle can't be reused after an error */
+		couch_parser_free(p);
+		
+		return(NULL);
+	}
+	
+	return(&p->row);
+}
+
+/* Parse the next chunk of a response containing a "rows" array, calling
+ * p->row_callback for each row as it completes. Returns 0 on success, or
+ * -1 on error after which the rest of the response is ignored */
+int couch_parse_rows(couch_parser_t *p, const char *text, size_t length)
+{
+	/* Don't try to resume after an error */
+	if(p->depth < 0) return(-1);
+	
+	if(!p->h && _alloc(p) != 0) return(-1);
+	
+	if(yajl_parse(p->h, (const unsigned char *) text, length) != yajl_status_ok)
+	{
+		_parse_error(p);
+		couch_parser_free(p);
+		p->depth = -1;
+		return(-1);
+	}
+	
+	return(0);
+}
+
+void couch_parser_free(couch_parser_t *p)
+{
+	if(p->h) yajl_free(p->h);
+	p->h = NULL;
+}
+
@@ -0,0 +1,112 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __COUCHDOC_H__
+#define __COUCHDOC_H__
+
+#include <stddef.h>
+#include <time.h>
+#include <yajl/yajl_parse.h>
+
+/* Maximum JSON nesting depth tracked by the parser. Anything deeper
+ * is still parsed but never matches a field */
+#define COUCH_MAX_DEPTH (8)
+
+typedef enum {
+	COUCH_DOC_NONE,
+	COUCH_DOC_OTHER,
+	COUCH_DOC_PAYLOAD_TELEMETRY,
+	COUCH_DOC_LISTENER_TELEMETRY,
+} couch_doctype_t;
+
+/* The fields of a habitat document that are of interest */
+typedef struct {
+	
+	/* Value of "type" */
+	couch_doctype_t type;
+	
+	/* Set if "data._parsed" is present */
+	char parsed;
+	
+	/* Value of "data.payload" and "data.callsign" */
+	char payload[64];
+	char callsign[64];
+	
+	/* Position, 0 if not present */
+	double latitude;
+	double longitude;
+	double altitude;
+	
+	/* Value of "data.sentence_id" and "data.time", for
+	 * telling the same sentence apart from different sources */
+	char has_sentence_id;
+	int sentence_id;
+	char time[16];
+	
+	/* The earliest "time_uploaded", of the document itself or any
+	 * entry in "receivers", 0 if none */
+	time_t uploaded;
+	
+} couch_doc_t;
+
+/* The fields of one line of a CouchDB response */
+typedef struct {
+	
+	/* Changes feed and _all_docs row fields */
+	char has_seq;
+	int seq;
+	char id[128];
+	
+	/* Database info fields */
+	char has_update_seq;
+	int update_seq;
+	char db_name[64];
+	
+	/* Set if the changes record or row included the document */
+	char has_doc;
+	
+	/* The document, either from "doc" or the top level object */
+	couch_doc_t doc;
+	
+} couch_row_t;
+
+typedef struct {
+	
+	/* yajl parser handle, allocated on first use */
+	yajl_handle h;
+	
+	/* Called for each element of a "rows" array by couch_parse_rows() */
+	void (*row_callback)(void *, couch_row_t *);
+	void *user;
+	
+	/* The result of the last parse */
+	couch_row_t row;
+	
+	/* Current nesting depth, and the context and most
+	 * recent key for each level */
+	int depth;
+	unsigned char ctx[COUCH_MAX_DEPTH];
+	unsigned char key[COUCH_MAX_DEPTH];
+	
+} couch_parser_t;
+
+extern couch_row_t *couch_parse(couch_parser_t *p, const char *text, size_t length);
+extern int couch_parse_rows(couch_parser_t *p, const char *text, size_t length);
+extern void couch_parser_free(couch_parser_t *p);
+
+#endif /* __COUCHDOC_H__ */
+
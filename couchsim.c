@@ -0,0 +1,562 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* couchsim - a small stand-in for the habitat CouchDB server, for testing
+ * and benchmarking habhound without a network connection.
+ *
+ * The documents served come from a fixture file with one JSON document
+ * per line. Line n is given the id "doc<n>" and the sequence number n.
+ * Paths are served under any database name:
+ *
+ *   GET  /db/                         the database info document
+ *   GET  /db/_changes?feed=continuous the fixture as a changes feed
+ *   GET  /db/<id>                     a single document
+ *   POST /db/_all_docs                {"keys":[...]} documents by id
+ *
+ * The changes feed respects "since", "heartbeat" and "include_docs".
+ * Options control the rate changes are sent at, how the response is
+ * split up into HTTP chunks, leaving the document out of some changes
+ * (so habhound has to fetch them) and dropping the connection after a
+ * number of changes. Fragmentation uses a fixed seed, so a run can be
+ * repeated exactly.
+ *
+ * Each connection is handled by its own process.
+*/
+
+#define _GNU_SOURCE /* For strcasestr() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Longest request header that will be read */
+#define REQUEST_MAX (65536)
+
+typedef struct {
+	
+	/* The fixture documents, one per line */
+	char **docs;
+	int count;
+	
+	/* Sequence number reported by the info document */
+	int update_seq;
+	
+	/* Changes per second, 0 for as fast as possible */
+	double rate;
+	
+	/* Largest HTTP chunk to send, 0 to send each line as one chunk */
+	int fragment;
+	
+	/* Leave the document out of every nth change, 0 never */
+	int missing;
+	
+	/* Drop the changes connection after this many changes, 0 never */
+	int disconnect;
+	
+	/* Seed for the fragment sizes */
+	unsigned int seed;
+	
+} couchsim_t;
+
+static couchsim_t sim;
+
+static double _now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static int _send(int fd, const char *data, size_t length)
+{
+	while(length > 0)
+	{
+		ssize_t r = send(fd, data, length, MSG_NOSIGNAL);
+		if(r == -1)
+		{
+			if(errno == EINTR) continue;
+			return(-1);
+		}
+		
+		data += r;
+		length -= r;
+	}
+	
+	return(0);
+}
+
+/* Send data as one or more HTTP chunks */
+static int _chunk(int fd, const char *data, size_t length)
+{
+	char head[16];
+	
+	while(length > 0)
+	{
+		size_t l = length;
+		
+		/* Split it up if asked to */
+		if(sim.fragment > 0)
+		{
+			l = 1 + rand_r(&sim.seed) % sim.fragment;
+			if(l > length) l = length;
+		}
+		
+		snprintf(head, sizeof(head), "%zx\r\n", l);
+		
+		if(_send(fd, head, strlen(head)) != 0 ||
+		   _send(fd, data, l) != 0 ||
+		   _send(fd, "\r\n", 2) != 0) return(-1);
+		
+		data += l;
+		length -= l;
+	}
+	
+	return(0);
+}
+
+static int _respond(int fd, int status, const char *reason, const char *body)
+{
+	char head[256];
+	
+	snprintf(head, sizeof(head),
+		"HTTP/1.1 %i %s\r\n"
+		"Content-Type: text/plain;charset=utf-8\r\n"
+		"Content-Length: %zu\r\n"
+		"\r\n", status, reason, strlen(body));
+	
+	if(_send(fd, head, strlen(head)) != 0) return(-1);
+	return(_send(fd, body, strlen(body)));
+}
+
+/* Find the fixture line for a document id, or -1 */
+static int _find(const char *id, size_t length)
+{
+	int n;
+	
+	if(length < 4 || strncmp(id, "doc", 3) != 0) return(-1);
+	
+	n = atoi(id + 3);
+	if(n < 1 || n > sim.count) return(-1);
+	
+	return(n - 1);
+}
+
+/* Get the value of a query string parameter, or NULL */
+static const char *_param(const char *path, const char *name)
+{
+	const char *q = strchr(path, '?');
+	size_t l = strlen(name);
+	
+	while(q)
+	{
+		q++;
+		if(strncmp(q, name, l) == 0 && q[l] == '=') return(q + l + 1);
+		q = strchr(q, '&');
+	}
+	
+	return(NULL);
+}
+
+static int _changes(int fd, const char *path)
+{
+	const char *p;
+	int since = 0, heartbeat = 60000, docs = 0;
+	int seq, sent = 0;
+	double next, last;
+	char *line = NULL;
+	size_t size = 0;
+	
+	if((p = _param(path, "since"))) since = atoi(p);
+	if((p = _param(path, "heartbeat"))) heartbeat = atoi(p);
+	if((p = _param(path, "include_docs"))) docs = (strncmp(p, "true", 4) == 0);
+	
+	p = "HTTP/1.1 200 OK\r\n"
+	    "Content-Type: text/plain;charset=utf-8\r\n"
+	    "Transfer-Encoding: chunked\r\n"
+	    "\r\n";
+	if(_send(fd, p, strlen(p)) != 0) return(-1);
+	
+	next = last = _now();
+	
+	for(seq = since + 1; seq <= sim.count; seq++)
+	{
+		const char *doc = sim.docs[seq - 1];
+		size_t l = strlen(doc) + 128;
+		
+		/* Keep to the rate */
+		if(sim.rate > 0)
+		{
+			double delay = next - _now();
+			if(delay > 0) usleep(delay * 1e6);
+			next += 1.0 / sim.rate;
+		}
+		
+		if(l > size)
+		{
+			char *n = realloc(line, l);
+			if(!n) break;
+			line = n;
+			size = l;
+		}
+		
+		if(docs && !(sim.missing > 0 && seq % sim.missing == 0))
+			snprintf(line, size, "{\"seq\":%i,\"id\":\"doc%i\",\"changes\":[{\"rev\":\"1-0\"}],\"doc\":%s}\n", seq, seq, doc);
+		else
+			snprintf(line, size, "{\"seq\":%i,\"id\":\"doc%i\",\"changes\":[{\"rev\":\"1-0\"}]}\n", seq, seq);
+		
+		if(_chunk(fd, line, strlen(line)) != 0) break;
+		last = _now();
+		
+		/* Drop the connection part way through if asked to */
+		if(sim.disconnect > 0 && ++sent >= sim.disconnect)
+		{
+			fprintf(stderr, "couchsim: disconnecting after seq %i\n", seq);
+			break;
+		}
+	}
+	
+	free(line);
+	if(seq <= sim.count) return(-1);
+	
+	fprintf(stderr, "couchsim: end of fixture, sending heartbeats\n");
+	
+	/* No more changes, keep the connection alive until the client goes */
+	while(1)
+	{
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int wait = heartbeat - (_now() - last) * 1000;
+		char c;
+		
+		if(wait > 0 && poll(&pfd, 1, wait) == 1)
+		{
+			/* The client has closed the connection */
+			if(recv(fd, &c, 1, MSG_PEEK) <= 0) return(-1);
+		}
+		
+		if(_chunk(fd, "\n", 1) != 0) return(-1);
+		last = _now();
+	}
+}
+
+static int _all_docs(int fd, const char *body)
+{
+	const char *p = strstr(body, "\"keys\"");
+	char *out = NULL;
+	size_t size = 0, length = 0;
+	FILE *f;
+	int first = 1;
+	
+	f = open_memstream(&out, &size);
+	if(!f) return(-1);
+	
+	fprintf(f, "{\"total_rows\":%i,\"offset\":0,\"rows\":[\r\n", sim.count);
+	
+	/* Pick each string out of the keys array */
+	if(p) p = strchr(p, '[');
+	while(p && *p && *p != ']')
+	{
+		const char *s = strchr(p, '"'), *e;
+		int i;
+		
+		if(!s) break;
+		e = strchr(++s, '"');
+		if(!e) break;
+		
+		i = _find(s, e - s);
+		if(!first) fprintf(f, ",\r\n");
+		first = 0;
+		
+		if(i < 0) fprintf(f, "{\"key\":\"%.*s\",\"error\":\"not_found\"}", (int) (e - s), s);
+		else fprintf(f, "{\"id\":\"doc%i\",\"key\":\"doc%i\",\"value\":{\"rev\":\"1-0\"},\"doc\":%s}",
+			i + 1, i + 1, sim.docs[i]);
+		
+		p = e + 1;
+		while(*p == ' ' || *p == ',') p++;
+	}
+	
+	fprintf(f, "\r\n]}\n");
+	fclose(f);
+	
+	length = strlen(out);
+	
+	/* Sent chunked, so fragmentation applies here too */
+	p = "HTTP/1.1 200 OK\r\n"
+	    "Content-Type: text/plain;charset=utf-8\r\n"
+	    "Transfer-Encoding: chunked\r\n"
+	    "\r\n";
+	
+	if(_send(fd, p, strlen(p)) != 0 ||
+	   _chunk(fd, out, length) != 0 ||
+	   _send(fd, "0\r\n\r\n", 5) != 0)
+	{
+		free(out);
+		return(-1);
+	}
+	
+	free(out);
+	
+	return(0);
+}
+
+/* Handle one request. Returns 0 if the connection can be reused */
+static int _request(int fd, char *method, char *path, char *body)
+{
+	char *doc, info[128];
+	int i;
+	
+	fprintf(stderr, "couchsim: %s %s\n", method, path);
+	
+	/* Skip the database name */
+	doc = strchr(path + 1, '/');
+	if(!doc) doc = "";
+	else doc++;
+	
+	if(strcmp(method, "POST") == 0)
+	{
+		if(strncmp(doc, "_all_docs", 9) == 0) return(_all_docs(fd, body));
+		return(_respond(fd, 404, "Object Not Found", "{\"error\":\"not_found\"}\n"));
+	}
+	
+	if(*doc == '\0')
+	{
+		snprintf(info, sizeof(info), "{\"db_name\":\"habitat\",\"doc_count\":%i,\"update_seq\":%i}\n",
+			sim.count, sim.update_seq);
+		return(_respond(fd, 200, "OK", info));
+	}
+	
+	if(strncmp(doc, "_changes", 8) == 0) return(_changes(fd, path));
+	
+	i = _find(doc, strcspn(doc, "?"));
+	if(i < 0) return(_respond(fd, 404, "Object Not Found", "{\"error\":\"not_found\"}\n"));
+	
+	if(_respond(fd, 200, "OK", sim.docs[i]) != 0) return(-1);
+	return(_send(fd, "\n", 1));
+}
+
+/* Serve requests on a connection until it's closed */
+static void _serve(int fd)
+{
+	char *buf = malloc(REQUEST_MAX);
+	size_t length = 0;
+	
+	if(!buf) return;
+	
+	while(1)
+	{
+		char method[8], path[1024], *end, *p, *body;
+		size_t content = 0, need;
+		ssize_t r;
+		
+		/* Read until the end of the headers, and then the body */
+		end = (length > 0 ? strstr(buf, "\r\n\r\n") : NULL);
+		if(end)
+		{
+			if((p = strcasestr(buf, "\r\nContent-Length:"))) content = atol(p + 17);
+			need = (end - buf) + 4 + content;
+		}
+		
+		if(!end || length < need)
+		{
+			if(length >= REQUEST_MAX - 1) break;
+			
+			r = recv(fd, buf + length, REQUEST_MAX - 1 - length, 0);
+			if(r <= 0) break;
+			
+			length += r;
+			buf[length] = '\0';
+			continue;
+		}
+		
+		if(sscanf(buf, "%7s %1023s", method, path) != 2) break;
+		
+		body = strndup(end + 4, content);
+		if(!body) break;
+		
+		r = _request(fd, method, path, body);
+		free(body);
+		if(r != 0) break;
+		
+		/* Keep any pipelined request that followed */
+		memmove(buf, buf + need, length - need);
+		length -= need;
+		buf[length] = '\0';
+	}
+	
+	free(buf);
+}
+
+static int _load(const char *path)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t l;
+	int n = 0;
+	
+	f = fopen(path, "r");
+	if(!f)
+	{
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		return(-1);
+	}
+	
+	while((l = getline(&line, &size, f)) != -1)
+	{
+		while(l > 0 && (line[l - 1] == '\n' || line[l - 1] == '\r')) line[--l] = '\0';
+		if(l == 0) continue;
+		
+		if(sim.count == n)
+		{
+			char **d;
+			
+			n = (n ? n * 2 : 1024);
+			d = realloc(sim.docs, sizeof(char *) * n);
+			if(!d) break; /* Out of memory! */
+			sim.docs = d;
+		}
+		
+		if(!(sim.docs[sim.count] = strdup(line))) break;
+		sim.count++;
+	}
+	
+	free(line);
+	fclose(f);
+	
+	return(0);
+}
+
+static void _usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <fixture>\n"
+		"\n"
+		"  -p, --port <n>        Port to listen on (default 5984)\n"
+		"  -u, --update-seq <n>  update_seq reported by the info document (default 0)\n"
+		"  -r, --rate <n>        Changes per second, 0 for no limit (default 0)\n"
+		"  -f, --fragment <n>    Split responses into chunks of 1 to n bytes\n"
+		"  -m, --missing <n>     Leave the document out of every nth change\n"
+		"  -d, --disconnect <n>  Drop the changes feed after n changes\n"
+		"  -s, --seed <n>        Seed for the chunk sizes (default 1)\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "port",       required_argument, 0, 'p' },
+		{ "update-seq", required_argument, 0, 'u' },
+		{ "rate",       required_argument, 0, 'r' },
+		{ "fragment",   required_argument, 0, 'f' },
+		{ "missing",    required_argument, 0, 'm' },
+		{ "disconnect", required_argument, 0, 'd' },
+		{ "seed",       required_argument, 0, 's' },
+		{ 0, 0, 0, 0 }
+	};
+	struct sockaddr_in addr;
+	int port = 5984;
+	int c, fd, one = 1;
+	
+	sim.seed = 1;
+	
+	while((c = getopt_long(argc, argv, "p:u:r:f:m:d:s:", long_options, NULL)) != -1)
+	{
+		switch(c)
+		{
+		case 'p': port = atoi(optarg); break;
+		case 'u': sim.update_seq = atoi(optarg); break;
+		case 'r': sim.rate = atof(optarg); break;
+		case 'f': sim.fragment = atoi(optarg); break;
+		case 'm': sim.missing = atoi(optarg); break;
+		case 'd': sim.disconnect = atoi(optarg); break;
+		case 's': sim.seed = strtoul(optarg, NULL, 10); break;
+		default:
+			_usage(argv[0]);
+			return(-1);
+		}
+	}
+	
+	if(optind != argc - 1)
+	{
+		_usage(argv[0]);
+		return(-1);
+	}
+	
+	if(_load(argv[optind]) != 0) return(-1);
+	fprintf(stderr, "couchsim: loaded %i documents\n", sim.count);
+	
+	/* Connections are served by child processes, which are left to exit */
+	signal(SIGCHLD, SIG_IGN);
+	
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	
+	if(fd == -1 ||
+	   bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+	   listen(fd, 16) == -1)
+	{
+		fprintf(stderr, "Can't listen on port %i: %s\n", port, strerror(errno));
+		return(-1);
+	}
+	
+	fprintf(stderr, "couchsim: listening on http://127.0.0.1:%i/habitat\n", port);
+	
+	while(1)
+	{
+		int cfd = accept(fd, NULL, NULL);
+		
+		if(cfd == -1)
+		{
+			if(errno == EINTR) continue;
+			perror("accept");
+			break;
+		}
+		
+		setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		
+		if(fork() == 0)
+		{
+			close(fd);
+			_serve(cfd);
+			close(cfd);
+			_exit(0);
+		}
+		
+		/* Each connection gets its own sequence of chunk sizes */
+		rand_r(&sim.seed);
+		close(cfd);
+	}
+	
+	close(fd);
+	
+	return(0);
+}
+
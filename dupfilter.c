@@ -0,0 +1,147 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* A filter for spotting repeats among recent items, each reduced to a
+ * 64-bit fingerprint. There are two open addressing tables: fingerprints
+ * are added to the current one, and once that is half full the other is
+ * cleared and becomes current. So at least the last size / 2 are always
+ * remembered, at most the last size, and lookups never miss because of
+ * a collision. It's not thread safe, each user has its own.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "dupfilter.h"
+
+int dupfilter_init(dupfilter_t *f, unsigned int size)
+{
+	unsigned int s;
+	
+	/* Round the size up to a power of two */
+	for(s = 1; s < size; s <<= 1);
+	
+	memset(f, 0, sizeof(dupfilter_t));
+	
+	f->tables = calloc(sizeof(uint64_t), s * 2);
+	if(!f->tables) return(-1);
+	
+	f->size = s;
+	
+	return(0);
+}
+
+void dupfilter_free(dupfilter_t *f)
+{
+	free(f->tables);
+	memset(f, 0, sizeof(dupfilter_t));
+}
+
+/* Look for a fingerprint in one table. Returns 1 with *slot set to
+ * where it is, or 0 with *slot set to the empty slot where it would go */
+static int _find(dupfilter_t *f, uint64_t *t, uint64_t h, unsigned int *slot)
+{
+	unsigned int mask = f->size - 1;
+	unsigned int i = h & mask;
+	
+	while(t[i] && t[i] != h)
+		i = (i + 1) & mask; /* Linear probing */
+	
+	*slot = i;
+	
+	return(t[i] != 0);
+}
+
+/* Check whether a fingerprint has been seen recently, and remember it
+ * if not. Returns 1 if it's a repeat, 0 if not */
+int dupfilter_check(dupfilter_t *f, uint64_t h)
+{
+	uint64_t *t;
+	unsigned int slot;
+	
+	if(h == 0) h = 1; /* 0 marks an empty slot */
+	
+	if(_find(f, f->tables + f->size * !f->current, h, &slot)) return(1);
+	
+	t = f->tables + f->size * f->current;
+	if(_find(f, t, h, &slot)) return(1);
+	
+	/* Keep the table no more than half full, forgetting
+	 * the older half of what's remembered */
+	if(f->count * 2 >= f->size)
+	{
+		f->current = !f->current;
+		f->count = 0;
+		
+		t = f->tables + f->size * f->current;
+		memset(t, 0, sizeof(uint64_t) * f->size);
+		_find(f, t, h, &slot);
+	}
+	
+	t[slot] = h;
+	f->count++;
+	
+	return(0);
+}
+
+/* Forget a fingerprint, for an item that was checked but then
+ * never used, so it isn't taken for a repeat when it comes again */
+void dupfilter_forget(dupfilter_t *f, uint64_t h)
+{
+	unsigned int mask = f->size - 1;
+	unsigned int i, j, k;
+	uint64_t *t;
+	int n;
+	
+	if(h == 0) h = 1;
+	
+	for(n = 0; n < 2; n++)
+	{
+		t = f->tables + f->size * n;
+		if(!_find(f, t, h, &i)) continue;
+		
+		/* Move later fingerprints back into the gap, so none is left
+		 * past an empty slot that would stop the search for it. Ones
+		 * whose home slot is after the gap stay where they are */
+		for(j = (i + 1) & mask; t[j]; j = (j + 1) & mask)
+		{
+			k = t[j] & mask;
+			if(i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+			
+			t[i] = t[j];
+			i = j;
+		}
+		
+		t[i] = 0;
+		if(n == f->current) f->count--;
+		
+		return;
+	}
+}
+
+/* Mix the bits of a value into a fingerprint, with the splitmix64
+ * finaliser. Callers combine their fields first */
+uint64_t dupfilter_mix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBULL;
+	h ^= h >> 31;
+	
+	return(h);
+}
+
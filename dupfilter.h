@@ -0,0 +1,43 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __DUPFILTER_H__
+#define __DUPFILTER_H__
+
+#include <stdint.h>
+
+/* Remembers recently seen 64-bit fingerprints */
+typedef struct {
+	
+	/* Two open addressing tables of fingerprints, 0 = empty */
+	uint64_t *tables;
+	unsigned int size; /* Slots in each, a power of two */
+	
+	/* The table new fingerprints go into, and how many it has */
+	int current;
+	unsigned int count;
+	
+} dupfilter_t;
+
+extern int dupfilter_init(dupfilter_t *f, unsigned int size);
+extern void dupfilter_free(dupfilter_t *f);
+extern int dupfilter_check(dupfilter_t *f, uint64_t h);
+extern void dupfilter_forget(dupfilter_t *f, uint64_t h);
+extern uint64_t dupfilter_mix(uint64_t h);
+
+#endif /* __DUPFILTER_H__ */
+
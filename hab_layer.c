@@ -15,16 +15,34 @@
 /* You should have received a copy of the GNU General Public License      */
 /* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
 
+#include <stdio.h>
 #include <cairo.h>
 #include <osm-gps-map-layer.h>
 
 #include "habhound.h"
 #include "hab_layer.h"
+#include "infobox.h"
+#include "metrics.h"
+
+/* Least time between redraws of the layer, in milliseconds */
+#define HAB_LAYER_FRAME_MS (40)
+
+/* Spacing of the infoboxes */
+#define INFOBOX_STEP   (110)
+#define INFOBOX_MARGIN (10)
+
+/* Height of the pager below the infoboxes */
+#define PAGER_HEIGHT (16)
+
+/* Height of the status bar */
+#define STATUS_HEIGHT (14)
 
 static void hab_layer_iface_init(OsmGpsMapLayerIface *iface);
 
 enum {
 	P_STATUS = 1,
+	P_STATS,
+	P_REDRAWS,
 };
 
 G_DEFINE_TYPE_WITH_CODE(hab_layer, hab_layer, G_TYPE_OBJECT,
@@ -33,6 +51,23 @@ G_DEFINE_TYPE_WITH_CODE(hab_layer, hab_layer, G_TYPE_OBJECT,
 struct _hab_layer_private
 {
 	char *status;
+	char *stats; /* Shown at the right of the status bar */
+	
+	/* The map widget, known after the first draw */
+	GtkWidget *map;
+	
+	/* The first infobox on the current page */
+	gint first;
+	
+	/* Areas waiting to be redrawn, and the pending redraw */
+	cairo_region_t *dirty;
+	guint flush_id;
+	gint64 last_flush;
+	
+	/* Redraws counted in the current second, and the last full second */
+	gint64 second;
+	guint redraws;
+	guint redraws_per_second;
 };
 
 static void     hab_layer_render (OsmGpsMapLayer *osd, OsmGpsMap *map);
@@ -42,6 +77,10 @@ static gboolean hab_layer_press  (OsmGpsMapLayer *osd, OsmGpsMap *map, GdkEventB
 
 static void scale_draw(hab_layer *self, GtkAllocation *allocation, cairo_t *cr);
 static void status_bar_draw(hab_layer *self, GtkAllocation *allocation, cairo_t *cr);
+static void invalidate(hab_layer *self, int x, int y, int width, int height);
+static void invalidate_status(hab_layer *self);
+static gint panel_rows(GtkAllocation *allocation);
+static gint panel_first(hab_layer *self, gint rows, gint count);
 
 static void hab_layer_iface_init(OsmGpsMapLayerIface *iface)
 {
@@ -63,6 +102,13 @@ static void hab_layer_set_property(GObject *object, guint prop_id, const GValue
 		if(priv->status) g_free(priv->status);
 		if(g_value_get_string(value)) priv->status = g_value_dup_string(value);
 		else priv->status = NULL;
+		invalidate_status(o);
+		break;
+	case P_STATS:
+		if(priv->stats) g_free(priv->stats);
+		if(g_value_get_string(value)) priv->stats = g_value_dup_string(value);
+		else priv->stats = NULL;
+		invalidate_status(o);
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
@@ -81,6 +127,12 @@ static void hab_layer_get_property(GObject *object, guint prop_id, GValue *value
 	case P_STATUS:
 		g_value_set_string(value, priv->status);
 		break;
+	case P_STATS:
+		g_value_set_string(value, priv->stats);
+		break;
+	case P_REDRAWS:
+		g_value_set_uint(value, priv->redraws_per_second);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -102,6 +154,9 @@ static void hab_layer_finalize(GObject *object)
 	hab_layer_private *priv = HAB_LAYER(object)->priv;
 	
 	if(priv->status) g_free(priv->status);
+	if(priv->stats) g_free(priv->stats);
+	if(priv->flush_id) g_source_remove(priv->flush_id);
+	if(priv->dirty) cairo_region_destroy(priv->dirty);
 	
 	G_OBJECT_CLASS(hab_layer_parent_class)->finalize(object);
 }
@@ -123,11 +178,27 @@ static void hab_layer_class_init(hab_layerClass *klass)
 			"Status bar text", "habhound/alpha",
 			G_PARAM_READWRITE | G_PARAM_CONSTRUCT)
 	);
+	
+	g_object_class_install_property(
+		object_class, P_STATS,
+		g_param_spec_string("stats", "stats",
+			"Feed statistics, shown at the right of the status bar", NULL,
+			G_PARAM_READWRITE)
+	);
+	
+	g_object_class_install_property(
+		object_class, P_REDRAWS,
+		g_param_spec_uint("redraws-per-second", "redraws per second",
+			"Number of times the layer was drawn in the last second",
+			0, G_MAXUINT, 0,
+			G_PARAM_READABLE)
+	);
 }
 
 static void hab_layer_init(hab_layer *self)
 {
 	self->priv = G_TYPE_INSTANCE_GET_PRIVATE(self, HAB_LAYER_TYPE, hab_layer_private);
+	self->priv->dirty = cairo_region_create();
 }
 
 static void hab_layer_render(OsmGpsMapLayer *osd, OsmGpsMap *map)
@@ -138,9 +209,25 @@ static void hab_layer_render(OsmGpsMapLayer *osd, OsmGpsMap *map)
 static void hab_layer_draw(OsmGpsMapLayer *osd, OsmGpsMap *map, cairo_t *cr)
 {
 	hab_layer *self;
+	hab_layer_private *priv;
 	GtkAllocation allocation;
+	gint64 second;
+	uint64_t t = metrics_now();
 	
 	self = HAB_LAYER(osd);
+	priv = self->priv;
+	
+	priv->map = GTK_WIDGET(map);
+	
+	/* Count the redraws for each second */
+	second = g_get_monotonic_time() / G_USEC_PER_SEC;
+	if(second != priv->second)
+	{
+		priv->redraws_per_second = (second == priv->second + 1 ? priv->redraws : 0);
+		priv->redraws = 0;
+		priv->second = second;
+	}
+	priv->redraws++;
 	
 	gtk_widget_get_allocation(GTK_WIDGET(map), &allocation);
 	//cr = gdk_cairo_create(drawable);
@@ -149,6 +236,8 @@ static void hab_layer_draw(OsmGpsMapLayer *osd, OsmGpsMap *map, cairo_t *cr)
 	status_bar_draw(self, &allocation, cr);
 	
 	//cairo_destroy(cr);
+	
+	metrics_observe(&metric_redraw_seconds, metrics_now() - t);
 }	
 
 static gboolean hab_layer_busy(OsmGpsMapLayer *osd)
@@ -158,7 +247,35 @@ static gboolean hab_layer_busy(OsmGpsMapLayer *osd)
 
 static gboolean hab_layer_press(OsmGpsMapLayer *osd, OsmGpsMap *map, GdkEventButton *event)
 {
-	return(FALSE);
+	hab_layer *self = HAB_LAYER(osd);
+	hab_layer_private *priv = self->priv;
+	GtkAllocation allocation;
+	gint x, y, rows, count, first;
+	
+	if(event->type != GDK_BUTTON_PRESS || event->button != 1) return(FALSE);
+	
+	gtk_widget_get_allocation(GTK_WIDGET(map), &allocation);
+	
+	count = habhound_get_infobox_count();
+	rows  = panel_rows(&allocation);
+	first = panel_first(self, rows, count);
+	if(count <= rows) return(FALSE);
+	
+	/* Was the pager clicked? */
+	x = allocation.width - INFOBOX_WIDTH - INFOBOX_MARGIN;
+	y = INFOBOX_MARGIN + rows * INFOBOX_STEP;
+	
+	if(event->x < x || event->x >= x + INFOBOX_WIDTH ||
+	   event->y < y || event->y >= y + PAGER_HEIGHT) return(FALSE);
+	
+	/* The left half goes back a page, the right half forward */
+	if(event->x < x + INFOBOX_WIDTH / 2) first -= rows;
+	else if(first + rows < count) first += rows;
+	
+	priv->first = (first < 0 ? 0 : first);
+	hab_layer_invalidate_panel(self);
+	
+	return(TRUE);
 }
 
 hab_layer *hab_layer_new(void)
@@ -166,23 +283,179 @@ hab_layer *hab_layer_new(void)
 	return(g_object_new(HAB_LAYER_TYPE, NULL));
 }
 
+static gboolean cb_flush(gpointer user_data)
+{
+	hab_layer_private *priv = HAB_LAYER(user_data)->priv;
+	
+	gtk_widget_queue_draw_region(priv->map, priv->dirty);
+	
+	cairo_region_destroy(priv->dirty);
+	priv->dirty = cairo_region_create();
+	
+	priv->flush_id = 0;
+	priv->last_flush = g_get_monotonic_time();
+	
+	return(FALSE);
+}
+
+/* Mark an area of the layer for redrawing. Redraws are collected and
+ * queued together, no sooner than HAB_LAYER_FRAME_MS after the last */
+static void invalidate(hab_layer *self, int x, int y, int width, int height)
+{
+	hab_layer_private *priv = self->priv;
+	cairo_rectangle_int_t rect = { x, y, width, height };
+	gint64 wait;
+	
+	/* Nothing to do until the layer has been drawn once */
+	if(!priv->map) return;
+	
+	cairo_region_union_rectangle(priv->dirty, &rect);
+	if(priv->flush_id) return;
+	
+	wait = priv->last_flush + HAB_LAYER_FRAME_MS * 1000 - g_get_monotonic_time();
+	if(wait < 0) wait = 0;
+	
+	priv->flush_id = g_timeout_add(wait / 1000, cb_flush, self);
+}
+
+static void invalidate_status(hab_layer *self)
+{
+	GtkAllocation allocation;
+	
+	if(!self->priv->map) return;
+	
+	gtk_widget_get_allocation(self->priv->map, &allocation);
+	invalidate(self, 0, allocation.height - STATUS_HEIGHT, allocation.width, STATUS_HEIGHT);
+}
+
+/* Mark the infobox using surface for redrawing, if it's on the current page */
+void hab_layer_invalidate_infobox(hab_layer *self, cairo_surface_t *surface)
+{
+	GtkAllocation allocation;
+	cairo_surface_t *s;
+	gint i, y, rows, first;
+	
+	if(!self->priv->map || !surface) return;
+	
+	gtk_widget_get_allocation(self->priv->map, &allocation);
+	
+	rows  = panel_rows(&allocation);
+	first = panel_first(self, rows, habhound_get_infobox_count());
+	
+	/* Find where it's drawn, the same way scale_draw() places them */
+	y = INFOBOX_MARGIN;
+	for(i = first; i < first + rows && habhound_get_infobox(i, &s) != -1; i++)
+	{
+		if(s == surface)
+		{
+			invalidate(self, allocation.width - INFOBOX_WIDTH - INFOBOX_MARGIN, y,
+				INFOBOX_WIDTH, INFOBOX_HEIGHT);
+			break;
+		}
+		
+		y += INFOBOX_STEP;
+	}
+}
+
+/* Mark the whole infobox panel for redrawing, for when the
+ * order of the infoboxes has changed */
+void hab_layer_invalidate_panel(hab_layer *self)
+{
+	GtkAllocation allocation;
+	
+	if(!self->priv->map) return;
+	
+	gtk_widget_get_allocation(self->priv->map, &allocation);
+	invalidate(self, allocation.width - INFOBOX_WIDTH - INFOBOX_MARGIN, 0,
+		INFOBOX_WIDTH, allocation.height - STATUS_HEIGHT);
+}
+
+/* Number of infoboxes that fit in the panel */
+static gint panel_rows(GtkAllocation *allocation)
+{
+	gint rows;
+	
+	rows = (allocation->height - INFOBOX_MARGIN - PAGER_HEIGHT - STATUS_HEIGHT) / INFOBOX_STEP;
+	
+	return(rows < 1 ? 1 : rows);
+}
+
+/* Keep the first infobox shown on a page within the number there are */
+static gint panel_first(hab_layer *self, gint rows, gint count)
+{
+	hab_layer_private *priv = self->priv;
+	
+	if(priv->first >= count) priv->first = (count > 0 ? (count - 1) / rows * rows : 0);
+	if(priv->first < 0) priv->first = 0;
+	
+	return(priv->first);
+}
+
 static void scale_draw(hab_layer *self, GtkAllocation *allocation, cairo_t *cr)
 {
 	cairo_surface_t *surface;
-	gint i, x, y;
+	GdkRectangle clip, box;
+	gint i, x, y, rows, count, first;
+	char msg[32];
+	
+	x = allocation->width - INFOBOX_WIDTH - INFOBOX_MARGIN;
+	y = INFOBOX_MARGIN;
+	
+	/* Only the infoboxes that need redrawing are painted */
+	if(!gdk_cairo_get_clip_rectangle(cr, &clip))
+		return;
 	
-	x = allocation->width - 220 - 10;
-	y = 10;
+	/* Only the page of infoboxes that fits the window is drawn */
+	count = habhound_get_infobox_count();
+	rows  = panel_rows(allocation);
+	first = panel_first(self, rows, count);
 	
-	for(i = 0; habhound_get_infobox(i, &surface) != -1; i++)
+	for(i = first; i < first + rows && habhound_get_infobox(i, &surface) != -1; i++)
 	{
-		if(!surface) continue;
+		box.x = x;
+		box.y = y;
+		box.width = INFOBOX_WIDTH;
+		box.height = INFOBOX_HEIGHT;
 		
-		cairo_set_source_surface(cr, surface, x, y);
-		cairo_paint(cr);
+		if(surface && gdk_rectangle_intersect(&clip, &box, NULL))
+		{
+			cairo_set_source_surface(cr, surface, x, y);
+			cairo_paint(cr);
+		}
 		
-		y += 110;
+		y += INFOBOX_STEP;
 	}
+	
+	/* Draw the pager if there's more than one page */
+	if(count <= rows) return;
+	
+	y = INFOBOX_MARGIN + rows * INFOBOX_STEP;
+	
+	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.6);
+	cairo_rectangle(cr, x, y, INFOBOX_WIDTH, PAGER_HEIGHT);
+	cairo_fill(cr);
+	
+	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+	cairo_select_font_face(cr, "Sans",
+		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, 9);
+	
+	if(first > 0)
+	{
+		cairo_move_to(cr, x + 4, y + PAGER_HEIGHT - 4);
+		cairo_show_text(cr, "< Prev");
+	}
+	
+	if(first + rows < count)
+	{
+		cairo_move_to(cr, x + INFOBOX_WIDTH - 36, y + PAGER_HEIGHT - 4);
+		cairo_show_text(cr, "Next >");
+	}
+	
+	snprintf(msg, sizeof(msg), "%i-%i of %i", first + 1,
+		first + rows < count ? first + rows : count, count);
+	cairo_move_to(cr, x + INFOBOX_WIDTH / 2 - 24, y + PAGER_HEIGHT - 4);
+	cairo_show_text(cr, msg);
 }
 
 static void status_bar_draw(hab_layer *self, GtkAllocation *allocation, cairo_t *cr)
@@ -192,7 +465,7 @@ static void status_bar_draw(hab_layer *self, GtkAllocation *allocation, cairo_t
 	/* Draw the outline box */
 	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.6);
 	cairo_set_line_width(cr, 0);
-	cairo_rectangle(cr, 0, allocation->height - 14, allocation->width, 14);
+	cairo_rectangle(cr, 0, allocation->height - STATUS_HEIGHT, allocation->width, STATUS_HEIGHT);
 	cairo_fill(cr);
 	
 	/* Draw the payload title */
@@ -207,5 +480,23 @@ static void status_bar_draw(hab_layer *self, GtkAllocation *allocation, cairo_t
 		cairo_move_to(cr, 2, allocation->height - 3);
 		cairo_show_text(cr, priv->status);
 	}
+	
+	/* And the statistics, right aligned over the top of it */
+	if(priv->stats)
+	{
+		cairo_text_extents_t extents;
+		double x;
+		
+		cairo_text_extents(cr, priv->stats, &extents);
+		x = allocation->width - extents.x_advance - 4;
+		
+		cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.6);
+		cairo_rectangle(cr, x - 4, allocation->height - STATUS_HEIGHT, extents.x_advance + 8, STATUS_HEIGHT);
+		cairo_fill(cr);
+		
+		cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+		cairo_move_to(cr, x, allocation->height - 3);
+		cairo_show_text(cr, priv->stats);
+	}
 }
 
@@ -19,6 +19,7 @@
 #define __HAB_LAYER_H__
 
 #include <glib-object.h>
+#include <cairo.h>
 
 G_BEGIN_DECLS
 
@@ -45,6 +46,8 @@ struct _hab_layer_class
 
 GType hab_layer_get_type(void);
 hab_layer *hab_layer_new(void);
+void hab_layer_invalidate_infobox(hab_layer *self, cairo_surface_t *surface);
+void hab_layer_invalidate_panel(hab_layer *self);
 
 G_END_DECLS
 
@@ -25,441 +25,213 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <math.h>
+#include <getopt.h>
 #include "habhound.h"
 #include "hab_layer.h"
-#include "habitat.h"
+#include "marker.h"
+#include "infobox.h"
+#include "track.h"
+#include "atlas.h"
+#include "horizon.h"
+#include "store.h"
+#include "sources.h"
+#include "metrics.h"
+#include "log.h"
+
+#define deg2rad(deg) ((deg) * M_PI / 180.0)
+
+/* How far a track may stray from the true path, in pixels */
+#define TRACK_TOLERANCE (1.0)
+
+/* How often the queue of updates is drained, in milliseconds */
+#define HABHOUND_FRAME_MS (40)
+
+/* How often the feed statistics in the status bar are updated, in seconds */
+#define HABHOUND_STATS_INTERVAL (1)
+
+/* The habitat server to use if none is given */
+#define HABHOUND_HABITAT_URL "http://habitat.habhub.org/habitat"
+
+/* Where received telemetry is kept between runs */
+#define HABHOUND_STORE "habhound.store"
 
 static OsmGpsMap *map = NULL;
 static OsmGpsMapLayer *osd = NULL;
 
-static GdkPixbuf *g_balloon_blue = NULL;
-static GdkPixbuf *g_radio_green = NULL;
-static GdkPixbuf *g_car_red = NULL;
+static const atlas_icon_t *g_balloon_blue = NULL;
+static const atlas_icon_t *g_radio_green = NULL;
+static const atlas_icon_t *g_car_red = NULL;
 
 typedef struct {
-	hab_object_type_t type;
-	const char *callsign;
+	hab_object_t *hab; /* Latest telemetry, from the core */
 	
-	GdkPixbuf *image;
+	const atlas_icon_t *image;
 	GdkPixbuf *mapimage;
 	double x_offset;
 	double y_offset;
 	gint z_order;
 	
 	OsmGpsMapImage *icon;
-	OsmGpsMapTrack *track;
+	track_t *track; /* Only for balloons */
 	
 	OsmGpsMapTrack *horizon; /* Only for balloons at the moment */
 	
-	cairo_surface_t *infobox; /* Also only for balloons */
+	/* Where the horizon was last calculated for */
+	horizon_t horizon_at;
 	
-	time_t timestamp;
-	double latitude;
-	double longitude;
-	double altitude;
+	infobox_t infobox; /* Also only for balloons */
 	
-	double max_altitude;
+	/* Set while waiting to be refreshed */
+	char dirty;
+	void *dirty_next;
 } map_object_t;
 
-static int map_objects_count = 0;
-static map_object_t **map_objects = NULL;
-
-typedef struct {
-	char *callsign;
-	hab_object_type_t type;
-	time_t timestamp;
-	double latitude;
-	double longitude;
-	double altitude;
-} obj_data_t;
-
-/* Taken from the GCC manual and cleaned up a bit. */
-char *vmake_message(const char *fmt, va_list ap)
-{
-	/* Start with 100 bytes. */
-	int n, size = 100;
-	char *p;
-	
-	p = (char *) malloc(size);
-	if(!p) return(NULL);
-	
-	while(1)
-	{
-		char *np;
-		va_list apc;
-		
-		/* Try to print in the allocated space. */
-		va_copy(apc, ap);
-		n = vsnprintf(p, size, fmt, apc);
-		
-		/* If that worked, return the string. */
-		if(n > -1 && n < size) return(p);
-		
-		/* Else try again with more space. */
-		if(n > -1) size = n + 1; /* gibc 2.1: exactly what is needed */
-		else size *= 2; /* glibc 2.0: twice the old size */
-		
-		np = (char *) realloc(p, size);
-		if(!np)
-		{
-			free(p);
-			return(NULL);
-		}
-		
-		p = np;
-	}
-	
-	free(p);
-	return(NULL);
-}
+/* Payloads with an infobox, most recently heard first */
+static map_object_t **panel = NULL;
+static int panel_count = 0;
+static int panel_size = 0;
 
-char *sprintf_alloc(const char *format, ... )
+/* horizon calculations */
+float calculate_distance_to_horizon(float altitude)
 {
-	va_list ap;
-	char *msg;
-	
-	va_start(ap, format);
-	msg = vmake_message(format, ap);
-	va_end(ap);
-	
-	return(msg);
+	return(sqrt(2 * 6378137.0 * altitude));
 }
 
-static map_object_t *find_map_object(hab_object_type_t type, const char *callsign)
+/* Move the points of a horizon circle to surround latitude, longitude
+ * (in degrees) at distance metres. The points are updated in place */
+static void calculate_horizon(OsmGpsMapTrack *track, double latitude, double longitude, double distance)
 {
+	double lat[HORIZON_POINTS + 1], lng[HORIZON_POINTS + 1];
+	GSList *l;
 	int i;
-	map_object_t *obj;
 	
-	/* No objects yet */
-	if(!map_objects) return(NULL);
+	horizon_circle(latitude, longitude, distance, lat, lng);
 	
-	/* Loop until a match is found, or the end is reached */
-	for(i = 0; map_objects[i]; i++)
-	{
-		obj = map_objects[i];
-		if(obj->type == type &&
-		   strcmp(obj->callsign, callsign) == 0) return(obj);
-	}
-	
-	/* No match was found */
-	return(NULL);
+	l = osm_gps_map_track_get_points(track);
+	for(i = 0; l && i <= HORIZON_POINTS; l = l->next, i++)
+		osm_gps_map_point_set_radians(l->data, lat[i], lng[i]);
 }
 
-static map_object_t *get_map_object(int index)
+/* The size of a map pixel in metres at a latitude and zoom level */
+static double metres_per_pixel(double latitude, int zoom)
 {
-	/* Return a map object by its index number */
-	if(index >= map_objects_count) return(NULL);
-	return(map_objects[index]);
+	return(2 * M_PI * 6378137.0 * cos(deg2rad(latitude)) / (256 << zoom));
 }
 
-static int new_map_object(map_object_t *obj)
+/* How far in metres a track at latitude may be simplified */
+static double track_epsilon(double latitude)
 {
-	/* Reallocate the length of the array */
-	void *t = realloc(map_objects, sizeof(map_object_t *) * (map_objects_count + 2));
-	if(!t) return(-1); /* Out of memory! */
+	int zoom;
 	
-	/* Add the new item to the end */
-	map_objects = t;
-	map_objects[map_objects_count++] = obj;
-	map_objects[map_objects_count] = NULL;
+	g_object_get(map, "zoom", &zoom, NULL);
 	
-	return(map_objects_count);
-}
-
-/* horizon calculations */
-float calculate_distance_to_horizon(float altitude)
-{
-	return(sqrt(2 * 6378137.0 * altitude));
+	return(TRACK_TOLERANCE * metres_per_pixel(latitude, zoom));
 }
 
-OsmGpsMapPoint *calculate_point_at_horizon(OsmGpsMapPoint *dst, OsmGpsMapPoint *src, float bearing, float distance)
+static void render_mapimage(map_object_t *obj)
 {
-	float lat1, lng1;
-	float lat2, lng2;
-	float d = distance / 6378137.0; /* Average radius of the earth */
-	
-	osm_gps_map_point_get_radians(src, &lat1, &lng1);
+	marker_t m;
 	
-	/* Formula from http://www.movable-type.co.uk/scripts/latlong.html */
+	/* Get the rendered icon and callsign from the marker cache */
+	if(marker_get(&m, obj->image, obj->x_offset, obj->y_offset,
+		obj->hab->callsign, "Sans", 8) != 0) return;
 	
-	lat2 = asin(sin(lat1) * cos(d) + cos(lat1) * sin(d) * cos(bearing));
-	lng2 = lng1 + atan2(sin(bearing) * sin(d) * cos(lat1), cos(d) - sin(lat1) * sin(lat2));
-	
-	osm_gps_map_point_set_radians(dst, lat2, lng2);
-	
-	return(dst);
+	obj->mapimage = m.pixbuf;
+	obj->x_offset = m.x_offset;
+	obj->y_offset = m.y_offset;
 }
 
-const char *habhound_object_type_name(hab_object_type_t type)
+/* Move a payload to the top of the infobox panel, adding it if it's not
+ * already there. Returns 1 if the order changed, 0 if not, or -1 on error */
+static int panel_raise(map_object_t *obj)
 {
-	switch(type)
-	{
-	case HAB_PAYLOAD: return("payload");
-	case HAB_LISTENER: return("listener");
-	case HAB_CHASE: return("chase");
-	}
+	int i;
 	
-	return("unknown");
-}
-
-/* Create a GdkPixbuf from a cairo surface -- based on convert_alpha() from aprsmap */
-static GdkPixbuf *_gdk_pixbuf_new_from_surface(cairo_surface_t *surface)
-{
-	GdkPixbuf *pixbuf;
-	unsigned char *dst_data, *src_data;
-	int dst_stride, src_stride;
-	int width, height;
-	int x, y;
-	
-	/* Get the details of the surface */
-	width      = cairo_image_surface_get_width(surface);
-	height     = cairo_image_surface_get_height(surface);
-	src_data   = cairo_image_surface_get_data(surface);
-	src_stride = cairo_image_surface_get_stride(surface);
-	
-	/* Create the new pixbuf */
-	pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, width, height);
-	if(!pixbuf) return(NULL);
-	
-	/* Get details of the pixbuf */
-	dst_data   = gdk_pixbuf_get_pixels(pixbuf);
-	dst_stride = gdk_pixbuf_get_rowstride(pixbuf);
-	
-	/* Flush any pending drawing bits */
-	cairo_surface_flush(surface);
-	
-	/* Copy the image data */
-	for(y = 0; y < height; y++)
+	if(panel_count > 0 && panel[0] == obj) return(0);
+	
+	for(i = 1; i < panel_count; i++)
+		if(panel[i] == obj) break;
+	
+	if(i >= panel_count)
 	{
-		uint32_t *src = (uint32_t *) src_data;
-		
-		for(x = 0; x < width; x++)
+		/* A new payload, make room for it */
+		if(panel_count == panel_size)
 		{
-			unsigned int alpha = src[x] >> 24;
+			int size = (panel_size ? panel_size * 2 : 16);
+			map_object_t **p = realloc(panel, sizeof(map_object_t *) * size);
+			if(!p) return(-1); /* Out of memory! */
 			
-			if(alpha == 0)
-			{
-				dst_data[x * 4 + 0] = 0;
-				dst_data[x * 4 + 1] = 0;
-				dst_data[x * 4 + 2] = 0;
-			}
-			else
-			{
-				dst_data[x * 4 + 0] = (((src[x] & 0xff0000) >> 16) * 255 + alpha / 2) / alpha;
-				dst_data[x * 4 + 1] = (((src[x] & 0x00ff00) >>  8) * 255 + alpha / 2) / alpha;
-				dst_data[x * 4 + 2] = (((src[x] & 0x0000ff) >>  0) * 255 + alpha / 2) / alpha;
-			}
-			dst_data[x * 4 + 3] = alpha;
+			panel = p;
+			panel_size = size;
 		}
-		src_data += src_stride;
-		dst_data += dst_stride;
+		
+		i = panel_count++;
 	}
 	
-	return(pixbuf);
-}
-
-static void render_mapimage(map_object_t *obj)
-{
-	cairo_t *cr;
-	cairo_surface_t *surface;
-	cairo_text_extents_t extent;
-	int width, height;
-	
-	/* Get the width and height of the icon */
-	width  = gdk_pixbuf_get_width(obj->image);
-	height = gdk_pixbuf_get_height(obj->image);
-	
-	/* Create a dummy surface, to find the width of the callsign. */
-	/* There must be a handier way of doing this! */
-	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 16, 16);
-	cr = cairo_create(surface);
-	cairo_select_font_face(cr, "Sans",
-		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, 8);
-	cairo_text_extents(cr, obj->callsign, &extent);
-	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
-	
-	/* Adjust the size to fit both the icon and text */
-	if(extent.width >= width) width = extent.width + 2;
-	height += extent.height + 2;
-	
-	obj->x_offset -= 0.5;
-	obj->x_offset *= (double) gdk_pixbuf_get_width(obj->image) / width;
-	obj->x_offset += 0.5;
-	obj->y_offset -= (double) (extent.height + 2) / height;
-	
-	/* Create and render the new icon */
-	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-	cr = cairo_create(surface);
-	
-	/* Draw the outline box */
-	//cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-	//cairo_set_line_width(cr, 2);
-	//cairo_rectangle(cr, 0, 0, width, height);
-	//cairo_stroke_preserve(cr);
-	
-	/* Draw the balloon icon */
-	gdk_cairo_set_source_pixbuf(cr, obj->image,
-		(width - gdk_pixbuf_get_width(obj->image)) / 2, 0);
-	cairo_paint(cr);
-	
-	/* Render the callsign */
-	cairo_select_font_face(cr, "Sans",
-		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, 8);
-	
-	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
-	cairo_set_line_width(cr, 2.0);
-	cairo_move_to(cr, (width - extent.width) / 2, height - extent.height / 2 + 2);
-	cairo_text_path(cr, obj->callsign);
-	cairo_stroke(cr);
-	
-	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-	cairo_set_font_size(cr, 8);
-	cairo_move_to(cr, (width - extent.width) / 2, height - extent.height / 2 + 2);
-	cairo_show_text(cr, obj->callsign);
-	
-	/* Create the GdkPixbuf from the cairo_surface */
-	obj->mapimage = _gdk_pixbuf_new_from_surface(surface);
-	
-	/* Destroy the surface */
-	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
+	memmove(&panel[1], &panel[0], sizeof(map_object_t *) * i);
+	panel[0] = obj;
+	
+	return(1);
 }
 
-static void render_infobox(map_object_t *obj)
+/* Update the infobox with the latest telemetry. Returns the number of
+ * lines that changed, or -1 on error */
+static int render_infobox(map_object_t *obj)
 {
-	cairo_t *cr;
-	char msg[100];
-	
-	/* Create the surface */
-	if(!obj->infobox) obj->infobox = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 220, 104);
-	
-	/* first fill with transparency */
-	cr = cairo_create(obj->infobox);
-	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-	cairo_paint(cr);
-	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	
-	/* Draw the outline box */
-	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
-	cairo_set_line_width(cr, 2);
-	cairo_rectangle(cr, 1, 1, 218, 102);
-	cairo_stroke_preserve(cr);
-	
-	/* Fill in box with semi-transparent white */
-	cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 0.85);
-	cairo_fill(cr);
-	
-	/* Draw the balloon icon */
-	if(obj->image)
-	{
-		gdk_cairo_set_source_pixbuf(cr, obj->image, 166, 5);
-		cairo_paint(cr);
-	}
-	
-	/* Draw the payload title */
-	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-	cairo_select_font_face(cr, "Sans",
-		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-	cairo_set_font_size(cr, 12);
-	
-	cairo_move_to(cr, 5, 14 /* - te.height / 2 - te.y_bearing*/);
-	cairo_show_text(cr, obj->callsign);
-	
-	/* Set the font for the rest of the data */
-	cairo_select_font_face(cr, "Sans",
-		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, 10);
+	hab_object_t *hab = obj->hab;
+	char lines[INFOBOX_LINES][64];
+	const char *l[INFOBOX_LINES];
+	int i;
 	
-	/* Print telemetry time */
-	cairo_move_to(cr, 5, 14 + 11);
-	if(obj->timestamp)
+	/* Telemetry time */
+	lines[0][0] = '\0';
+	if(hab->timestamp)
 	{
 		struct tm tm;
-		strftime(msg, 100, "Time: %Y-%m-%d %H:%M:%S", gmtime_r(&obj->timestamp, &tm));
-		cairo_show_text(cr, msg);
+		strftime(lines[0], 64, "Time: %Y-%m-%d %H:%M:%S", gmtime_r(&hab->timestamp, &tm));
 	}
 	
-	/* Print position */
-	cairo_move_to(cr, 5, 14 + 22);
-	snprintf(msg, 100, "Position: %.5f, %.5f", obj->latitude, obj->longitude);
-	cairo_show_text(cr, msg);
+	/* Position, altitude and max altitude */
+	snprintf(lines[1], 64, "Position: %.5f, %.5f", hab->latitude, hab->longitude);
+	snprintf(lines[2], 64, "Altitude: %i m", (int) hab->altitude);
+	snprintf(lines[3], 64, "Max. Altitude: %i m", (int) hab->max_altitude);
 	
-	/* Altitude */
-	cairo_move_to(cr, 5, 14 + 33);
-	snprintf(msg, 100, "Altitude: %i m", (int) obj->altitude);
-	cairo_show_text(cr, msg);
+	for(i = 0; i < INFOBOX_LINES; i++) l[i] = lines[i];
 	
-	/* Max altitude */
-	cairo_move_to(cr, 5, 14 + 44);
-	snprintf(msg, 100, "Max. Altitude: %i m", (int) obj->max_altitude);
-	cairo_show_text(cr, msg);
-	
-	cairo_destroy(cr);
+	return(infobox_update(&obj->infobox, obj->image, hab->callsign, l));
 }
 
 static gboolean cb_habhound_set_status(char *data)
 {
+	/* The layer redraws just the status bar */
 	g_object_set(G_OBJECT(osd), "status", data, NULL);
-	osm_gps_map_scroll(map, 0, 0); /* <-- hacky way to re-render map */
+	free(data);
 	return(FALSE);
 }
 
-static gboolean cb_habhound_plot_object(obj_data_t *data)
+/* Get the map object for a changed object, creating its icon the first
+ * time it's seen. Every position goes into the track, but the icon,
+ * horizon and infobox are only refreshed once per drain by
+ * habhound_refresh_object() */
+static map_object_t *habhound_map_object(hab_object_t *hab)
 {
-	map_object_t *obj;
-	OsmGpsMapPoint coord;
-	
-	habhound_set_status("%s %s at %f,%f altitude %i m",
-		habhound_object_type_name(data->type), data->callsign,
-		data->latitude, data->longitude, (int) data->altitude);
-	fprintf(stderr, "%s %s at %f,%f altitude %.2f\n",
-		habhound_object_type_name(data->type), data->callsign,
-		data->latitude, data->longitude, data->altitude);
+	map_object_t *obj = hab->user;
 	
-	/* Ignore 0,0 coordinates */
-	if(data->latitude == 0 && data->longitude == 0)
-	{
-		free(data->callsign);
-		free(data);
-		return(FALSE);
-	}
-	
-	/* Is this a known object? */
-	obj = find_map_object(data->type, data->callsign);
 	if(!obj)
 	{
 		obj = calloc(sizeof(map_object_t), 1);
-		if(!obj)
-		{
-			free(data->callsign);
-			free(data);
-			return(FALSE); /* Out of memory! */
-		}
+		if(!obj) return(NULL); /* Out of memory! */
 		
-		/* Add the new object to the objects array */
-		if(new_map_object(obj) == -1)
-		{
-			/* Failed to add! */
-			free(obj);
-			free(data->callsign);
-			free(data);
-			return(FALSE);
-		}
+		obj->hab = hab;
 		
-		obj->type = data->type;
-		obj->callsign = data->callsign;
-		switch(obj->type)
+		switch(hab->type)
 		{
 		case HAB_PAYLOAD:
 			obj->image = g_balloon_blue;
 			obj->x_offset = 0.5;
 			obj->y_offset = 0.95;
 			obj->z_order = 2;
-			obj->track = osm_gps_map_track_new();
-			osm_gps_map_track_add(map, obj->track);
+			obj->track = track_new(map, track_epsilon(hab->latitude));
 			break;
 		case HAB_LISTENER:
 			obj->image = g_radio_green;
@@ -483,74 +255,66 @@ static gboolean cb_habhound_plot_object(obj_data_t *data)
 		render_mapimage(obj);
 		
 		obj->icon = osm_gps_map_image_add_with_alignment_z(
-			map, data->latitude, data->longitude, obj->mapimage,
+			map, hab->latitude, hab->longitude, obj->mapimage,
 			obj->x_offset, obj->y_offset, obj->z_order);
-	}
-	else
-	{
-		free(data->callsign); /* Don't need this */
 		
-		/* Has the data changed from the last time? */
-		if((obj->latitude == data->latitude) ||
-		   (obj->longitude == data->longitude) ||
-		   (obj->altitude  == data->altitude))
-		{
-			/* Nothing has changed, ignore data */
-			free(data);
-			return(FALSE);
-		}
+		hab->user = obj;
 	}
 	
-	obj->timestamp = data->timestamp;
-	obj->latitude  = data->latitude;
-	obj->longitude = data->longitude;
-	obj->altitude  = data->altitude;
-	if(data->altitude > obj->max_altitude)
-		obj->max_altitude = data->altitude;
+	if(obj->track) track_add(obj->track, hab->latitude, hab->longitude, hab->altitude);
 	
-	if(strcmp(obj->callsign, "2I0VIM") == 0) obj->altitude = 80.0;
+	return(obj);
+}
+
+/* Move the icon, and redraw the horizon and infobox for the latest position */
+static void habhound_refresh_object(map_object_t *obj)
+{
+	hab_object_t *hab = obj->hab;
+	OsmGpsMapPoint coord;
 	
-	osm_gps_map_point_set_degrees(&coord, obj->latitude, obj->longitude);
+	osm_gps_map_point_set_degrees(&coord, hab->latitude, hab->longitude);
 	g_object_set(G_OBJECT(obj->icon), "point", &coord, NULL);
-	if(obj->track) osm_gps_map_track_add_point(obj->track, &coord);
 	
 	/* Draw payload horizon circle */
-	if(obj->type == HAB_PAYLOAD || obj->altitude > 0)
+	if(hab->type == HAB_PAYLOAD || hab->altitude > 0)
 	{
-		OsmGpsMapPoint p;
-		int i;
-		float b, s;
-		float d; /* 1km */
-		GdkColor c;
+		double d = calculate_distance_to_horizon(hab->altitude);
+		double mpp;
+		int zoom;
 		
-		d = calculate_distance_to_horizon(obj->altitude);
+		g_object_get(map, "zoom", &zoom, NULL);
+		mpp = metres_per_pixel(hab->latitude, zoom);
 		
-		if(obj->horizon)
+		if(!obj->horizon)
 		{
-			osm_gps_map_track_remove(map, obj->horizon);
-			g_object_unref(G_OBJECT(obj->horizon));
-		}
-		obj->horizon = osm_gps_map_track_new();
-		
-		for(i = 0; i <= 100; i++)
-		{
-			b = M_PI * 2.0 / 100.0 * (float) i;
-			calculate_point_at_horizon(&p, &coord, b, d);
-			osm_gps_map_track_add_point(obj->horizon, &p);
+			OsmGpsMapPoint p;
+			GdkColor c;
+			int i;
+			
+			/* Create the circle, the points are moved into place below */
+			obj->horizon = osm_gps_map_track_new();
+			
+			osm_gps_map_point_set_degrees(&p, hab->latitude, hab->longitude);
+			for(i = 0; i <= HORIZON_POINTS; i++)
+				osm_gps_map_track_add_point(obj->horizon, &p);
+			
+			gdk_color_parse("#0000FF", &c);
+			g_object_set(G_OBJECT(obj->horizon),
+				"alpha", 0.5,
+				"color", &c,
+				"line-width", 2.0,
+				NULL);
+			
+			osm_gps_map_track_add(map, obj->horizon);
+			obj->horizon_at.zoom = -1;
 		}
 		
-		gdk_color_parse("#0000FF", &c);
-		d = 0.5;
-		s = 2.0;
-		g_object_set(G_OBJECT(obj->horizon),
-			"alpha", d,
-			"color", &c,
-			"line-width", s,
-			NULL);
-		
-		osm_gps_map_track_add(map, obj->horizon);
+		/* Only move the circle if it will have shifted by more than a
+		 * pixel at the current zoom, or the map has been zoomed in */
+		if(horizon_moved(&obj->horizon_at, hab->latitude, hab->longitude, d, zoom, mpp))
+			calculate_horizon(obj->horizon, hab->latitude, hab->longitude, d);
 	}
-	else if(obj->type == HAB_PAYLOAD || obj->altitude <= 0)
+	else if(hab->type == HAB_PAYLOAD || hab->altitude <= 0)
 	{
 		/* Remove horizon if payload is on the ground */
 		if(obj->horizon)
@@ -562,57 +326,144 @@ static gboolean cb_habhound_plot_object(obj_data_t *data)
 	}
 	
 	/* Render the payload infobox */
-	if(obj->type == HAB_PAYLOAD) render_infobox(obj);
+	if(hab->type == HAB_PAYLOAD)
+	{
+		int n = render_infobox(obj);
+		
+		/* Only redraw it on the map if the text or order has changed */
+		if(n >= 0 && panel_raise(obj) > 0)
+			hab_layer_invalidate_panel(HAB_LAYER(osd));
+		else if(n > 0)
+			hab_layer_invalidate_infobox(HAB_LAYER(osd), obj->infobox.surface);
+	}
+}
+
+/* Add a changed object to the list waiting to be refreshed,
+ * if it's not already on it */
+static void habhound_mark_dirty(map_object_t **dirty, map_object_t *obj)
+{
+	if(!obj || obj->dirty) return;
 	
-	free(data);
+	obj->dirty = 1;
+	obj->dirty_next = *dirty;
+	*dirty = obj;
+}
+
+/* Refresh each changed object for its latest position */
+static void habhound_refresh_dirty(map_object_t *dirty)
+{
+	map_object_t *obj;
 	
-	return(FALSE);
+	if(!dirty) return;
+	
+	while((obj = dirty))
+	{
+		dirty = obj->dirty_next;
+		obj->dirty = 0;
+		obj->dirty_next = NULL;
+		
+		habhound_refresh_object(obj);
+	}
+	
+	/* Icons and horizons are moved in place, which
+	 * osm-gps-map isn't told about, so redraw once */
+	osm_gps_map_map_redraw_fast(map);
 }
 
-/* Set the status message */
-void habhound_set_status(char *message, ... )
+/* Log each update that changed an object, and collect the objects */
+static void cb_habhound_update(void *user, hab_update_t *data, hab_object_t *hab)
 {
-	va_list ap;
-	char *s;
+	if(!hab) return;
 	
-	if(!message) return;
+	/* Formatted later, by the log writer */
+	log_update(LOG_LEVEL_DEBUG, data);
 	
-	/* Create the full URL */
-	va_start(ap, message);
-	s = vmake_message(message, ap);
-	va_end(ap);
+	/* Collect each changed object once */
+	habhound_mark_dirty((map_object_t **) user, habhound_map_object(hab));
+}
+
+/* Drain the update queue. This runs at most once per frame, however
+ * many updates arrived in the meantime */
+static gboolean cb_habhound_drain_updates(gpointer user_data)
+{
+	map_object_t *dirty = NULL;
+	hab_update_t data;
+	
+	/* callsign stays NULL if no update changed anything */
+	data.callsign = NULL;
+	
+	if(core_drain(cb_habhound_update, &dirty, &data) == 0) return(FALSE);
+	
+	habhound_refresh_dirty(dirty);
+	
+	/* Only the last update is shown in the status bar */
+	if(data.callsign)
+		habhound_set_status("%s %s at %f,%f altitude %i m",
+			habhound_object_type_name(data.type), data.callsign,
+			data.latitude, data.longitude, (int) data.altitude);
+	
+	return(FALSE);
+}
+
+/* Show how each source is keeping up, at the right of the status bar */
+static gboolean cb_habhound_stats(gpointer user_data)
+{
+	GString *s = g_string_new(NULL);
+	core_stats_t st;
+	int i;
 	
-	if(!s) return;
+	for(i = 0; core_source_stats(i, &st) == 0; i++)
+	{
+		if(i > 0) g_string_append(s, " | ");
+		
+		if(st.lag >= 0) g_string_append_printf(s, "lag %ld, ", st.lag);
+		g_string_append_printf(s, "%.1f docs/s", st.rate);
+		if(st.age >= 0) g_string_append_printf(s, ", age %.0fs", st.age);
+		if(st.idle >= 0) g_string_append_printf(s, ", idle %llds", st.idle / 1000);
+	}
 	
-	g_idle_add((GSourceFunc) cb_habhound_set_status, s);
+	g_object_set(G_OBJECT(osd), "stats", s->str, NULL);
+	g_string_free(s, TRUE);
+	
+	return(TRUE);
+}
+
+/* Apply a position read back from the store at startup */
+static void cb_habhound_replay(void *user, hab_update_t *data)
+{
+	hab_object_t *hab = core_apply_update(data);
+	if(hab) habhound_mark_dirty((map_object_t **) user, habhound_map_object(hab));
+}
+
+/* Core hook, updates are waiting. Called from the source threads */
+static void habhound_wake(void)
+{
+	/* Have the main loop drain the queue on the next frame */
+	g_timeout_add(HABHOUND_FRAME_MS, cb_habhound_drain_updates, NULL);
+}
+
+/* Core hook, show a new status message */
+static void habhound_status(char *message)
+{
+	g_idle_add((GSourceFunc) cb_habhound_set_status, message);
 }
 
 /* Get a pointer to a map objects infobox. Used by the hab_layer
- * object to retrieve the rendered infoboxes for each payload */
+ * object to retrieve the rendered infoboxes for each payload,
+ * in order of when they were last heard */
 int habhound_get_infobox(int index, cairo_surface_t **surface)
 {
-	map_object_t *obj = get_map_object(index);
-	if(!obj) return(-1);
+	if(index < 0 || index >= panel_count) return(-1);
 	
-	*surface = obj->infobox;
+	*surface = panel[index]->infobox.surface;
 	
 	return(index);
 }
 
-void habhound_plot_object(const char *callsign, hab_object_type_t type,
-	time_t timestamp, double latitude, double longitude, double altitude)
+/* Get the number of infoboxes */
+int habhound_get_infobox_count(void)
 {
-	obj_data_t *data = calloc(sizeof(obj_data_t), 1);
-	if(!data) return;
-	
-	data->callsign  = strdup(callsign);
-	data->type      = type;
-	data->timestamp = timestamp;
-	data->latitude  = latitude;
-	data->longitude = longitude;
-	data->altitude  = altitude;
-	
-	g_idle_add((GSourceFunc) cb_habhound_plot_object, data);
+	return(panel_count);
 }
 
 void habhound_delete_object(const char *callsign)
@@ -630,6 +481,21 @@ static void on_tiles_queued_changed(OsmGpsMap *map, GParamSpec *pspec, gpointer
 	else habhound_set_status("Map downloaded");
 }
 
+/* Simplify the tracks again for the new zoom level */
+static void on_zoom_changed(OsmGpsMap *map, GParamSpec *pspec, gpointer user_data)
+{
+	hab_object_t *hab;
+	int i;
+	
+	for(i = 0; (hab = core_get_object(i)); i++)
+	{
+		map_object_t *obj = hab->user;
+		
+		if(!obj || !obj->track) continue;
+		track_simplify(obj->track, track_epsilon(hab->latitude));
+	}
+}
+
 static gboolean key_press_event(GtkWidget *widget, GdkEventKey *event, gpointer data)
 {
 	switch(event->keyval)
@@ -638,6 +504,12 @@ static gboolean key_press_event(GtkWidget *widget, GdkEventKey *event, gpointer
 	case 'Q':
 		gtk_main_quit();
 		return(TRUE);
+	
+	case 's':
+	case 'S':
+		/* Dump the feed statistics for other programs */
+		core_dump_stats(stdout);
+		return(TRUE);
 	}
 	
 	return(FALSE);
@@ -655,14 +527,57 @@ static void destroy(GtkWidget *widget, gpointer data)
 
 int main(int argc, char *argv[])
 {
+	static const core_hooks_t hooks = { habhound_wake, habhound_status };
 	GtkWidget *mainwin;
-	src_habitat_t *src_habitat;
+	sources_t sources = { .speed = 1.0 };
+	store_t *store = NULL;
+	metrics_server_t *metrics = NULL;
+	char *metrics_where = NULL;
+	map_object_t *dirty = NULL;
+	unsigned long hits, misses;
+	unsigned int count;
+	size_t bytes;
 	
 	/* Initialise libraries */
 	curl_global_init(CURL_GLOBAL_ALL);
 	
 	gtk_init(&argc, &argv);
 	
+	/* Read the command line, what's left after GTK has had its turn */
+	while(1)
+	{
+		static const struct option long_options[] = {
+			{ "habitat", required_argument, 0, 'h' },
+			{ "replay",  required_argument, 0, 'r' },
+			{ "udp",     required_argument, 0, 'u' },
+			{ "speed",   required_argument, 0, 's' },
+			{ "metrics", required_argument, 0, 'm' },
+			{ "verbose", no_argument,       0, 'v' },
+			{ 0, 0, 0, 0 }
+		};
+		
+		int c = getopt_long(argc, argv, "h:r:u:s:m:v", long_options, NULL);
+		if(c == -1) break;
+		
+		switch(c)
+		{
+		case 'h': if(sources_add(&sources, SOURCE_HABITAT, optarg) != 0) return(-1); break;
+		case 'r': if(sources_add(&sources, SOURCE_REPLAY, optarg) != 0) return(-1); break;
+		case 'u': if(sources_add(&sources, SOURCE_UDP, optarg) != 0) return(-1); break;
+		case 's': sources.speed = atof(optarg); break;
+		case 'm': metrics_where = optarg; break;
+		case 'v': if(log_level < LOG_LEVEL_DEBUG) log_level++; break;
+		default:
+			fprintf(stderr, "Usage: %s [--habitat <url>] [--replay <capture>] [--udp [<address>:]<port>] [--speed <n>]\n", argv[0]);
+			fprintf(stderr, "       [--metrics <port or socket path>] [--verbose]\n");
+			fprintf(stderr, "Each source may be given more than once. A speed of 0 replays as fast as possible\n");
+			return(-1);
+		}
+	}
+	
+	/* Connect to habhub if no sources were given */
+	if(sources.count == 0) sources_add(&sources, SOURCE_HABITAT, HABHOUND_HABITAT_URL);
+	
 	/* Create the main window */
 	mainwin = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 	gtk_window_set_title(GTK_WINDOW(mainwin), "habhound - High Altitude Balloon tracking");
@@ -690,6 +605,7 @@ int main(int argc, char *argv[])
 	osm_gps_map_set_keyboard_shortcut(map, OSM_GPS_MAP_KEY_RIGHT, GDK_KEY_Right);
 	
 	g_signal_connect(map, "notify::tiles-queued", G_CALLBACK(on_tiles_queued_changed), NULL);
+	g_signal_connect(map, "notify::zoom", G_CALLBACK(on_zoom_changed), NULL);
 	
 	/* Setup key press event */
 	g_signal_connect(mainwin, "key-press-event", G_CALLBACK(key_press_event), NULL);
@@ -718,21 +634,81 @@ int main(int argc, char *argv[])
 	osm_gps_map_layer_add(map, osd);
 	g_object_unref(G_OBJECT(osd));
 	
-	/* Plot a point on the map */
-	g_balloon_blue = gdk_pixbuf_new_from_file("icons/balloon-blue.png", NULL);
-	g_radio_green  = gdk_pixbuf_new_from_file("icons/antenna-green.png", NULL);
-	g_car_red      = gdk_pixbuf_new_from_file("icons/car-red.png", NULL);
+	horizon_init();
+	
+	/* Start the core */
+	if(core_init(&hooks) != 0)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return(-1);
+	}
+	
+	/* Decode the icons, all at once */
+	if(atlas_load() != 0) return(-1);
+	
+	g_balloon_blue = atlas_icon("balloon", "blue", NULL);
+	g_radio_green  = atlas_icon("antenna", "green", NULL);
+	g_car_red      = atlas_icon("car", "red", NULL);
+	
+	if(!g_balloon_blue || !g_radio_green || !g_car_red)
+	{
+		fprintf(stderr, "Icons are missing from the atlas\n");
+		return(-1);
+	}
+	
+	/* Telemetry is only stored when following a habitat server,
+	 * restore everything received before the last exit */
+	if(sources_count(&sources, SOURCE_HABITAT) > 0)
+	{
+		store = store_open(HABHOUND_STORE, cb_habhound_replay, &dirty);
+		if(!store) fprintf(stderr, "Telemetry won't be stored\n");
+		habhound_refresh_dirty(dirty);
+	}
+	
+	/* Serve the metrics, if asked to */
+	if(metrics_where && !(metrics = metrics_serve(metrics_where)))
+	{
+		store_close(store);
+		return(-1);
+	}
 	
-	/* Start the habitat handler */
-	src_habitat = src_habitat_start("http://habitat.habhub.org/habitat");
+	/* Messages are written by a thread of their own from here on */
+	log_start();
+	
+	/* Start the sources */
+	if(sources_start(&sources, store) != 0)
+	{
+		sources_stop(&sources);
+		metrics_server_stop(metrics);
+		store_close(store);
+		log_stop();
+		return(-1);
+	}
+	
+	g_timeout_add_seconds(HABHOUND_STATS_INTERVAL, cb_habhound_stats, NULL);
 	
 	/* Finally show the lot */
 	gtk_widget_show(mainwin);
 	
 	gtk_main();
 	
-	/* Stop the habitat handler */
-	src_habitat_stop(src_habitat);
+	/* Stop the sources */
+	sources_stop(&sources);
+	metrics_server_stop(metrics);
+	store_close(store);
+	log_stop();
+	
+	core_print_sources(stderr);
+	core_free();
+	free(panel);
+	
+	/* Report how well the marker cache did */
+	marker_cache_stats(&hits, &misses, &count, &bytes);
+	fprintf(stderr, "Marker cache: %lu hits, %lu misses (%.1f%% hit rate), %u markers using %zu bytes\n",
+		hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0, count, bytes);
+	
+	marker_cache_free();
+	atlas_free();
 	
 	/* Done */
 	
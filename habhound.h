@@ -19,28 +19,10 @@
 #define __HABHOUND_H__
 
 #include <cairo.h>
-#include <stdarg.h>
+#include "core.h"
 
-typedef enum {
-	HAB_PAYLOAD,
-	HAB_LISTENER,
-	HAB_CHASE,
-} hab_object_type_t;
-
-extern char *vmake_message(const char *fmt, va_list ap);
-extern char *sprintf_alloc(const char *format, ... );
-
-extern void habhound_plot_object(
-	const char *callsign,
-	hab_object_type_t type,
-	time_t timestamp,
-	double latitude,
-	double longitude,
-	double altitude
-);
-
-extern void habhound_set_status(char *format, ... );
 extern int habhound_get_infobox(int index, cairo_surface_t **surface);
+extern int habhound_get_infobox_count(void);
 extern void habhound_delete_object(const char *callsign);
 
 #endif /* __HABHOUND_H__ */
@@ -23,6 +23,20 @@
  * number onwards. If necessary more curl easy interfaces can be added to
  * request specific documents. Whether they are returned as part of the
  * changes or directly doesn't matter.
+ *
+ * The thread is driven by curl_multi_socket_action(). libcurl's sockets and
+ * a timerfd for its timeouts are kept in an epoll set, so the thread only
+ * wakes when there is something to do.
+ *
+ * If the changes feed drops, or goes quiet for three heartbeats, it's
+ * reopened from the last sequence number seen -- straight away the first
+ * time, then backing off with some jitter if the server stays away. The
+ * basic details are only asked for when there's no sequence number yet.
+ *
+ * A sequence number stored by an earlier run against the same server is
+ * resumed from, once the basic details show the server has got that far.
+ * If its update_seq is lower the database has been recreated, and the
+ * stored one means nothing.
 */
 
 #include <stdio.h>
@@ -32,10 +46,20 @@
 #include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <curl/curl.h>
-#include <yajl/yajl_tree.h>
 #include "habitat.h"
-#include "habhound.h"
+#include "linebuf.h"
+#include "couchdoc.h"
+#include "core.h"
+#include "intern.h"
+#include "store.h"
+#include "metrics.h"
+#include "log.h"
 
 typedef struct {
 	
@@ -45,95 +69,144 @@ typedef struct {
 	/* The full URL of this connection */
 	char *url;
 	
-	/* Text buffer */
-	char *text;
+	/* POST body and headers, if any */
+	char *body;
+	struct curl_slist *headers;
 	
-	/* Length of text buffer, in characters */
-	size_t length;
+	/* Set if the response is a list of rows, rather than lines */
+	char rows;
+	
+	/* Line buffer */
+	linebuf_t lb;
+	
+	/* JSON field extractor */
+	couch_parser_t parser;
 	
 	/* Callback for when a complete string is received */
-	void (*callback)(src_habitat_t *, char *, yajl_val);
+	void (*callback)(src_habitat_t *, char *, couch_row_t *);
+	
+	/* For a batch of documents, the batch_seq it was sent with */
+	int seq;
+	
+	/* The curl easy handle, and whether it has been added to the
+	 * multi interface yet */
+	CURL *c;
+	char added;
+	
+	/* Neighbours in the list of unfinished requests */
+	void *prev;
+	void *next;
 	
 } strbuf_t;
 
+static long long _mtime(void)
+{
+	struct timespec ts;
+	
+	/* Monotonic time in milliseconds */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void strbuf_row_callback(void *userdata, couch_row_t *row)
+{
+	strbuf_t *sb = userdata;
+	
+	/* Rows without a document are deleted or missing */
+	if(row->has_doc) sb->callback(sb->s, NULL, row);
+}
+
 size_t strbuf_callback(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
 	strbuf_t *sb = userdata;
-	char *s;
+	char *line;
+	size_t length;
+	int lines = 0;
 	
 	/* This function receives data from libcurl - it builds it into a
 	 * string and passes each line to a callback function for processing */
 	
-	/* Append the new data to the buffer */
-	if(sb->text == NULL)
+	metrics_add(&metric_bytes_received, size * nmemb);
+	
+	/* Lists of rows are streamed straight into the parser */
+	if(sb->rows)
 	{
-		/* First data.. just duplicate it */
-		sb->text = strndup(ptr, size * nmemb);
-		sb->length = size * nmemb;
+		if(couch_parse_rows(&sb->parser, ptr, size * nmemb) != 0) return(0);
+		return(size * nmemb);
 	}
-	else
+	
+	/* Append the new data to the buffer. Returning a short
+	 * count tells libcurl to abort the transfer */
+	if(linebuf_append(&sb->lb, ptr, size * nmemb) != 0)
 	{
-		/* Allocate new buffer */
-		s = malloc(sb->length + size * nmemb + 1);
-		
-		/* Combine old and new data */
-		strcpy(s, sb->text);
-		strncat(s, ptr, size * nmemb);
-		
-		/* Replace old buffer */
-		free(sb->text);
-		sb->text = s;
-		sb->length += size * nmemb;
+		log_printf(LOG_LEVEL_ERROR, "strbuf_callback(): out of memory\n");
+		return(0);
 	}
 	
-	/* Test for a newline */
-	while((s = strstr(sb->text, "\n")) != NULL)
+	/* Handle each complete line */
+	while((line = linebuf_next(&sb->lb, &length)) != NULL)
 	{
-		char errbuf[1024];
-		yajl_val node = NULL;
-		
-		/* Null-terminate the string at the newline */
-		s[0] = '\0';
+		couch_row_t *row = NULL;
 		
-		/* Pass the string to yajl */
-		if(strlen(sb->text) > 0 && !(node = yajl_tree_parse(sb->text, errbuf, sizeof(errbuf))))
-			fprintf(stderr, "parse_error: %s\n", *errbuf ? errbuf : "unknown error");
+		/* Extract the fields of interest */
+		if(length > 0)
+		{
+			uint64_t t = metrics_now();
+			row = couch_parse(&sb->parser, line, length);
+			metrics_observe(&metric_parse_seconds, metrics_now() - t);
+		}
 		
 		/* Pass the string and result to the callback function */
-		sb->callback(sb->s, sb->text, node);
-		
-		/* Free yajl data */
-		if(node) yajl_tree_free(node);
-		
-		/* Move the remaining data in the string to the beginning */
-		s++;
-		sb->length = strlen(s);
-		memmove(sb->text, s, sb->length + 1);
+		sb->callback(sb->s, line, row);
+		lines++;
 	}
 	
+	metrics_add(&metric_lines_framed, lines);
+	
 	return(size * nmemb);
 }
 
-static int open_couch_url(src_habitat_t *s, void (*callback)(src_habitat_t *, char *, yajl_val), char *document, ... )
+static void strbuf_free(strbuf_t *sb)
+{
+	linebuf_free(&sb->lb);
+	couch_parser_free(&sb->parser);
+	curl_slist_free_all(sb->headers);
+	free(sb->body);
+	free(sb->url);
+	free(sb);
+}
+
+static int vopen_couch_url(src_habitat_t *s, void (*callback)(src_habitat_t *, char *, couch_row_t *), char *body, char *document, va_list ap)
 {
 	CURL *c;
 	strbuf_t *sb;
-	va_list ap;
 	char *temp;
 	
 	/* Allocate space for the private data */
 	sb = calloc(sizeof(strbuf_t), 1);
-	if(!sb) return(-1);
+	if(!sb)
+	{
+		free(body);
+		return(-1);
+	}
+	
+	/* The request body, if any, is freed with the strbuf. POST is
+	 * only used for views, which respond with a list of rows */
+	sb->body = body;
+	if(body)
+	{
+		sb->rows = 1;
+		sb->parser.row_callback = strbuf_row_callback;
+		sb->parser.user = sb;
+	}
 	
 	/* Create the full URL */
-	va_start(ap, document);
 	temp = vmake_message(document, ap);
-	va_end(ap);
 	
 	if(!temp)
 	{
 		/* Out of memory */
-		free(sb);
+		strbuf_free(sb);
 		return(-1);
 	}
 	
@@ -143,7 +216,7 @@ static int open_couch_url(src_habitat_t *s, void (*callback)(src_habitat_t *, ch
 	if(!sb->url)
 	{
 		/* Out of memory */
-		free(sb);
+		strbuf_free(sb);
 		return(-1);
 	}
 	
@@ -151,7 +224,7 @@ static int open_couch_url(src_habitat_t *s, void (*callback)(src_habitat_t *, ch
 	sb->callback = callback;
 	
 	/* Got the full URL */
-	fprintf(stderr, "=> %s\n", sb->url);
+	log_printf(LOG_LEVEL_DEBUG, "=> %s\n", sb->url);
 	
 	c = curl_easy_init();
 	curl_easy_setopt(c, CURLOPT_USERAGENT, "habhound/alpha");
@@ -160,269 +233,745 @@ static int open_couch_url(src_habitat_t *s, void (*callback)(src_habitat_t *, ch
 	curl_easy_setopt(c, CURLOPT_WRITEDATA, sb);
 	curl_easy_setopt(c, CURLOPT_PRIVATE, sb);
 	curl_easy_setopt(c, CURLOPT_ENCODING, "");
-	curl_multi_add_handle(s->cm, c);
+	
+	if(sb->body)
+	{
+		sb->headers = curl_slist_append(NULL, "Content-Type: application/json");
+		curl_easy_setopt(c, CURLOPT_HTTPHEADER, sb->headers);
+		curl_easy_setopt(c, CURLOPT_POSTFIELDS, sb->body);
+	}
+	
+	/* libcurl doesn't allow handles to be added from inside its own
+	 * callbacks, which is where most requests are made. Put it at the
+	 * head of the list, to be added by libcurl_perform() */
+	sb->c = c;
+	sb->prev = NULL;
+	sb->next = s->requests;
+	if(sb->next) ((strbuf_t *) sb->next)->prev = sb;
+	s->requests = sb;
+	
 	s->running++;
 	
 	return(s->running);
 }
 
+static int open_couch_url(src_habitat_t *s, void (*callback)(src_habitat_t *, char *, couch_row_t *), char *document, ... )
+{
+	va_list ap;
+	int r;
+	
+	va_start(ap, document);
+	r = vopen_couch_url(s, callback, NULL, document, ap);
+	va_end(ap);
+	
+	return(r);
+}
+
+static int post_couch_rows(src_habitat_t *s, void (*callback)(src_habitat_t *, char *, couch_row_t *), char *body, char *document, ... )
+{
+	va_list ap;
+	int r;
+	
+	va_start(ap, document);
+	r = vopen_couch_url(s, callback, body, document, ap);
+	va_end(ap);
+	
+	return(r);
+}
+
+static void couch_document_callback(src_habitat_t *s, char *str, couch_row_t *row);
+static void couch_changes_callback(src_habitat_t *s, char *str, couch_row_t *row);
+static void couch_initial_callback(src_habitat_t *s, char *str, couch_row_t *row);
+static void couch_info_callback(src_habitat_t *s, char *str, couch_row_t *row);
+static void habitat_dropped(src_habitat_t *s);
+
+/* Request the documents in the batch. Returns 0 on success, or -1 if the
+ * request couldn't be made. The batch is then kept, and tried again once
+ * another HABITAT_BATCH_WAIT has passed */
+static int couch_batch_flush(src_habitat_t *s)
+{
+	char *body, *p;
+	size_t length;
+	int i;
+	
+	if(s->batch_count == 0) return(0);
+	
+	/* Work out the size of the request body. IDs are
+	 * escaped, so allow for every character doubling */
+	length = 16;
+	for(i = 0; i < s->batch_count; i++)
+		length += strlen(s->batch[i]) * 2 + 3;
+	
+	body = malloc(length);
+	if(!body)
+	{
+		/* Out of memory, try again later */
+		s->batch_time = _mtime();
+		return(-1);
+	}
+	
+	/* Build the list of keys */
+	p = body + sprintf(body, "{\"keys\":[");
+	for(i = 0; i < s->batch_count; i++)
+	{
+		char *id;
+		
+		if(i > 0) *(p++) = ',';
+		*(p++) = '"';
+		
+		for(id = s->batch[i]; *id; id++)
+		{
+			if(*id == '"' || *id == '\\') *(p++) = '\\';
+			*(p++) = *id;
+		}
+		
+		*(p++) = '"';
+	}
+	strcpy(p, "]}");
+	
+	/* Request the lot, each row is passed to couch_document_callback */
+	if(post_couch_rows(s, couch_document_callback, body, "_all_docs?include_docs=true") < 0)
+	{
+		s->batch_time = _mtime();
+		return(-1);
+	}
+	
+	((strbuf_t *) s->requests)->seq = s->batch_seq;
+	
+	while(s->batch_count > 0) free(s->batch[--s->batch_count]);
+	
+	return(0);
+}
+
+/* Add the document for a change to the next batch to fetch. seq is the
+ * sequence number of the change before it. Returns 0 on success, or -1
+ * if the batch is full and still can't be sent, or out of memory */
+static int couch_batch_add(src_habitat_t *s, const char *id, int seq)
+{
+	char *t;
+	
+	/* A full batch couldn't be sent, try again now */
+	if(s->batch_count == HABITAT_BATCH_MAX && couch_batch_flush(s) != 0)
+		return(-1);
+	
+	t = strdup(id);
+	if(!t) return(-1); /* Out of memory */
+	
+	if(s->batch_count == 0)
+	{
+		s->batch_time = _mtime();
+		s->batch_seq = seq;
+	}
+	
+	s->batch[s->batch_count++] = t;
+	
+	/* Send the batch now if it's full. If that fails it's kept, the
+	 * ID has still been added */
+	if(s->batch_count == HABITAT_BATCH_MAX) couch_batch_flush(s);
+	
+	return(0);
+}
+
+/* Returns the number of milliseconds until the current batch is due
+ * to be sent, 0 if it's due now, or -1 if there is no batch waiting */
+static long couch_batch_timeout(src_habitat_t *s)
+{
+	long long t;
+	
+	if(s->batch_count == 0) return(-1);
+	
+	t = s->batch_time + HABITAT_BATCH_WAIT - _mtime();
+	return(t > 0 ? t : 0);
+}
+
+/* Clear a timerfd or eventfd */
+static void _drain(int fd)
+{
+	uint64_t count;
+	if(read(fd, &count, sizeof(count)) != sizeof(count)) return;
+}
+
+/* Add a file descriptor to the epoll set */
+static int _watch(src_habitat_t *s, int fd)
+{
+	struct epoll_event ev;
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	
+	return(epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev));
+}
+
+/* The sequence number up to which every change has been applied, for
+ * the store. Documents waiting to be fetched hold it back, and so do
+ * any that couldn't be */
+static int habitat_applied_seq(src_habitat_t *s)
+{
+	int seq = s->seq;
+	strbuf_t *sb;
+	
+	if(s->batch_count > 0 && s->batch_seq < seq) seq = s->batch_seq;
+	if(s->lost_seq >= 0 && s->lost_seq < seq) seq = s->lost_seq;
+	
+	for(sb = s->requests; sb; sb = sb->next)
+		if(sb->callback == couch_document_callback && sb->seq < seq) seq = sb->seq;
+	
+	return(seq);
+}
+
+/* The changes feed is open, again if it had dropped */
+static void habitat_resumed(src_habitat_t *s)
+{
+	if(s->dropped)
+	{
+		s->resume_time = _mtime() - s->dropped;
+		s->reconnects++;
+		
+		log_printf(LOG_LEVEL_INFO, "Reconnected to %s, %.1f seconds after the drop\n", s->url, s->resume_time / 1000.0);
+		habhound_set_status("Reconnected to %s after %.1f seconds", s->url, s->resume_time / 1000.0);
+	}
+	else habhound_set_status("Connected to %s", s->url);
+	
+	s->dropped = 0;
+}
+
+/* Header callback for the changes feed. The body is quiet until there's
+ * a change or heartbeat, so the feed counts as open once the server has
+ * said yes */
+static size_t couch_changes_header(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	strbuf_t *sb = userdata;
+	size_t length = size * nmemb;
+	char *sp;
+	
+	/* The status line, "HTTP/1.1 200 OK" */
+	if(length > 5 && memcmp(ptr, "HTTP/", 5) == 0 &&
+	   (sp = memchr(ptr, ' ', length)) && strtol(sp + 1, NULL, 10) == 200)
+		habitat_resumed(sb->s);
+	
+	return(length);
+}
+
+/* Open the changes feed from the current sequence number */
+static void couch_follow_changes(src_habitat_t *s)
+{
+	strbuf_t *sb;
+	
+	s->state = HABITAT_FOLLOWING;
+	s->last_data = _mtime();
+	s->info_time = s->last_data + HABITAT_INFO_INTERVAL;
+	s->changes = NULL;
+	
+	if(open_couch_url(s, couch_changes_callback,
+		"_changes?feed=continuous&since=%i&heartbeat=%i&include_docs=true",
+		s->seq, HABITAT_HEARTBEAT) < 0)
+	{
+		habitat_dropped(s);
+		return;
+	}
+	
+	/* Remember the request, to spot it ending or stalling */
+	sb = s->requests;
+	s->changes = sb;
+	
+	curl_easy_setopt(sb->c, CURLOPT_HEADERFUNCTION, couch_changes_header);
+	curl_easy_setopt(sb->c, CURLOPT_HEADERDATA, sb);
+}
+
+/* (Re)connect to the server. The changes feed is opened straight away
+ * if the sequence number is known, there's no need to ask again */
+static void habitat_connect(src_habitat_t *s)
+{
+	if(s->has_seq)
+	{
+		couch_follow_changes(s);
+		
+		/* The server's update_seq wasn't asked for, do it now */
+		s->info_time = _mtime();
+		return;
+	}
+	
+	s->state = HABITAT_CONNECTING;
+	if(open_couch_url(s, couch_initial_callback, "") < 0) habitat_dropped(s);
+}
+
+/* The connection has been lost, or never made. Work out how long to
+ * wait before trying again */
+static void habitat_dropped(src_habitat_t *s)
+{
+	long long now = _mtime();
+	long delay = 0;
+	
+	/* Time the outage from the first failure */
+	if(!s->dropped) s->dropped = now;
+	
+	/* Try once straight away, then back off */
+	if(s->attempts > 0)
+	{
+		int shift = s->attempts - 1;
+		
+		delay = HABITAT_RETRY_MAX;
+		if(shift < 16 && (HABITAT_RETRY_MIN << shift) < HABITAT_RETRY_MAX)
+			delay = HABITAT_RETRY_MIN << shift;
+		
+		/* Up to half of it random, so several clients
+		 * dropped at once don't all return at once */
+		delay -= rand_r(&s->rand) % (delay / 2 + 1);
+	}
+	
+	s->attempts++;
+	s->state = HABITAT_WAITING;
+	s->retry_time = now + delay;
+	
+	if(delay == 0) log_printf(LOG_LEVEL_WARN, "Disconnected from %s. Reconnecting...\n", s->url);
+	else
+	{
+		log_printf(LOG_LEVEL_WARN, "Disconnected from %s. Reconnecting in %.1f seconds...\n", s->url, delay / 1000.0);
+		habhound_set_status("Disconnected from %s. Reconnecting in %.1f seconds...", s->url, delay / 1000.0);
+	}
+}
+
+/* Free a request, finished or not */
+static void habitat_release(src_habitat_t *s, strbuf_t *sb)
+{
+	if(sb->added) curl_multi_remove_handle(s->cm, sb->c);
+	curl_easy_cleanup(sb->c);
+	
+	if(sb->prev) ((strbuf_t *) sb->prev)->next = sb->next;
+	else s->requests = sb->next;
+	if(sb->next) ((strbuf_t *) sb->next)->prev = sb->prev;
+	
+	strbuf_free(sb);
+	s->running--;
+}
+
+/* Milliseconds until the thread next has something to do that isn't
+ * signalled by a file descriptor, or -1 if nothing */
+static long habitat_timeout(src_habitat_t *s)
+{
+	long long t = -1;
+	long b = couch_batch_timeout(s);
+	
+	if(s->state == HABITAT_WAITING) t = s->retry_time - _mtime();
+	else if(s->state == HABITAT_FOLLOWING && s->changes)
+	{
+		t = s->last_data + HABITAT_STALL;
+		if(s->info_time < t) t = s->info_time;
+		t -= _mtime();
+	}
+	
+	if(t < 0 && t != -1) t = 0;
+	if(b != -1 && (t == -1 || b < t)) t = b;
+	
+	return(t);
+}
+
+/* libcurl tells us which sockets to watch here */
+static int libcurl_socket_callback(CURL *c, curl_socket_t fd, int what, void *userp, void *socketp)
+{
+	src_habitat_t *s = userp;
+	struct epoll_event ev;
+	
+	if(what == CURL_POLL_REMOVE)
+	{
+		/* The socket may already be closed, so ignore errors */
+		epoll_ctl(s->epfd, EPOLL_CTL_DEL, fd, NULL);
+		return(0);
+	}
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	if(what & CURL_POLL_IN) ev.events |= EPOLLIN;
+	if(what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+	
+	/* socketp is set once the socket is in the epoll set */
+	if(socketp) epoll_ctl(s->epfd, EPOLL_CTL_MOD, fd, &ev);
+	else
+	{
+		epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev);
+		curl_multi_assign(s->cm, fd, s);
+	}
+	
+	return(0);
+}
+
+/* ... and when it next wants to be called, if no sockets are active */
+static int libcurl_timer_callback(CURLM *cm, long timeout, void *userp)
+{
+	src_habitat_t *s = userp;
+	struct itimerspec its;
+	
+	memset(&its, 0, sizeof(its));
+	
+	if(timeout == 0) its.it_value.tv_nsec = 1; /* A zero value would disarm it */
+	else if(timeout > 0)
+	{
+		its.it_value.tv_sec = timeout / 1000;
+		its.it_value.tv_nsec = (timeout % 1000) * 1000000;
+	}
+	
+	/* A timeout of -1 disarms the timer */
+	timerfd_settime(s->tfd, 0, &its, NULL);
+	
+	return(0);
+}
+
 static int libcurl_perform(src_habitat_t *s)
 {
-	fd_set fdread, fdwrite, fdexcep;
-	struct timeval t;
-	long timeout;
-	int msgs, maxfd;
+	struct epoll_event ev[16];
+	int i, n, r, msgs;
 	CURLMsg *msg;
+	strbuf_t *sb;
 	
-	/* Let libcurl do it's thing */
-	curl_multi_perform(s->cm, &s->running);
+	/* Add any new requests to the multi handle. They're at the head
+	 * of the list, ahead of any already added. libcurl sets a timer
+	 * for each, so the wait below returns straight away */
+	for(sb = s->requests; sb && !sb->added; sb = sb->next)
+	{
+		curl_multi_add_handle(s->cm, sb->c);
+		sb->added = 1;
+	}
+	
+	/* Sleep until there is socket activity, a libcurl timeout, the next
+	 * batch or reconnect is due, the feed has stalled or the thread is
+	 * asked to stop */
+	n = epoll_wait(s->epfd, ev, 16, habitat_timeout(s));
+	if(n == -1)
+	{
+		if(errno == EINTR) return(0);
+		
+		log_printf(LOG_LEVEL_ERROR, "epoll_wait() error: %i: %s\n", errno, strerror(errno));
+		return(-1);
+	}
 	
-	if(s->running)
+	for(i = 0; i < n; i++)
 	{
-		FD_ZERO(&fdread);
-		FD_ZERO(&fdwrite);
-		FD_ZERO(&fdexcep);
+		int fd = ev[i].data.fd;
+		int flags = 0;
 		
-		if(curl_multi_fdset(s->cm, &fdread, &fdwrite, &fdexcep, &maxfd))
+		if(fd == s->efd)
 		{
-			fprintf(stderr, "curl_multi_fdset(): error\n");
-			return(-1);
+			/* Woken by src_habitat_stop() */
+			_drain(s->efd);
+			continue;
 		}
 		
-		if(curl_multi_timeout(s->cm, &timeout))
+		if(fd == s->tfd)
 		{
-			fprintf(stderr, "curl_multi_timeout() error\n");
-			return(-1);
+			/* libcurl's timer has expired */
+			_drain(s->tfd);
+			curl_multi_socket_action(s->cm, CURL_SOCKET_TIMEOUT, 0, &r);
+			continue;
 		}
 		
-		/* Default timeout 100ms */
-		if(timeout == -1) timeout = 100;
+		/* Let libcurl do it's thing. The count of running handles it
+		 * returns is ignored, as s->running also includes requests
+		 * still queued. It's updated as transfers finish instead */
+		if(ev[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+		if(ev[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+		if(ev[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
 		
-		if(maxfd == -1) usleep(timeout * 1000);
-		else
-		{
-			t.tv_sec = timeout / 1000;
-			t.tv_usec = (timeout % 1000) * 1000;
-			
-			if(select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &t) == -1)
-			{
-				fprintf(stderr, "select() error: %i: %s\n", errno, strerror(errno));
-				return(-1);
-			}
-		}
+		curl_multi_socket_action(s->cm, fd, flags, &r);
+	}
+	
+	/* Send any batch of document requests that's due */
+	if(couch_batch_timeout(s) == 0) couch_batch_flush(s);
+	
+	/* Write out what's been received, and how far through the feed.
+	 * Until the feed has a sequence number the stored one is kept */
+	if(s->store)
+	{
+		if(s->has_seq) store_set_seq(s->store, habitat_applied_seq(s));
+		store_flush(s->store);
 	}
 	
 	while((msg = curl_multi_info_read(s->cm, &msgs)))
 	{
 		if(msg->msg == CURLMSG_DONE)
 		{
-			CURL *c;
 			strbuf_t *sb;
+			long code = 0;
 			
-			/* Remove handle from the multi group */
-			c = msg->easy_handle;
-			curl_multi_remove_handle(s->cm, c);
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &sb);
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
 			
-			/* Free memory used by the strbuf parser */
-			curl_easy_getinfo(c, CURLINFO_PRIVATE, &sb);
-			if(sb->text) free(sb->text);
-			free(sb);
+			/* A batch of documents that didn't arrive is asked for
+			 * again on the next start, the store stops before it */
+			if(sb->callback == couch_document_callback &&
+			   (msg->data.result != CURLE_OK || code != 200))
+			{
+				log_printf(LOG_LEVEL_WARN, "%s: %s (%li), documents lost\n", sb->url, curl_easy_strerror(msg->data.result), code);
+				if(s->lost_seq < 0 || sb->seq < s->lost_seq) s->lost_seq = sb->seq;
+			}
+			
+			/* The changes feed should never end, and if asking for
+			 * the basic details didn't lead to it, try again */
+			if(sb == s->changes || (sb->callback == couch_initial_callback &&
+			   s->state == HABITAT_CONNECTING))
+			{
+				log_printf(LOG_LEVEL_WARN, "%s: %s\n", sb->url, curl_easy_strerror(msg->data.result));
+				if(sb == s->changes) s->changes = NULL;
+				if(!s->stopping) habitat_dropped(s);
+			}
 			
-			/* Done with this handle */
-			curl_easy_cleanup(c);
+			/* Done with this handle, and the strbuf parser */
+			habitat_release(s, sb);
 		}
 	}
 	
+	/* Missed heartbeats mean the feed has silently died */
+	if(s->state == HABITAT_FOLLOWING && s->changes &&
+	   _mtime() - s->last_data >= HABITAT_STALL)
+	{
+		log_printf(LOG_LEVEL_WARN, "No heartbeat from %s for %i seconds\n", s->url, HABITAT_STALL / 1000);
+		
+		habitat_release(s, s->changes);
+		s->changes = NULL;
+		habitat_dropped(s);
+	}
+	
+	/* See how far behind the server the feed is */
+	if(s->state == HABITAT_FOLLOWING && _mtime() >= s->info_time)
+	{
+		s->info_time = _mtime() + HABITAT_INFO_INTERVAL;
+		open_couch_url(s, couch_info_callback, "");
+	}
+	
+	/* Reconnect when it's time */
+	if(s->state == HABITAT_WAITING && _mtime() >= s->retry_time && !s->stopping)
+		habitat_connect(s);
+	
 	return(0);
 }
 
-static void couch_document_callback(src_habitat_t *s, char *str, yajl_val node)
+/* Fill in a position update from a row with a telemetry document.
+ * Returns 0 if the document has a position to plot, or -1 if not */
+int habitat_document_update(couch_row_t *row, hab_update_t *u)
 {
-	const char *path[] = { 0, 0, 0 };
-	const char *doctype, *callsign;
-	yajl_val v;
+	couch_doc_t *doc = &row->doc;
+	const char *callsign;
 	hab_object_type_t type;
-	double lat, lng, alt;
 	
 	/* Find out which document type this is */
-	path[0] = "type";
-	v = yajl_tree_get(node, path, yajl_t_string);
-	doctype = (v ? YAJL_GET_STRING(v) : NULL);
-        if(!doctype) return;
-	
-	if(strcmp(doctype, "payload_telemetry") == 0) type = HAB_PAYLOAD;
-	else if(strcmp(doctype, "listener_telemetry") == 0) type = HAB_LISTENER;
-	else return; /* Unknown document type */
-	
-	path[0] = "data";
-	
-	/* In the case of payload telemetry, make sure the data has been
-	 * parsed by the server */
-	if(type == HAB_PAYLOAD)
+	switch(doc->type)
 	{
-		path[1] = "_parsed";
-		v = yajl_tree_get(node, path, yajl_t_object);
-		if(!v) return; /* Document data has not been parsed */
-	}
-	
-	/* Get the callsign */
-	path[1] = (type == HAB_PAYLOAD ? "payload" : "callsign");
-	v = yajl_tree_get(node, path, yajl_t_string);
-	callsign = (v ? YAJL_GET_STRING(v) : NULL);
-	if(!callsign) return;
+	case COUCH_DOC_PAYLOAD_TELEMETRY:
+		/* In the case of payload telemetry, make sure the data has been
+		 * parsed by the server */
+		if(!doc->parsed) return(-1);
+		
+		type = HAB_PAYLOAD;
+		callsign = doc->payload;
+		break;
 	
-	/* Get the latitude */
-	path[1] = "latitude";
-	v = yajl_tree_get(node, path, yajl_t_number);
-	lat = (v ? YAJL_GET_DOUBLE(v) : 0);
+	case COUCH_DOC_LISTENER_TELEMETRY:
+		type = HAB_LISTENER;
+		callsign = doc->callsign;
+		break;
 	
-	/* Get the longitude */
-	path[1] = "longitude";
-	v = yajl_tree_get(node, path, yajl_t_number);
-	lng = (v ? YAJL_GET_DOUBLE(v) : 0);
+	default: return(-1); /* Unknown document type */
+	}
 	
-	/* Get the altitude */
-	path[1] = "altitude";
-	v = yajl_tree_get(node, path, yajl_t_number);
-	alt = (v ? YAJL_GET_DOUBLE(v) : 0);
+	if(*callsign == '\0') return(-1);
 	
 	/* Listener stations with "chase" in the name get the car icon */
 	if(type == HAB_LISTENER && strstr(callsign, "chase"))
 		type = HAB_CHASE;
 	
-	/* Send it to the map! */
-	habhound_plot_object(callsign, type, time(NULL), lat, lng, alt);
+	u->callsign  = intern(callsign);
+	u->type      = type;
+	u->timestamp = time(NULL);
+	u->latitude  = doc->latitude;
+	u->longitude = doc->longitude;
+	u->altitude  = doc->altitude;
+	u->uploaded  = doc->uploaded;
+	
+	/* Payload sentences are known by their number and time, which
+	 * is the same however they were received. Anything else by its
+	 * document ID, which is the same on every mirror */
+	if(doc->has_sentence_id) u->sentence = core_sentence_key(doc->sentence_id, doc->time);
+	else u->sentence = core_id_key(row->id);
+	
+	return(u->callsign ? 0 : -1);
+}
+
+static void couch_document_callback(src_habitat_t *s, char *str, couch_row_t *row)
+{
+	hab_update_t u;
+	
+	/* Don't proceed if no JSON data present */
+	if(!row || habitat_document_update(row, &u) != 0) return;
+	
+	/* Send it to the map! Repeats of telemetry
+	 * already sent go no further */
+	if(core_push(s->source, &u) == 1) return;
+	
+	/* And keep it for next time */
+	if(s->store && (u.latitude != 0 || u.longitude != 0))
+		store_append(s->store, &u);
 }
 
-static void couch_changes_callback(src_habitat_t *s, char *str, yajl_val node)
+static void couch_changes_callback(src_habitat_t *s, char *str, couch_row_t *row)
 {
-	const char *path[] = { 0, 0 };
-	yajl_val v;
-	char *id;
+	int seq;
+	
+	/* Anything at all shows the feed is still alive. The back off
+	 * only starts again from nothing once the feed has sent something,
+	 * a server that accepts then hangs up at once isn't hammered */
+	s->last_data = _mtime();
+	s->attempts = 0;
 	
 	/* Couchdb should send an empty line to keep the connection alive */
-	if(strlen(str) == 0)
+	if(*str == '\0')
 	{
-		fprintf(stderr, "Ping? Pong!\n");
+		core_source_alive(s->source);
 		return;
 	}
 	
-	/* Update the recorded sequence number */
-	path[0] = "seq";
-	v = yajl_tree_get(node, path, yajl_t_number);
-	if(v) s->seq = YAJL_GET_INTEGER(v);
-	else return;
+	/* Update the recorded sequence number. The store is only told
+	 * once the document has been applied, by libcurl_perform() */
+	if(!row || !row->has_seq) return;
+	seq = s->seq;
+	s->seq = row->seq;
+	core_source_feed(s->source, s->seq);
 	
 	/* Was the document included? */
-	path[0] = "doc";
-	v = yajl_tree_get(node, path, yajl_t_object);
-	if(v)
+	if(row->has_doc)
 	{
-		couch_document_callback(s, NULL, v);
+		couch_document_callback(s, NULL, row);
 		return;
 	}
 	
 	/* The document wasn't included in the changes record,
-	 * request it directly */
-	path[0] = "id";
-	v = yajl_tree_get(node, path, yajl_t_string);
-	id = (v ? YAJL_GET_STRING(v) : NULL);
-	if(!id) return;
+	 * add it to the next batch to be requested */
+	if(*row->id == '\0') return;
 	
-	open_couch_url(s, couch_document_callback, "%s", id);
+	if(couch_batch_add(s, row->id, seq) != 0)
+	{
+		/* The store is held back to before it, so it's
+		 * asked for again on the next start */
+		log_printf(LOG_LEVEL_WARN, "Couldn't queue document %s to be fetched\n", row->id);
+		metrics_add(&metric_documents_dropped, 1);
+		if(s->lost_seq < 0 || seq < s->lost_seq) s->lost_seq = seq;
+	}
 }
 
-static void couch_initial_callback(src_habitat_t *s, char *str, yajl_val node)
+static void couch_initial_callback(src_habitat_t *s, char *str, couch_row_t *row)
 {
-	const char *path[] = { 0, 0 };
-	yajl_val v;
-	char *vs;
 	int seq;
 	
 	/* Don't proceed if no JSON data present */
-	if(!node) return;
+	if(!row) return;
 	
-	path[0] = "update_seq";
-	v = yajl_tree_get(node, path, yajl_t_number);
-	if(v) seq = YAJL_GET_INTEGER(v);
+	if(row->has_update_seq) seq = row->update_seq;
 	else
 	{
-		fprintf(stderr, "No update_seq found in response from server\n");
+		log_printf(LOG_LEVEL_ERROR, "No update_seq found in response from server\n");
 		return;
 	}
 	
-	path[0] = "db_name";
-	v = yajl_tree_get(node, path, yajl_t_string);
-	vs = YAJL_GET_STRING(v);
-	if(vs) s->db_name = strdup(vs);
+	if(*row->db_name)
+	{
+		free(s->db_name);
+		s->db_name = strdup(row->db_name);
+	}
 	else
 	{
-		fprintf(stderr, "No db_name found in response from server\n");
+		log_printf(LOG_LEVEL_ERROR, "No db_name found in response from server\n");
 		return;
 	}
 	
-	fprintf(stderr, "Connected to %s\n", s->url);
-	fprintf(stderr, "db_name: %s\n", s->db_name);
-	fprintf(stderr, "update_seq: %i\n", seq);
+	log_printf(LOG_LEVEL_INFO, "Connected to %s\n", s->url);
+	log_printf(LOG_LEVEL_INFO, "db_name: %s\n", s->db_name);
+	log_printf(LOG_LEVEL_INFO, "update_seq: %i\n", seq);
 	
-	/* Resume from the previous point if one is set */
-	if(s->seq > 0) fprintf(stderr, "Resuming from update_seq: %i\n", s->seq);
-	else s->seq = seq;
+	core_source_server_seq(s->source, seq);
 	
-	habhound_set_status("Connected to %s", s->url);
+	/* Carry on from the last change stored, if the server has it */
+	if(s->stored_seq > seq)
+		log_printf(LOG_LEVEL_WARN, "Stored update_seq %i is ahead of the server, ignoring it\n", s->stored_seq);
+	else if(s->stored_seq > 0)
+	{
+		log_printf(LOG_LEVEL_INFO, "Resuming from update_seq: %i\n", s->stored_seq);
+		seq = s->stored_seq;
+	}
+	
+	s->seq = seq;
+	s->has_seq = 1;
+	s->stored_seq = 0;
 	
 	/* Server seems good, begin monitoring changes */
-	open_couch_url(s, couch_changes_callback, "_changes?feed=continuous&since=%i&heartbeat=5000&include_docs=true", s->seq);
+	couch_follow_changes(s);
+}
+
+/* The server's latest update_seq, asked for now and then */
+static void couch_info_callback(src_habitat_t *s, char *str, couch_row_t *row)
+{
+	if(row && row->has_update_seq) core_source_server_seq(s->source, row->update_seq);
 }
 
 static void *habitat_thread(void *arg)
 {
 	src_habitat_t *s = (src_habitat_t *) arg;
-	int r;
+	strbuf_t *sb;
+	
+	/* Create the epoll set and libcurl's timer */
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	s->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	
+	if(s->epfd == -1 || s->tfd == -1 ||
+	   _watch(s, s->tfd) == -1 || _watch(s, s->efd) == -1)
+	{
+		log_printf(LOG_LEVEL_ERROR, "habitat thread failed to create epoll set: %s\n", strerror(errno));
+		if(s->epfd != -1) close(s->epfd);
+		if(s->tfd != -1) close(s->tfd);
+		return(NULL);
+	}
 	
 	/* Create the multi interface, and enable pipelining */
 	s->cm = curl_multi_init();
-	if(!s->cm) return(NULL);
+	if(!s->cm)
+	{
+		close(s->epfd);
+		close(s->tfd);
+		return(NULL);
+	}
 	
 	curl_multi_setopt(s->cm, CURLMOPT_PIPELINING, 1L);
+	curl_multi_setopt(s->cm, CURLMOPT_SOCKETFUNCTION, libcurl_socket_callback);
+	curl_multi_setopt(s->cm, CURLMOPT_SOCKETDATA, s);
+	curl_multi_setopt(s->cm, CURLMOPT_TIMERFUNCTION, libcurl_timer_callback);
+	curl_multi_setopt(s->cm, CURLMOPT_TIMERDATA, s);
 	
 	/* Open the initial connection to the database */
-	habhound_set_status("Connecting to server...");
-	open_couch_url(s, couch_initial_callback, "");
+	habhound_set_status("Connecting to %s...", s->url);
+	habitat_connect(s);
 	
-	/* The main libcurl loop */
+	/* The main libcurl loop, reconnecting is handled inside */
 	while(!s->stopping)
 	{
-		/* The main libcurl loop */
-		while(s->running)
-		{
-			r = libcurl_perform(s);
-			if(r != 0) break;
-			if(s->stopping) break;
-		}
-		
-		if(!s->stopping)
-		{
-			fprintf(stderr, "Disconnected from server. Reconnecting in 10 seconds...\n");
-			habhound_set_status("Disconnected from server. Reconnecting in 10 seconds...");
-		}
-		
-		/* Sleep for 10 seconds */
-		for(r = 0; r < 100 && !s->stopping; r++)
-			usleep(100000);
-		
-		/* Start a new connection to habitat */
-		if(!s->stopping) open_couch_url(s, couch_initial_callback, "");
+		if(libcurl_perform(s) != 0) break;
 	}
 	
+	/* Drop any requests still open, or never started */
+	while((sb = s->requests)) habitat_release(s, sb);
+	
 	curl_multi_cleanup(s->cm);
+	close(s->epfd);
+	close(s->tfd);
 	
-	fprintf(stderr, "habitat thread ending\n");
+	/* Drop any document requests still waiting */
+	while(s->batch_count > 0) free(s->batch[--s->batch_count]);
+	
+	log_printf(LOG_LEVEL_INFO, "habitat thread ending\n");
 	
 	return(NULL);
 }
 
-src_habitat_t *src_habitat_start(char *url)
+/* Start following the habitat server at url. Updates are pushed to
+ * source, and stored in store if it's not NULL */
+src_habitat_t *src_habitat_start(char *url, store_t *store, core_source_t *source)
 {
 	src_habitat_t *s;
 	pthread_attr_t attr;
@@ -439,6 +988,30 @@ src_habitat_t *src_habitat_start(char *url)
 		return(NULL);
 	}
 	
+	s->source = source;
+	
+	/* The last change stored is only carried on from if it was this
+	 * server's, checked against its update_seq once connected */
+	s->store = store;
+	if(store)
+	{
+		s->stored_seq = store_seq(store, url);
+		store_set_source(store, url);
+	}
+	
+	s->rand = time(NULL) ^ (uintptr_t) s;
+	s->lost_seq = -1;
+	
+	/* Used to wake the thread when stopping */
+	s->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(s->efd == -1)
+	{
+		perror("eventfd");
+		free(s->url);
+		free(s);
+		return(NULL);
+	}
+	
 	/* Start the thread */
 	pthread_attr_init(&attr);
 	r = pthread_create(&s->t, &attr, habitat_thread, (void *) s);
@@ -447,9 +1020,10 @@ src_habitat_t *src_habitat_start(char *url)
 	if(r != 0)
 	{
 		/* Didn't work! */
-		fprintf(stderr, "habitat thread failed to start\n");
+		log_printf(LOG_LEVEL_ERROR, "habitat thread failed to start\n");
 		perror("pthread_create");
 		
+		close(s->efd);
 		free(s->url);
 		free(s);
 		
@@ -461,12 +1035,18 @@ src_habitat_t *src_habitat_start(char *url)
 
 void src_habitat_stop(src_habitat_t *s)
 {
+	uint64_t one = 1;
+	
 	/* Signal to the thread we're stopping */
 	s->stopping = 1;
+	if(write(s->efd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
 	
 	/* Wait until it complies */
 	pthread_join(s->t, NULL);
 	
+	close(s->efd);
+	free(s->db_name);
 	free(s->url);
 	free(s);
 }
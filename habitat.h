@@ -18,6 +18,38 @@
 #ifndef __HABITAT_H__
 #define __HABITAT_H__
 
+#include "store.h"
+#include "couchdoc.h"
+#include "updq.h"
+
+/* Document IDs missing from the changes feed are fetched in batches with
+ * _all_docs. A batch is sent once it is full or its oldest ID has waited
+ * for HABITAT_BATCH_WAIT milliseconds */
+#define HABITAT_BATCH_MAX  (100)
+#define HABITAT_BATCH_WAIT (250)
+
+/* The changes feed sends a heartbeat every HABITAT_HEARTBEAT milliseconds
+ * while it's idle, and is taken to have stalled after HABITAT_STALL
+ * milliseconds without one */
+#define HABITAT_HEARTBEAT (5000)
+#define HABITAT_STALL     (HABITAT_HEARTBEAT * 3)
+
+/* After a drop the first reconnect is made straight away. If that fails
+ * the delay starts at HABITAT_RETRY_MIN milliseconds and doubles on each
+ * failure up to HABITAT_RETRY_MAX, with up to half of it random */
+#define HABITAT_RETRY_MIN (500)
+#define HABITAT_RETRY_MAX (30000)
+
+/* How often the server is asked for its latest update_seq while
+ * following the feed, to see how far behind it is, in milliseconds */
+#define HABITAT_INFO_INTERVAL (30000)
+
+typedef enum {
+	HABITAT_CONNECTING, /* Asking the server for its update_seq */
+	HABITAT_FOLLOWING,  /* The changes feed is open */
+	HABITAT_WAITING,    /* Waiting to reconnect */
+} habitat_state_t;
+
 typedef struct
 {
 	/* Base URL of the CouchDB server */
@@ -29,9 +61,50 @@ typedef struct
 	/* Number of curl easy interfaces running */
 	int running;
 	
+	/* epoll set for the libcurl sockets and timer */
+	int epfd;
+	int tfd; /* timerfd for libcurl's timeouts */
+	int efd; /* eventfd to wake the thread when stopping */
+	
+	/* Requests that haven't finished, newest first. New ones are
+	 * added to the multi interface by libcurl_perform() */
+	void *requests;
+	
 	/* Server details */
 	char *db_name; /* Database name */
 	int seq; /* Sequence number */
+	char has_seq; /* Set once seq is known, once the server is asked */
+	int stored_seq; /* Stored seq for this server to resume from, or 0 */
+	
+	/* Connection state */
+	habitat_state_t state;
+	void *changes; /* The changes feed request, if open */
+	long long last_data; /* When the feed last sent a line, in ms */
+	long long retry_time; /* When to reconnect, while waiting */
+	long long dropped; /* When the feed dropped, 0 once it's back */
+	long long info_time; /* When to next ask for the update_seq */
+	int attempts; /* Reconnects since the feed last sent anything */
+	unsigned int rand; /* Seed for the jitter */
+	
+	/* Reconnect statistics */
+	unsigned long reconnects;
+	long long resume_time; /* Time taken to resume after the last drop, ms */
+	
+	/* Where received positions are logged, may be NULL */
+	store_t *store;
+	
+	/* Where updates are sent */
+	core_source_t *source;
+	
+	/* Document IDs waiting to be fetched */
+	char *batch[HABITAT_BATCH_MAX];
+	int batch_count;
+	long long batch_time; /* When the first ID was added, in ms */
+	int batch_seq; /* Sequence number of the change before the first ID */
+	
+	/* Sequence number before the earliest batch of documents that
+	 * couldn't be fetched, or -1. The store is held back to it */
+	int lost_seq;
 	
 	/* Thread stuffs */
 	pthread_t t;
@@ -39,8 +112,9 @@ typedef struct
 	
 } src_habitat_t;
 
-extern src_habitat_t *src_habitat_start(char *url);
-extern void src_habitat_stop();
+extern src_habitat_t *src_habitat_start(char *url, store_t *store, core_source_t *source);
+extern void src_habitat_stop(src_habitat_t *s);
+extern int habitat_document_update(couch_row_t *row, hab_update_t *u);
 
 #endif /* __HABITAT_H__ */
 
@@ -0,0 +1,243 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* habhound-core, the tracker without the map. Positions are taken in as
+ * fast as the sources deliver them and each change is written to stdout
+ * as a line of tab separated fields:
+ *
+ *   timestamp type callsign latitude longitude altitude max-altitude
+ *
+ * for other programs to consume. Status messages go to stderr. The
+ * store, sources and options are the same as habhound's.
+ *
+ * Sending SIGUSR1 writes each source's statistics to stderr, as
+ * core_dump_stats() describes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <curl/curl.h>
+#include "core.h"
+#include "store.h"
+#include "sources.h"
+#include "metrics.h"
+#include "log.h"
+
+/* The habitat server to use if none is given */
+#define HABHOUND_HABITAT_URL "http://habitat.habhub.org/habitat"
+
+/* Where received telemetry is kept between runs */
+#define HABHOUND_STORE "habhound.store"
+
+/* Written to by the wake hook when the queue needs draining */
+static int efd = -1;
+
+/* Set by SIGINT or SIGTERM */
+static volatile sig_atomic_t stopping = 0;
+
+/* Set by SIGUSR1 */
+static volatile sig_atomic_t dump_stats = 0;
+
+/* Core hook, updates are waiting. Called from the source threads */
+static void headless_wake(void)
+{
+	uint64_t one = 1;
+	
+	if(write(efd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
+}
+
+/* Core hook, a new status message */
+static void headless_status(char *message)
+{
+	log_printf(LOG_LEVEL_INFO, "%s\n", message);
+	free(message);
+}
+
+/* Write out each object changed by an update */
+static void cb_headless_update(void *user, hab_update_t *data, hab_object_t *obj)
+{
+	if(!obj) return;
+	
+	fprintf((FILE *) user, "%ld\t%s\t%s\t%.6f\t%.6f\t%.1f\t%.1f\n",
+		(long) obj->timestamp, habhound_object_type_name(obj->type),
+		obj->callsign, obj->latitude, obj->longitude, obj->altitude,
+		obj->max_altitude);
+}
+
+/* Apply a position read back from the store at startup. These
+ * are written out too, so consumers start with the full picture */
+static void cb_headless_replay(void *user, hab_update_t *data)
+{
+	cb_headless_update(user, data, core_apply_update(data));
+}
+
+static void on_signal(int sig)
+{
+	if(sig == SIGUSR1) dump_stats = 1;
+	else stopping = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	static const core_hooks_t hooks = { headless_wake, headless_status };
+	sources_t sources = { .speed = 1.0 };
+	store_t *store = NULL;
+	metrics_server_t *metrics = NULL;
+	char *metrics_where = NULL;
+	struct sigaction sa;
+	
+	/* Read the command line */
+	while(1)
+	{
+		static const struct option long_options[] = {
+			{ "habitat", required_argument, 0, 'h' },
+			{ "replay",  required_argument, 0, 'r' },
+			{ "udp",     required_argument, 0, 'u' },
+			{ "speed",   required_argument, 0, 's' },
+			{ "metrics", required_argument, 0, 'm' },
+			{ "verbose", no_argument,       0, 'v' },
+			{ 0, 0, 0, 0 }
+		};
+		
+		int c = getopt_long(argc, argv, "h:r:u:s:m:v", long_options, NULL);
+		if(c == -1) break;
+		
+		switch(c)
+		{
+		case 'h': if(sources_add(&sources, SOURCE_HABITAT, optarg) != 0) return(-1); break;
+		case 'r': if(sources_add(&sources, SOURCE_REPLAY, optarg) != 0) return(-1); break;
+		case 'u': if(sources_add(&sources, SOURCE_UDP, optarg) != 0) return(-1); break;
+		case 's': sources.speed = atof(optarg); break;
+		case 'm': metrics_where = optarg; break;
+		case 'v': if(log_level < LOG_LEVEL_DEBUG) log_level++; break;
+		default:
+			fprintf(stderr, "Usage: %s [--habitat <url>] [--replay <capture>] [--udp [<address>:]<port>] [--speed <n>]\n", argv[0]);
+			fprintf(stderr, "       [--metrics <port or socket path>] [--verbose]\n");
+			fprintf(stderr, "Each source may be given more than once. A speed of 0 replays as fast as possible\n");
+			return(-1);
+		}
+	}
+	
+	/* Connect to habhub if no sources were given */
+	if(sources.count == 0) sources_add(&sources, SOURCE_HABITAT, HABHOUND_HABITAT_URL);
+	
+	/* Initialise libraries */
+	curl_global_init(CURL_GLOBAL_ALL);
+	
+	efd = eventfd(0, EFD_CLOEXEC);
+	if(efd == -1)
+	{
+		perror("eventfd");
+		return(-1);
+	}
+	
+	/* Start the core */
+	if(core_init(&hooks) != 0)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return(-1);
+	}
+	
+	/* Stop cleanly on ^C or kill. Without SA_RESTART
+	 * the signal interrupts the poll below */
+	sa.sa_handler = on_signal;
+	sa.sa_flags = 0;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+	
+	/* Telemetry is only stored when following a habitat server,
+	 * restore everything received before the last exit */
+	if(sources_count(&sources, SOURCE_HABITAT) > 0)
+	{
+		store = store_open(HABHOUND_STORE, cb_headless_replay, stdout);
+		if(!store) fprintf(stderr, "Telemetry won't be stored\n");
+		fflush(stdout);
+	}
+	
+	/* Serve the metrics, if asked to */
+	if(metrics_where && !(metrics = metrics_serve(metrics_where)))
+	{
+		store_close(store);
+		return(-1);
+	}
+	
+	/* Messages are written by a thread of their own from here on */
+	log_start();
+	
+	/* Start the sources */
+	if(sources_start(&sources, store) != 0)
+	{
+		sources_stop(&sources);
+		metrics_server_stop(metrics);
+		store_close(store);
+		log_stop();
+		return(-1);
+	}
+	
+	/* Apply updates as soon as they arrive */
+	while(!stopping)
+	{
+		struct pollfd p = { efd, POLLIN, 0 };
+		uint64_t n;
+		
+		if(dump_stats)
+		{
+			dump_stats = 0;
+			core_dump_stats(stderr);
+		}
+		
+		if(poll(&p, 1, 1000) == -1)
+		{
+			if(errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+		
+		if(!(p.revents & POLLIN)) continue;
+		if(read(efd, &n, sizeof(n)) != sizeof(n)) continue;
+		
+		core_drain(cb_headless_update, stdout, NULL);
+		fflush(stdout);
+	}
+	
+	/* Stop the sources */
+	sources_stop(&sources);
+	metrics_server_stop(metrics);
+	store_close(store);
+	log_stop();
+	
+	/* Anything left over */
+	core_drain(cb_headless_update, stdout, NULL);
+	fflush(stdout);
+	
+	core_print_sources(stderr);
+	core_free();
+	close(efd);
+	
+	return(0);
+}
+
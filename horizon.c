@@ -0,0 +1,86 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* The circle around a balloon showing how far it can be heard, the
+ * points on the earth's surface at the distance to its horizon. Plain
+ * C, so it can be measured without GTK.
+*/
+
+#include <math.h>
+#include "horizon.h"
+
+#define deg2rad(deg) ((deg) * M_PI / 180.0)
+
+/* Sine and cosine of the bearing to each point on the horizon circle */
+static double horizon_sin[HORIZON_POINTS + 1];
+static double horizon_cos[HORIZON_POINTS + 1];
+
+void horizon_init(void)
+{
+	int i;
+	
+	for(i = 0; i <= HORIZON_POINTS; i++)
+	{
+		double b = M_PI * 2.0 / HORIZON_POINTS * i;
+		horizon_sin[i] = sin(b);
+		horizon_cos[i] = cos(b);
+	}
+}
+
+/* Decide if a circle needs moving to latitude, longitude (in degrees)
+ * and distance (in metres). It does if it would shift by more than a
+ * pixel of mpp metres, or the map has zoomed in since it was placed.
+ * Returns 1 and records the new place if so, or 0 */
+int horizon_moved(horizon_t *h, double latitude, double longitude, double distance, int zoom, double mpp)
+{
+	if(zoom <= h->zoom &&
+	   fabs(distance - h->distance) <= mpp &&
+	   fabs(latitude - h->latitude) * 111320.0 <= mpp &&
+	   fabs(longitude - h->longitude) * 111320.0 * cos(deg2rad(latitude)) <= mpp) return(0);
+	
+	h->latitude  = latitude;
+	h->longitude = longitude;
+	h->distance  = distance;
+	h->zoom      = zoom;
+	
+	return(1);
+}
+
+/* Calculate the HORIZON_POINTS + 1 points of a circle around latitude,
+ * longitude (in degrees) at distance metres, into lat and lng (in
+ * radians). The last point closes the circle */
+void horizon_circle(double latitude, double longitude, double distance, double *lat, double *lng)
+{
+	double lat1 = deg2rad(latitude);
+	double lng1 = deg2rad(longitude);
+	double d = distance / 6378137.0; /* Average radius of the earth */
+	double sin_lat1 = sin(lat1), cos_lat1 = cos(lat1);
+	double sin_d = sin(d), cos_d = cos(d);
+	int i;
+	
+	/* Formula from http://www.movable-type.co.uk/scripts/latlong.html
+	 * The sin(lat2) term is just the argument to asin() */
+	
+	for(i = 0; i <= HORIZON_POINTS; i++)
+	{
+		double sin_lat2 = sin_lat1 * cos_d + cos_lat1 * sin_d * horizon_cos[i];
+		
+		lat[i] = asin(sin_lat2);
+		lng[i] = lng1 + atan2(horizon_sin[i] * sin_d * cos_lat1, cos_d - sin_lat1 * sin_lat2);
+	}
+}
+
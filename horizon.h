@@ -0,0 +1,37 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __HORIZON_H__
+#define __HORIZON_H__
+
+/* Number of segments in the horizon circle */
+#define HORIZON_POINTS (100)
+
+/* Where a horizon circle was last placed */
+typedef struct {
+	double latitude;  /* Degrees */
+	double longitude;
+	double distance;  /* Metres */
+	int zoom;         /* -1 until it's first placed */
+} horizon_t;
+
+extern void horizon_init(void);
+extern int horizon_moved(horizon_t *h, double latitude, double longitude, double distance, int zoom, double mpp);
+extern void horizon_circle(double latitude, double longitude, double distance, double *lat, double *lng);
+
+#endif /* __HORIZON_H__ */
+
@@ -0,0 +1,182 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Rendering of the payload infoboxes shown down the side of the map.
+ *
+ * The parts of a box that don't change with each position, the frame,
+ * icon and title, are drawn once into a background surface. The box
+ * itself is a copy of that with the lines of text drawn over it. When
+ * the box is updated only the lines whose text has changed are redrawn,
+ * by restoring their strip of the background and drawing the new text.
+ *
+ * The fonts are looked up once and kept as scaled fonts, rather than
+ * selected again for every box.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <cairo.h>
+#include <gdk/gdk.h>
+#include "infobox.h"
+
+/* Baseline of the title, and of the first line below it */
+#define TITLE_BASELINE (14)
+#define LINE_BASELINE  (25)
+
+/* Spacing of the lines, and how far above the baseline each starts */
+#define LINE_HEIGHT (11)
+#define LINE_ASCENT (9)
+
+static cairo_scaled_font_t *_title_font = NULL;
+static cairo_scaled_font_t *_line_font = NULL;
+
+static cairo_scaled_font_t *_font(cairo_font_weight_t weight, double size)
+{
+	cairo_font_face_t *face;
+	cairo_scaled_font_t *font;
+	cairo_matrix_t matrix, ctm;
+	cairo_font_options_t *options;
+	
+	face = cairo_toy_font_face_create("Sans", CAIRO_FONT_SLANT_NORMAL, weight);
+	
+	cairo_matrix_init_scale(&matrix, size, size);
+	cairo_matrix_init_identity(&ctm);
+	options = cairo_font_options_create();
+	
+	font = cairo_scaled_font_create(face, &matrix, &ctm, options);
+	
+	cairo_font_options_destroy(options);
+	cairo_font_face_destroy(face);
+	
+	return(font);
+}
+
+static int _draw_background(infobox_t *ib, const atlas_icon_t *icon, const char *title)
+{
+	cairo_t *cr;
+	
+	ib->background = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, INFOBOX_WIDTH, INFOBOX_HEIGHT);
+	if(cairo_surface_status(ib->background) != CAIRO_STATUS_SUCCESS) return(-1);
+	
+	/* The surface starts off transparent */
+	cr = cairo_create(ib->background);
+	
+	/* Draw the outline box */
+	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
+	cairo_set_line_width(cr, 2);
+	cairo_rectangle(cr, 1, 1, INFOBOX_WIDTH - 2, INFOBOX_HEIGHT - 2);
+	cairo_stroke_preserve(cr);
+	
+	/* Fill in box with semi-transparent white */
+	cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 0.85);
+	cairo_fill(cr);
+	
+	/* Draw the balloon icon */
+	if(icon) atlas_paint(cr, icon, 166, 5);
+	
+	/* Draw the payload title */
+	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+	cairo_set_scaled_font(cr, _title_font);
+	cairo_move_to(cr, 5, TITLE_BASELINE);
+	cairo_show_text(cr, title);
+	
+	cairo_destroy(cr);
+	
+	return(0);
+}
+
+/* Update the infobox with the text for each line, creating it if
+ * needed. The icon and title are only used when the box is created.
+ * Returns the number of lines redrawn, which is 0 if nothing changed,
+ * or -1 on error */
+int infobox_update(infobox_t *ib, const atlas_icon_t *icon, const char *title,
+	const char *lines[INFOBOX_LINES])
+{
+	cairo_t *cr;
+	int i, n = 0;
+	
+	if(!_title_font)
+	{
+		_title_font = _font(CAIRO_FONT_WEIGHT_BOLD, 12);
+		_line_font = _font(CAIRO_FONT_WEIGHT_NORMAL, 10);
+	}
+	
+	if(!ib->surface)
+	{
+		if(_draw_background(ib, icon, title) != 0)
+		{
+			fprintf(stderr, "Failed to create infobox for '%s'\n", title);
+			infobox_free(ib);
+			return(-1);
+		}
+		
+		/* Start the box as a copy of the background */
+		ib->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, INFOBOX_WIDTH, INFOBOX_HEIGHT);
+		
+		cr = cairo_create(ib->surface);
+		cairo_set_source_surface(cr, ib->background, 0, 0);
+		cairo_paint(cr);
+		cairo_destroy(cr);
+		
+		/* Mark every line as changed */
+		for(i = 0; i < INFOBOX_LINES; i++)
+			strcpy(ib->lines[i], "\n");
+	}
+	
+	cr = cairo_create(ib->surface);
+	cairo_set_scaled_font(cr, _line_font);
+	
+	for(i = 0; i < INFOBOX_LINES; i++)
+	{
+		int y = LINE_BASELINE + LINE_HEIGHT * i;
+		
+		if(strncmp(ib->lines[i], lines[i], sizeof(ib->lines[i]) - 1) == 0) continue;
+		snprintf(ib->lines[i], sizeof(ib->lines[i]), "%s", lines[i]);
+		
+		/* Restore this line's strip of the background, and draw
+		 * the new text over it. The text is kept within the strip */
+		cairo_save(cr);
+		cairo_rectangle(cr, 0, y - LINE_ASCENT, INFOBOX_WIDTH, LINE_HEIGHT);
+		cairo_clip(cr);
+		
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source_surface(cr, ib->background, 0, 0);
+		cairo_paint(cr);
+		
+		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+		cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+		cairo_move_to(cr, 5, y);
+		cairo_show_text(cr, ib->lines[i]);
+		
+		cairo_restore(cr);
+		n++;
+	}
+	
+	cairo_destroy(cr);
+	
+	return(n);
+}
+
+void infobox_free(infobox_t *ib)
+{
+	if(ib->surface) cairo_surface_destroy(ib->surface);
+	if(ib->background) cairo_surface_destroy(ib->background);
+	
+	ib->surface = NULL;
+	ib->background = NULL;
+}
+
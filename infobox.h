@@ -0,0 +1,49 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __INFOBOX_H__
+#define __INFOBOX_H__
+
+#include <cairo.h>
+#include "atlas.h"
+
+/* Size of an infobox, in pixels */
+#define INFOBOX_WIDTH  (220)
+#define INFOBOX_HEIGHT (104)
+
+/* Number of lines of text below the title */
+#define INFOBOX_LINES (4)
+
+typedef struct {
+	
+	/* The finished infobox */
+	cairo_surface_t *surface;
+	
+	/* The frame, icon and title, which the lines are drawn over */
+	cairo_surface_t *background;
+	
+	/* The text currently drawn on each line */
+	char lines[INFOBOX_LINES][64];
+	
+} infobox_t;
+
+extern int infobox_update(infobox_t *ib, const atlas_icon_t *icon, const char *title,
+	const char *lines[INFOBOX_LINES]);
+extern void infobox_free(infobox_t *ib);
+
+#endif /* __INFOBOX_H__ */
+
@@ -0,0 +1,222 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* A process-wide pool of interned strings (callsigns, mostly). Each
+ * distinct string is copied once into an arena and the same pointer is
+ * returned for it from then on, so interned strings can be compared by
+ * pointer and are never freed.
+ *
+ * Lookups of strings already in the pool take no lock and allocate
+ * nothing. The table is open addressed and slots are only ever filled,
+ * with a release store after the string is written. New strings are
+ * added under a mutex. When the table grows a new one is built and
+ * published, and the old one is kept, as a reader may still be using it.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "intern.h"
+
+/* Size of each arena chunk */
+#define INTERN_CHUNK (65536)
+
+/* Initial number of table slots */
+#define INTERN_MIN_SLOTS (1024)
+
+typedef struct _intern_table_t {
+	unsigned int size; /* Power of two */
+	unsigned int count;
+	struct _intern_table_t *prev; /* Tables replaced by this one */
+	const char *slots[];
+} intern_table_t;
+
+static intern_table_t *_table = NULL;
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The current arena chunk */
+static char *_arena = NULL;
+static size_t _arena_used = 0;
+
+static uint32_t _hash(const char *s, size_t length)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261U;
+	
+	while(length--)
+	{
+		h ^= (unsigned char) *(s++);
+		h *= 16777619U;
+	}
+	
+	return(h);
+}
+
+/* Each string is stored after its hash, so
+ * the table doesn't need to hold them */
+static uint32_t _stored_hash(const char *p)
+{
+	return(((const uint32_t *) p)[-1]);
+}
+
+/* Probe a table for a string. Returns it, or NULL with *slot set
+ * to the empty slot where it would go */
+static const char *_find(intern_table_t *t, const char *s, size_t length, uint32_t hash, unsigned int *slot)
+{
+	unsigned int mask = t->size - 1;
+	unsigned int i = hash & mask;
+	const char *p;
+	
+	while((p = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE)) != NULL)
+	{
+		if(_stored_hash(p) == hash &&
+		   strncmp(p, s, length) == 0 && p[length] == '\0') return(p);
+		
+		i = (i + 1) & mask; /* Linear probing */
+	}
+	
+	if(slot) *slot = i;
+	
+	return(NULL);
+}
+
+/* Copy a string into the arena, after its hash */
+static char *_store(const char *s, size_t length, uint32_t hash)
+{
+	size_t need = sizeof(uint32_t) + length + 1;
+	char *p;
+	
+	/* Keep each hash aligned */
+	need = (need + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+	
+	if(!_arena || _arena_used + need > INTERN_CHUNK)
+	{
+		/* Long strings get a chunk of their own */
+		p = malloc(need > INTERN_CHUNK ? need : INTERN_CHUNK);
+		if(!p) return(NULL);
+		
+		if(need > INTERN_CHUNK)
+		{
+			*(uint32_t *) p = hash;
+			p += sizeof(uint32_t);
+			memcpy(p, s, length);
+			p[length] = '\0';
+			return(p);
+		}
+		
+		_arena = p;
+		_arena_used = 0;
+	}
+	
+	p = _arena + _arena_used;
+	_arena_used += need;
+	
+	*(uint32_t *) p = hash;
+	p += sizeof(uint32_t);
+	memcpy(p, s, length);
+	p[length] = '\0';
+	
+	return(p);
+}
+
+static intern_table_t *_grow(intern_table_t *old)
+{
+	intern_table_t *t;
+	unsigned int size = (old ? old->size * 2 : INTERN_MIN_SLOTS);
+	unsigned int i, slot;
+	
+	t = calloc(sizeof(intern_table_t) + sizeof(char *) * size, 1);
+	if(!t) return(NULL);
+	
+	t->size = size;
+	t->prev = old;
+	
+	/* Copy the existing strings over */
+	for(i = 0; old && i < old->size; i++)
+	{
+		const char *p = old->slots[i];
+		if(!p) continue;
+		
+		_find(t, p, strlen(p), _stored_hash(p), &slot);
+		t->slots[slot] = p;
+		t->count++;
+	}
+	
+	return(t);
+}
+
+/* Return the interned copy of the first length bytes of s,
+ * adding it to the pool if needed. NULL if out of memory */
+const char *intern_n(const char *s, size_t length)
+{
+	intern_table_t *t;
+	uint32_t hash;
+	unsigned int slot;
+	const char *p;
+	char *n;
+	
+	/* The string ends at any NUL */
+	length = strnlen(s, length);
+	hash = _hash(s, length);
+	
+	/* The common case, the string has been seen before */
+	t = __atomic_load_n(&_table, __ATOMIC_ACQUIRE);
+	if(t && (p = _find(t, s, length, hash, NULL))) return(p);
+	
+	pthread_mutex_lock(&_lock);
+	
+	/* Check again, it may have been added or the table grown */
+	t = _table;
+	if(t && (p = _find(t, s, length, hash, NULL)))
+	{
+		pthread_mutex_unlock(&_lock);
+		return(p);
+	}
+	
+	/* Keep the table no more than half full */
+	if(!t || (t->count + 1) * 2 > t->size)
+	{
+		intern_table_t *g = _grow(t);
+		if(!g)
+		{
+			pthread_mutex_unlock(&_lock);
+			return(NULL); /* Out of memory */
+		}
+		
+		__atomic_store_n(&_table, g, __ATOMIC_RELEASE);
+		t = g;
+	}
+	
+	n = _store(s, length, hash);
+	if(n)
+	{
+		_find(t, s, length, hash, &slot);
+		t->count++;
+		__atomic_store_n(&t->slots[slot], n, __ATOMIC_RELEASE);
+	}
+	
+	pthread_mutex_unlock(&_lock);
+	
+	return(n);
+}
+
+const char *intern(const char *s)
+{
+	return(intern_n(s, strlen(s)));
+}
+
@@ -0,0 +1,117 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* A growable buffer that splits a byte stream into lines. Data is appended
+ * to the end of a single slab and lines are handed back as pointers into
+ * it, with the newline replaced by a NUL. The newline search resumes from
+ * where the last one stopped, so each byte is only scanned once. Consumed
+ * space at the front is reclaimed either when the buffer empties or, when
+ * more room is needed, if the consumed part is at least as large as the
+ * data still waiting -- so every byte is moved at most once on average.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "linebuf.h"
+
+/* The smallest allocation made for a buffer */
+#define LINEBUF_MIN_SIZE (4096)
+
+static int linebuf_reserve(linebuf_t *lb, size_t length)
+{
+	size_t pending = lb->tail - lb->head;
+	size_t size;
+	char *data;
+	
+	/* Already enough room at the end? */
+	if(lb->size - lb->tail >= length) return(0);
+	
+	/* Reclaim the consumed space if that's cheap enough and sufficient */
+	if(lb->head >= pending && lb->size - pending >= length)
+	{
+		memmove(lb->data, lb->data + lb->head, pending);
+		lb->scan -= lb->head;
+		lb->tail -= lb->head;
+		lb->head = 0;
+		return(0);
+	}
+	
+	/* Grow the buffer, at least doubling it */
+	size = (lb->size < LINEBUF_MIN_SIZE ? LINEBUF_MIN_SIZE : lb->size * 2);
+	while(size - lb->tail < length) size *= 2;
+	
+	data = realloc(lb->data, size);
+	if(!data) return(-1); /* Out of memory */
+	
+	lb->data = data;
+	lb->size = size;
+	
+	return(0);
+}
+
+int linebuf_append(linebuf_t *lb, const char *data, size_t length)
+{
+	/* Make sure there's room for the new data */
+	if(linebuf_reserve(lb, length) != 0) return(-1);
+	
+	memcpy(lb->data + lb->tail, data, length);
+	lb->tail += length;
+	
+	return(0);
+}
+
+/* Returns the next complete line in the buffer, or NULL if there isn't one.
+ * The line is NUL-terminated in place and remains valid until the next
+ * call to linebuf_append() or linebuf_free() */
+char *linebuf_next(linebuf_t *lb, size_t *length)
+{
+	char *line, *nl;
+	
+	/* Nothing left to scan? */
+	if(lb->scan >= lb->tail) return(NULL);
+	
+	/* Search for the newline, starting where the last search stopped */
+	nl = memchr(lb->data + lb->scan, '\n', lb->tail - lb->scan);
+	if(!nl)
+	{
+		/* No complete line yet, don't scan this data again */
+		lb->scan = lb->tail;
+		return(NULL);
+	}
+	
+	/* Null-terminate the string at the newline */
+	*nl = '\0';
+	
+	line = lb->data + lb->head;
+	if(length) *length = nl - line;
+	
+	/* Move past the line */
+	lb->head = lb->scan = nl - lb->data + 1;
+	
+	/* If that was the last of the data, rewind to the start of
+	 * the buffer. The line remains valid until the next append */
+	if(lb->head == lb->tail) lb->head = lb->tail = lb->scan = 0;
+	
+	return(line);
+}
+
+void linebuf_free(linebuf_t *lb)
+{
+	free(lb->data);
+	memset(lb, 0, sizeof(linebuf_t));
+}
+
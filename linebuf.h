@@ -0,0 +1,47 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __LINEBUF_H__
+#define __LINEBUF_H__
+
+#include <stddef.h>
+
+typedef struct {
+	
+	/* The buffer */
+	char *data;
+	
+	/* Allocated size of the buffer, in bytes */
+	size_t size;
+	
+	/* Offset of the first byte not yet returned as a line */
+	size_t head;
+	
+	/* Offset of the end of the data */
+	size_t tail;
+	
+	/* Offset where the next newline search will begin */
+	size_t scan;
+	
+} linebuf_t;
+
+extern int linebuf_append(linebuf_t *lb, const char *data, size_t length);
+extern char *linebuf_next(linebuf_t *lb, size_t *length);
+extern void linebuf_free(linebuf_t *lb);
+
+#endif /* __LINEBUF_H__ */
+
@@ -0,0 +1,376 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Leveled messages to stderr, written by a thread of their own so that
+ * no other thread ever waits on a slow terminal or pipe. Anything below
+ * the current level costs only the comparison, so chatty messages can
+ * be left in hot paths.
+ *
+ * Messages are passed to the writer as fixed size records in a bounded
+ * ring, which any thread may add to without a lock: each slot has a
+ * sequence number saying whether it's free or full, and a producer
+ * claims a slot by moving the head along with a compare and swap. Text
+ * messages are formatted into the record by the caller, but position
+ * updates are stored as they are and only formatted by the writer. The
+ * writer collects what's waiting into a buffer and writes it at once.
+ *
+ * A full ring, or more than LOG_RATE_MAX messages in a second, drops
+ * messages rather than wait. The writer reports how many were lost.
+ * Until log_start() and after log_stop() messages are written directly.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "log.h"
+
+typedef enum {
+	LOG_TEXT,
+	LOG_UPDATE,
+} log_kind_t;
+
+typedef struct {
+	
+	/* Equal to the position when the slot is free for
+	 * it, position + 1 once the record has been written */
+	unsigned int seq;
+	
+	log_kind_t kind;
+	
+	union {
+		char text[LOG_TEXT_MAX];
+		hab_update_t update;
+	};
+	
+} log_record_t;
+
+log_level_t log_level = LOG_LEVEL_INFO;
+
+static log_record_t *_ring = NULL;
+static unsigned int _head = 0; /* Next position to claim, shared by producers */
+static unsigned int _tail = 0; /* Next position to write, only used by the writer */
+
+/* Set when the writer has been woken, cleared as it starts draining */
+static int _signalled = 0;
+
+/* Messages lost to a full ring or the rate limit */
+static unsigned long _dropped = 0;
+static unsigned long _suppressed = 0;
+
+/* The current second, and messages accepted during it */
+static long _second = 0;
+static unsigned int _count = 0;
+
+static pthread_t _thread;
+static int _efd = -1;
+static char _running = 0;
+static char _stopping = 0;
+
+/* Count a message against the rate limit. Returns 0
+ * if it may be logged, or -1 if it's over the limit */
+static int _rate(log_level_t level)
+{
+	struct timespec ts;
+	long second, current;
+	
+	if(level == LOG_LEVEL_ERROR) return(0);
+	
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	second = ts.tv_sec;
+	
+	/* The first message of a new second starts the count again */
+	current = __atomic_load_n(&_second, __ATOMIC_RELAXED);
+	if(current != second &&
+	   __atomic_compare_exchange_n(&_second, &current, second, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		__atomic_store_n(&_count, 0, __ATOMIC_RELAXED);
+	
+	if(__atomic_add_fetch(&_count, 1, __ATOMIC_RELAXED) > LOG_RATE_MAX)
+	{
+		__atomic_add_fetch(&_suppressed, 1, __ATOMIC_RELAXED);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/* Claim the next free record. Returns NULL if the ring is full */
+static log_record_t *_claim(unsigned int *pos)
+{
+	unsigned int p = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+	log_record_t *r;
+	int d;
+	
+	while(1)
+	{
+		r = &_ring[p & (LOG_RING_SIZE - 1)];
+		d = (int) (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) - p);
+		
+		/* Free, try to take it. On failure p is updated */
+		if(d == 0)
+		{
+			if(__atomic_compare_exchange_n(&_head, &p, p + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if(d < 0)
+		{
+			/* The writer hasn't got this far round yet */
+			__atomic_add_fetch(&_dropped, 1, __ATOMIC_RELAXED);
+			return(NULL);
+		}
+		else p = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+	}
+	
+	*pos = p;
+	
+	return(r);
+}
+
+/* Hand a filled in record to the writer */
+static void _publish(log_record_t *r, unsigned int pos)
+{
+	uint64_t one = 1;
+	
+	__atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+	
+	/* Wake the writer, unless it's already been */
+	if(__atomic_exchange_n(&_signalled, 1, __ATOMIC_ACQ_REL) == 0 &&
+	   write(_efd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
+}
+
+/* Format a record onto the end of the buffer. Returns the number of
+ * bytes added, which may have been cut short if it was nearly full */
+static size_t _format(log_record_t *r, char *buf, size_t size)
+{
+	hab_update_t *u = &r->update;
+	int n;
+	
+	if(r->kind == LOG_TEXT) n = snprintf(buf, size, "%s", r->text);
+	else n = snprintf(buf, size, "%s %s at %f,%f altitude %.2f\n",
+		habhound_object_type_name(u->type), u->callsign,
+		u->latitude, u->longitude, u->altitude);
+	
+	if(n < 0) return(0);
+	return((size_t) n < size ? (size_t) n : size - 1);
+}
+
+static void _write(const char *buf, size_t length)
+{
+	ssize_t n;
+	
+	while(length > 0)
+	{
+		n = write(STDERR_FILENO, buf, length);
+		if(n == -1)
+		{
+			if(errno == EINTR) continue;
+			return; /* Nowhere to report it */
+		}
+		
+		buf += n;
+		length -= n;
+	}
+}
+
+/* Write out everything waiting, in as few writes as possible */
+static void _drain(char *buf)
+{
+	static unsigned long dropped = 0, suppressed = 0;
+	unsigned long d, s;
+	size_t length = 0;
+	
+	while(1)
+	{
+		log_record_t *r = &_ring[_tail & (LOG_RING_SIZE - 1)];
+		
+		if(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != _tail + 1) break;
+		
+		/* Make sure the longest record will fit */
+		if(LOG_BUFFER_SIZE - length <= LOG_TEXT_MAX * 2)
+		{
+			_write(buf, length);
+			length = 0;
+		}
+		
+		length += _format(r, buf + length, LOG_BUFFER_SIZE - length);
+		
+		/* Free the slot for its next time round */
+		__atomic_store_n(&r->seq, _tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		_tail++;
+	}
+	
+	/* Say if anything was lost since last time */
+	d = __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+	s = __atomic_load_n(&_suppressed, __ATOMIC_RELAXED);
+	if(d != dropped || s != suppressed)
+	{
+		length += snprintf(buf + length, LOG_BUFFER_SIZE - length,
+			"log: %lu messages dropped, %lu over the rate limit\n",
+			d - dropped, s - suppressed);
+		dropped = d;
+		suppressed = s;
+	}
+	
+	if(length > 0) _write(buf, length);
+}
+
+static void *log_thread(void *arg)
+{
+	struct pollfd pfd = { _efd, POLLIN, 0 };
+	uint64_t n;
+	char *buf = arg;
+	
+	while(1)
+	{
+		/* Anything logged from here on wakes the thread again */
+		__atomic_exchange_n(&_signalled, 0, __ATOMIC_ACQ_REL);
+		
+		_drain(buf);
+		
+		if(__atomic_load_n(&_stopping, __ATOMIC_ACQUIRE)) break;
+		
+		if(poll(&pfd, 1, -1) == -1 && errno != EINTR) break;
+		if(read(_efd, &n, sizeof(n)) != sizeof(n)) continue;
+	}
+	
+	/* One last time, for anything logged while stopping */
+	_drain(buf);
+	free(buf);
+	
+	return(NULL);
+}
+
+/* Start the writer thread. Returns 0 on success, or -1 if it couldn't be
+ * started, in which case messages continue to be written directly */
+int log_start(void)
+{
+	char *buf;
+	int i, e;
+	
+	if(_running) return(0);
+	
+	_ring = calloc(sizeof(log_record_t), LOG_RING_SIZE);
+	buf = malloc(LOG_BUFFER_SIZE);
+	_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	
+	if(!_ring || !buf || _efd == -1)
+	{
+		fprintf(stderr, "Can't start the log writer\n");
+		if(_efd != -1) close(_efd);
+		free(_ring);
+		free(buf);
+		_ring = NULL;
+		_efd = -1;
+		return(-1);
+	}
+	
+	for(i = 0; i < LOG_RING_SIZE; i++) _ring[i].seq = i;
+	_head = _tail = 0;
+	_stopping = 0;
+	
+	e = pthread_create(&_thread, NULL, log_thread, buf);
+	if(e != 0)
+	{
+		fprintf(stderr, "log thread failed to start: %s\n", strerror(e));
+		close(_efd);
+		free(_ring);
+		free(buf);
+		_ring = NULL;
+		_efd = -1;
+		return(-1);
+	}
+	
+	__atomic_store_n(&_running, 1, __ATOMIC_RELEASE);
+	
+	return(0);
+}
+
+/* Write out anything waiting and stop the writer thread. Every other
+ * thread that logs must have stopped first */
+void log_stop(void)
+{
+	uint64_t one = 1;
+	
+	if(!_running) return;
+	
+	__atomic_store_n(&_running, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&_stopping, 1, __ATOMIC_RELEASE);
+	
+	if(write(_efd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
+	
+	/* Wait until it complies */
+	pthread_join(_thread, NULL);
+	
+	close(_efd);
+	free(_ring);
+	_ring = NULL;
+	_efd = -1;
+}
+
+void log_printf(log_level_t level, const char *format, ... )
+{
+	log_record_t *r;
+	unsigned int pos;
+	va_list ap;
+	
+	if(!log_enabled(level)) return;
+	
+	va_start(ap, format);
+	
+	if(!__atomic_load_n(&_running, __ATOMIC_ACQUIRE)) vfprintf(stderr, format, ap);
+	else if(_rate(level) == 0 && (r = _claim(&pos)))
+	{
+		r->kind = LOG_TEXT;
+		vsnprintf(r->text, LOG_TEXT_MAX, format, ap);
+		_publish(r, pos);
+	}
+	
+	va_end(ap);
+}
+
+/* Log a position update. The callsign must be interned, as it's
+ * only looked at later when the writer gets to it */
+void log_update(log_level_t level, const hab_update_t *u)
+{
+	log_record_t *r;
+	unsigned int pos;
+	
+	if(!log_enabled(level)) return;
+	
+	if(!__atomic_load_n(&_running, __ATOMIC_ACQUIRE))
+	{
+		fprintf(stderr, "%s %s at %f,%f altitude %.2f\n",
+			habhound_object_type_name(u->type), u->callsign,
+			u->latitude, u->longitude, u->altitude);
+	}
+	else if(_rate(level) == 0 && (r = _claim(&pos)))
+	{
+		r->kind = LOG_UPDATE;
+		r->update = *u;
+		_publish(r, pos);
+	}
+}
+
@@ -0,0 +1,57 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include "core.h"
+
+/* Number of records the ring holds, a power of two. Messages logged
+ * while it's full are dropped rather than wait for the writer */
+#define LOG_RING_SIZE (1024)
+
+/* Longest text message kept, the rest is cut off */
+#define LOG_TEXT_MAX (240)
+
+/* Most messages accepted per second, below the error level. The
+ * rest are counted and reported, but not written */
+#define LOG_RATE_MAX (500)
+
+/* Size of the writer's output buffer */
+#define LOG_BUFFER_SIZE (65536)
+
+/* How much is written to stderr. Each level includes those above it */
+typedef enum {
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_INFO,  /* Connections and the like, the default */
+	LOG_LEVEL_DEBUG, /* Every request and update, very chatty */
+} log_level_t;
+
+extern log_level_t log_level;
+
+/* True if messages at level are being written, to skip
+ * the work of preparing ones that won't be */
+#define log_enabled(level) ((level) <= log_level)
+
+extern int log_start(void);
+extern void log_stop(void);
+extern void log_printf(log_level_t level, const char *format, ... );
+extern void log_update(log_level_t level, const hab_update_t *u);
+
+#endif /* __LOG_H__ */
+
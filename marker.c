@@ -0,0 +1,338 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Rendering of the map markers, an icon with a label (the callsign)
+ * drawn below it. Finished markers are kept in a cache keyed by the
+ * icon, its alignment, the label, font and font size, so each one is
+ * only rendered once however many times it's asked for, and objects
+ * with the same icon and label share one pixbuf.
+ *
+ * The cache is a chained hash table with the entries also on a list in
+ * order of use. When the pixbufs held take more than MARKER_CACHE_BYTES
+ * the least recently used are dropped. Callers take their own reference
+ * to the pixbuf, so dropping one from the cache doesn't affect markers
+ * already on the map.
+ *
+ * Labels and fonts are interned and compared by pointer. All of this
+ * runs on the GTK thread only.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cairo.h>
+#include <gdk/gdk.h>
+#include "marker.h"
+#include "intern.h"
+#include "unpremul.h"
+
+/* Number of hash chains, a power of two */
+#define MARKER_BUCKETS (256)
+
+typedef struct _marker_entry_t {
+	
+	/* The key */
+	const atlas_icon_t *icon;
+	double x_align;
+	double y_align;
+	const char *label;
+	const char *font;
+	double size;
+	uint32_t hash;
+	
+	/* The rendered marker, and the bytes it uses */
+	marker_t marker;
+	size_t bytes;
+	
+	/* The next entry in this hash chain */
+	struct _marker_entry_t *next;
+	
+	/* Neighbours in the use list, most recent first */
+	struct _marker_entry_t *newer;
+	struct _marker_entry_t *older;
+	
+} marker_entry_t;
+
+static marker_entry_t *_buckets[MARKER_BUCKETS];
+static marker_entry_t *_newest = NULL;
+static marker_entry_t *_oldest = NULL;
+
+static unsigned int _count = 0;
+static size_t _bytes = 0;
+static unsigned long _hits = 0;
+static unsigned long _misses = 0;
+
+/* A small surface kept only for measuring text */
+static cairo_surface_t *_measure_surface = NULL;
+static cairo_t *_measure = NULL;
+
+static uint32_t _hash(const atlas_icon_t *icon, const char *label, const char *font, double size)
+{
+	uint64_t h;
+	
+	h  = (uintptr_t) icon;
+	h ^= (uintptr_t) label * 0x9E3779B97F4A7C15ULL;
+	h ^= (uintptr_t) font + (uint64_t) (size * 64);
+	h *= 0x9E3779B97F4A7C15ULL;
+	
+	return(h >> 32);
+}
+
+/* Create a GdkPixbuf from a cairo surface -- based on convert_alpha() from aprsmap */
+static GdkPixbuf *_gdk_pixbuf_new_from_surface(cairo_surface_t *surface)
+{
+	GdkPixbuf *pixbuf;
+	unsigned char *dst_data, *src_data;
+	int dst_stride, src_stride;
+	int width, height;
+	int y;
+	
+	/* Get the details of the surface */
+	width      = cairo_image_surface_get_width(surface);
+	height     = cairo_image_surface_get_height(surface);
+	src_data   = cairo_image_surface_get_data(surface);
+	src_stride = cairo_image_surface_get_stride(surface);
+	
+	/* Create the new pixbuf */
+	pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+	if(!pixbuf) return(NULL);
+	
+	/* Get details of the pixbuf */
+	dst_data   = gdk_pixbuf_get_pixels(pixbuf);
+	dst_stride = gdk_pixbuf_get_rowstride(pixbuf);
+	
+	/* Flush any pending drawing bits */
+	cairo_surface_flush(surface);
+	
+	/* Copy the image data */
+	for(y = 0; y < height; y++)
+	{
+		unpremultiply_row(dst_data, (uint32_t *) src_data, width);
+		src_data += src_stride;
+		dst_data += dst_stride;
+	}
+	
+	return(pixbuf);
+}
+
+/* Render a marker into e */
+static int _render(marker_entry_t *e)
+{
+	cairo_t *cr;
+	cairo_surface_t *surface;
+	cairo_text_extents_t extent;
+	int width, height;
+	
+	/* Get the width and height of the icon */
+	width  = e->icon->width;
+	height = e->icon->height;
+	
+	/* Measure the label. The same context is used every time */
+	if(!_measure)
+	{
+		_measure_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+		_measure = cairo_create(_measure_surface);
+	}
+	
+	cairo_select_font_face(_measure, e->font,
+		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(_measure, e->size);
+	cairo_text_extents(_measure, e->label, &extent);
+	
+	/* Adjust the size to fit both the icon and text */
+	if(extent.width >= width) width = extent.width + 2;
+	height += extent.height + 2;
+	
+	e->marker.x_offset  = e->x_align - 0.5;
+	e->marker.x_offset *= (double) e->icon->width / width;
+	e->marker.x_offset += 0.5;
+	e->marker.y_offset  = e->y_align - (double) (extent.height + 2) / height;
+	
+	/* Create and render the new icon */
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	cr = cairo_create(surface);
+	
+	/* Draw the balloon icon */
+	atlas_paint(cr, e->icon, (width - e->icon->width) / 2, 0);
+	
+	/* Render the callsign */
+	cairo_select_font_face(cr, e->font,
+		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, e->size);
+	
+	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+	cairo_set_line_width(cr, 2.0);
+	cairo_move_to(cr, (width - extent.width) / 2, height - extent.height / 2 + 2);
+	cairo_text_path(cr, e->label);
+	cairo_stroke(cr);
+	
+	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+	cairo_move_to(cr, (width - extent.width) / 2, height - extent.height / 2 + 2);
+	cairo_show_text(cr, e->label);
+	
+	/* Create the GdkPixbuf from the cairo_surface */
+	e->marker.pixbuf = _gdk_pixbuf_new_from_surface(surface);
+	
+	/* Destroy the surface */
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+	
+	if(!e->marker.pixbuf) return(-1);
+	
+	e->bytes = (size_t) gdk_pixbuf_get_rowstride(e->marker.pixbuf) * height;
+	
+	return(0);
+}
+
+static void _unlink(marker_entry_t *e)
+{
+	if(e->newer) e->newer->older = e->older;
+	else _newest = e->older;
+	
+	if(e->older) e->older->newer = e->newer;
+	else _oldest = e->newer;
+	
+	e->newer = e->older = NULL;
+}
+
+static void _link(marker_entry_t *e)
+{
+	e->newer = NULL;
+	e->older = _newest;
+	
+	if(_newest) _newest->newer = e;
+	else _oldest = e;
+	
+	_newest = e;
+}
+
+static void _drop(marker_entry_t *e)
+{
+	marker_entry_t **p;
+	
+	/* Remove from the hash chain */
+	for(p = &_buckets[e->hash & (MARKER_BUCKETS - 1)]; *p; p = &(*p)->next)
+	{
+		if(*p != e) continue;
+		*p = e->next;
+		break;
+	}
+	
+	_unlink(e);
+	
+	_count--;
+	_bytes -= e->bytes;
+	
+	g_object_unref(G_OBJECT(e->marker.pixbuf));
+	free(e);
+}
+
+/* Get the marker for an icon, aligned on the map at x_offset, y_offset,
+ * with label drawn below it in font at size. The offsets of the marker
+ * are set in m, and m->pixbuf is a new reference the caller must unref.
+ * Returns 0 on success, -1 on error */
+int marker_get(marker_t *m, const atlas_icon_t *icon, double x_offset, double y_offset,
+	const char *label, const char *font, double size)
+{
+	marker_entry_t *e;
+	uint32_t hash;
+	
+	label = intern(label);
+	font = intern(font);
+	if(!label || !font) return(-1);
+	
+	hash = _hash(icon, label, font, size);
+	
+	for(e = _buckets[hash & (MARKER_BUCKETS - 1)]; e; e = e->next)
+	{
+		if(e->hash == hash && e->icon == icon &&
+		   e->label == label && e->font == font && e->size == size &&
+		   e->x_align == x_offset && e->y_align == y_offset) break;
+	}
+	
+	if(e)
+	{
+		/* Move to the front of the use list */
+		_unlink(e);
+		_link(e);
+		_hits++;
+	}
+	else
+	{
+		_misses++;
+		
+		e = calloc(1, sizeof(marker_entry_t));
+		if(!e) return(-1); /* Out of memory! */
+		
+		e->icon = icon;
+		e->x_align = x_offset;
+		e->y_align = y_offset;
+		e->label = label;
+		e->font = font;
+		e->size = size;
+		e->hash = hash;
+		
+		if(_render(e) != 0)
+		{
+			fprintf(stderr, "Failed to render marker for '%s'\n", label);
+			free(e);
+			return(-1);
+		}
+		
+		e->next = _buckets[hash & (MARKER_BUCKETS - 1)];
+		_buckets[hash & (MARKER_BUCKETS - 1)] = e;
+		_link(e);
+		
+		_count++;
+		_bytes += e->bytes;
+		
+		/* Drop the least recently used markers if over the limit,
+		 * but always keep the one just rendered */
+		while(_bytes > MARKER_CACHE_BYTES && _oldest != e)
+			_drop(_oldest);
+	}
+	
+	*m = e->marker;
+	g_object_ref(G_OBJECT(m->pixbuf));
+	
+	return(0);
+}
+
+/* Get the cache statistics. Any of the pointers may be NULL */
+void marker_cache_stats(unsigned long *hits, unsigned long *misses,
+	unsigned int *count, size_t *bytes)
+{
+	if(hits) *hits = _hits;
+	if(misses) *misses = _misses;
+	if(count) *count = _count;
+	if(bytes) *bytes = _bytes;
+}
+
+void marker_cache_free(void)
+{
+	while(_oldest) _drop(_oldest);
+	
+	if(_measure)
+	{
+		cairo_destroy(_measure);
+		cairo_surface_destroy(_measure_surface);
+		_measure = NULL;
+		_measure_surface = NULL;
+	}
+}
+
@@ -0,0 +1,48 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __MARKER_H__
+#define __MARKER_H__
+
+#include <stddef.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "atlas.h"
+
+/* Most memory the cached markers can use before the
+ * least recently used are dropped, in bytes */
+#define MARKER_CACHE_BYTES (4 * 1024 * 1024)
+
+/* A rendered map marker, an icon with a label below it */
+typedef struct {
+	
+	/* The rendered image */
+	GdkPixbuf *pixbuf;
+	
+	/* Alignment of the position within the image, 0.0 - 1.0 */
+	double x_offset;
+	double y_offset;
+	
+} marker_t;
+
+extern int marker_get(marker_t *m, const atlas_icon_t *icon, double x_offset, double y_offset,
+	const char *label, const char *font, double size);
+extern void marker_cache_stats(unsigned long *hits, unsigned long *misses,
+	unsigned int *count, size_t *bytes);
+extern void marker_cache_free(void);
+
+#endif /* __MARKER_H__ */
+
@@ -0,0 +1,414 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Counters, gauges and histograms for watching the pipeline at work, and
+ * a small server to hand them out in Prometheus' text format. Every
+ * metric is a static metric_t defined here and updated with relaxed
+ * atomic operations, so they can be bumped from any thread without a
+ * lock. A scrape reads each value on its own, so the figures may be very
+ * slightly out of step with each other.
+ *
+ * The server listens on a loopback TCP port, or on a Unix socket if
+ * given a path, and answers each request with the metrics whatever was
+ * asked for. It has a thread of its own and handles one connection at a
+ * time, which is plenty for a scraper or two.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "core.h"
+
+/* Upper bounds of the histogram buckets, in nanoseconds */
+static const uint64_t _bounds[METRICS_BUCKETS] = {
+	1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+	1000000, 10000000, 100000000, 1000000000
+};
+
+static double _queue_depth(void)
+{
+	unsigned int depth;
+	
+	habhound_get_queue_stats(&depth, NULL, NULL);
+	
+	return(depth);
+}
+
+metric_t metric_bytes_received = {
+	"habhound_bytes_received_total", "Bytes received from the sources", METRIC_COUNTER };
+metric_t metric_lines_framed = {
+	"habhound_lines_framed_total", "Lines split from habitat responses", METRIC_COUNTER };
+metric_t metric_documents_dropped = {
+	"habhound_documents_dropped_total", "Documents missing from the changes feed that couldn't be queued for fetching", METRIC_COUNTER };
+metric_t metric_parse_seconds = {
+	"habhound_parse_seconds", "Time taken to parse each line from habitat", METRIC_HISTOGRAM };
+metric_t metric_queue_depth = {
+	"habhound_queue_depth", "Updates waiting to be applied", METRIC_GAUGE, 0, _queue_depth };
+metric_t metric_updates_applied = {
+	"habhound_updates_applied_total", "Position updates applied", METRIC_COUNTER };
+metric_t metric_objects = {
+	"habhound_objects", "Payloads, listeners and chase cars being tracked", METRIC_GAUGE };
+metric_t metric_track_points = {
+	"habhound_track_points_total", "Points added to payload tracks", METRIC_COUNTER };
+metric_t metric_redraw_seconds = {
+	"habhound_redraw_seconds", "Time taken to draw the map overlay", METRIC_HISTOGRAM };
+
+static metric_t *_metrics[] = {
+	&metric_bytes_received,
+	&metric_lines_framed,
+	&metric_documents_dropped,
+	&metric_parse_seconds,
+	&metric_queue_depth,
+	&metric_updates_applied,
+	&metric_objects,
+	&metric_track_points,
+	&metric_redraw_seconds,
+	NULL
+};
+
+void metrics_add(metric_t *m, int64_t n)
+{
+	__atomic_add_fetch(&m->value, n, __ATOMIC_RELAXED);
+}
+
+void metrics_set(metric_t *m, int64_t n)
+{
+	__atomic_store_n(&m->value, n, __ATOMIC_RELAXED);
+}
+
+/* A monotonic time in nanoseconds, for timing things to observe */
+uint64_t metrics_now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* Add a duration, in nanoseconds, to a histogram */
+void metrics_observe(metric_t *m, uint64_t ns)
+{
+	int i;
+	
+	for(i = 0; i < METRICS_BUCKETS && ns > _bounds[i]; i++);
+	
+	__atomic_add_fetch(&m->buckets[i], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&m->sum, ns, __ATOMIC_RELAXED);
+}
+
+/* Write every metric in Prometheus' text format */
+void metrics_write(FILE *f)
+{
+	metric_t *m;
+	uint64_t n;
+	int i, j;
+	
+	for(i = 0; (m = _metrics[i]); i++)
+	{
+		fprintf(f, "# HELP %s %s\n", m->name, m->help);
+		
+		switch(m->type)
+		{
+		case METRIC_COUNTER:
+			fprintf(f, "# TYPE %s counter\n", m->name);
+			fprintf(f, "%s %lld\n", m->name, (long long) __atomic_load_n(&m->value, __ATOMIC_RELAXED));
+			break;
+		
+		case METRIC_GAUGE:
+			fprintf(f, "# TYPE %s gauge\n", m->name);
+			if(m->read) fprintf(f, "%s %g\n", m->name, m->read());
+			else fprintf(f, "%s %lld\n", m->name, (long long) __atomic_load_n(&m->value, __ATOMIC_RELAXED));
+			break;
+		
+		case METRIC_HISTOGRAM:
+			/* Prometheus wants the buckets cumulative, in seconds */
+			fprintf(f, "# TYPE %s histogram\n", m->name);
+			for(n = 0, j = 0; j <= METRICS_BUCKETS; j++)
+			{
+				n += __atomic_load_n(&m->buckets[j], __ATOMIC_RELAXED);
+				
+				if(j < METRICS_BUCKETS) fprintf(f, "%s_bucket{le=\"%g\"} %llu\n", m->name, _bounds[j] / 1e9, (unsigned long long) n);
+				else fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n", m->name, (unsigned long long) n);
+			}
+			
+			fprintf(f, "%s_sum %.9f\n", m->name, __atomic_load_n(&m->sum, __ATOMIC_RELAXED) / 1e9);
+			fprintf(f, "%s_count %llu\n", m->name, (unsigned long long) n);
+			break;
+		}
+	}
+}
+
+/* Send all of a buffer, giving up if the client goes away */
+static int _send(int fd, const char *data, size_t length)
+{
+	ssize_t n;
+	
+	while(length > 0)
+	{
+		n = send(fd, data, length, MSG_NOSIGNAL);
+		if(n == -1)
+		{
+			if(errno == EINTR) continue;
+			return(-1);
+		}
+		
+		data += n;
+		length -= n;
+	}
+	
+	return(0);
+}
+
+/* Read the request, which is ignored, and reply with the metrics */
+static void _answer(int fd)
+{
+	char request[METRICS_REQUEST_MAX + 1], header[128];
+	uint64_t deadline = metrics_now() + (uint64_t) METRICS_REQUEST_WAIT * 1000000;
+	struct timeval tv = { 1, 0 };
+	size_t length = 0, size;
+	char *body = NULL;
+	FILE *f;
+	ssize_t n;
+	
+	/* Don't wait long for a client that isn't reading the reply */
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	
+	/* Up to the blank line at the end of the headers. Clients are
+	 * answered one at a time, so a slow one only gets so long to send
+	 * the whole request, however it dribbles in */
+	while(length < METRICS_REQUEST_MAX)
+	{
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int64_t left = (int64_t) (deadline - metrics_now()) / 1000000;
+		
+		if(left <= 0) break;
+		
+		n = poll(&pfd, 1, left);
+		if(n == -1 && errno == EINTR) continue;
+		if(n <= 0) break;
+		
+		n = recv(fd, request + length, METRICS_REQUEST_MAX - length, MSG_DONTWAIT);
+		if(n == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+		if(n <= 0) break;
+		
+		length += n;
+		request[length] = '\0';
+		
+		if(strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+	}
+	
+	f = open_memstream(&body, &size);
+	if(!f) return;
+	
+	metrics_write(f);
+	fclose(f);
+	
+	snprintf(header, sizeof(header),
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\n"
+		"\r\n", size);
+	
+	if(_send(fd, header, strlen(header)) == 0) _send(fd, body, size);
+	
+	free(body);
+}
+
+static void *metrics_thread(void *arg)
+{
+	metrics_server_t *ms = (metrics_server_t *) arg;
+	struct pollfd pfd[2];
+	int fd;
+	
+	pfd[0].fd = ms->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = ms->efd;
+	pfd[1].events = POLLIN;
+	
+	while(!ms->stopping)
+	{
+		if(poll(pfd, 2, -1) == -1)
+		{
+			if(errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+		
+		if(!(pfd[0].revents & POLLIN)) continue;
+		
+		fd = accept(ms->fd, NULL, NULL);
+		if(fd == -1) continue;
+		
+		_answer(fd);
+		close(fd);
+	}
+	
+	return(NULL);
+}
+
+/* Open the listening socket, a Unix socket if where is a path,
+ * otherwise a TCP port on the loopback address */
+static int _listen(const char *where)
+{
+	int fd, one = 1;
+	
+	if(strchr(where, '/'))
+	{
+		struct sockaddr_un addr;
+		struct stat sb;
+		
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(strlen(where) >= sizeof(addr.sun_path))
+		{
+			fprintf(stderr, "Metrics socket path %s is too long\n", where);
+			return(-1);
+		}
+		strcpy(addr.sun_path, where);
+		
+		/* Replace a socket left behind by a previous run,
+		 * but nothing else that happens to be there */
+		if(lstat(where, &sb) == 0)
+		{
+			if(!S_ISSOCK(sb.st_mode))
+			{
+				errno = EEXIST;
+				return(-1);
+			}
+			
+			unlink(where);
+		}
+		
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(fd == -1) return(-1);
+		
+		if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+		   listen(fd, 8) == -1)
+		{
+			close(fd);
+			return(-1);
+		}
+	}
+	else
+	{
+		struct sockaddr_in addr;
+		
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(atoi(where));
+		
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(fd == -1) return(-1);
+		
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		
+		if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+		   listen(fd, 8) == -1)
+		{
+			close(fd);
+			return(-1);
+		}
+	}
+	
+	return(fd);
+}
+
+/* Start serving the metrics on a loopback port or Unix socket */
+metrics_server_t *metrics_serve(const char *where)
+{
+	metrics_server_t *ms;
+	int e;
+	
+	ms = calloc(sizeof(metrics_server_t), 1);
+	if(!ms) return(NULL);
+	
+	ms->where = strdup(where);
+	if(!ms->where)
+	{
+		free(ms);
+		return(NULL);
+	}
+	
+	ms->fd = _listen(where);
+	if(ms->fd == -1)
+	{
+		fprintf(stderr, "Can't serve metrics on %s: %s\n", where, strerror(errno));
+		free(ms->where);
+		free(ms);
+		return(NULL);
+	}
+	
+	/* Used to wake the thread when stopping */
+	ms->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(ms->efd == -1)
+	{
+		perror("eventfd");
+		close(ms->fd);
+		free(ms->where);
+		free(ms);
+		return(NULL);
+	}
+	
+	/* Start the thread */
+	e = pthread_create(&ms->t, NULL, metrics_thread, (void *) ms);
+	if(e != 0)
+	{
+		fprintf(stderr, "metrics thread failed to start: %s\n", strerror(e));
+		close(ms->efd);
+		close(ms->fd);
+		free(ms->where);
+		free(ms);
+		return(NULL);
+	}
+	
+	return(ms);
+}
+
+void metrics_server_stop(metrics_server_t *ms)
+{
+	uint64_t one = 1;
+	
+	if(!ms) return;
+	
+	/* Signal to the thread we're stopping */
+	ms->stopping = 1;
+	if(write(ms->efd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
+	
+	/* Wait until it complies */
+	pthread_join(ms->t, NULL);
+	
+	close(ms->efd);
+	close(ms->fd);
+	if(strchr(ms->where, '/')) unlink(ms->where);
+	free(ms->where);
+	free(ms);
+}
+
@@ -0,0 +1,94 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Number of histogram buckets, besides +Inf. The bounds are in
+ * metrics.c, from a microsecond up to a second */
+#define METRICS_BUCKETS (13)
+
+/* Largest request read by the metrics server, anything after is ignored,
+ * and the longest it waits for one to arrive in milliseconds */
+#define METRICS_REQUEST_MAX (4096)
+#define METRICS_REQUEST_WAIT (1000)
+
+typedef enum {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+} metric_type_t;
+
+/* A single metric. All are defined in metrics.c, and updated with atomic
+ * operations from whichever thread, so there's nothing to register and
+ * no lock to take */
+typedef struct {
+	const char *name;
+	const char *help;
+	metric_type_t type;
+	
+	/* Counters and gauges */
+	int64_t value;
+	
+	/* Gauges may instead be read when the metrics are written */
+	double (*read)(void);
+	
+	/* Histograms, the number of observations in each bucket (not
+	 * cumulative, the last is +Inf) and their total in nanoseconds */
+	uint64_t buckets[METRICS_BUCKETS + 1];
+	uint64_t sum;
+	
+} metric_t;
+
+extern metric_t metric_bytes_received;
+extern metric_t metric_lines_framed;
+extern metric_t metric_documents_dropped;
+extern metric_t metric_parse_seconds;
+extern metric_t metric_queue_depth;
+extern metric_t metric_updates_applied;
+extern metric_t metric_objects;
+extern metric_t metric_track_points;
+extern metric_t metric_redraw_seconds;
+
+/* A server for the metrics, in Prometheus' text format */
+typedef struct {
+	
+	/* Where it's listening, for messages */
+	char *where;
+	int fd;
+	
+	/* Thread stuffs */
+	pthread_t t;
+	int efd; /* eventfd to wake the thread when stopping */
+	char stopping;
+	
+} metrics_server_t;
+
+extern void metrics_add(metric_t *m, int64_t n);
+extern void metrics_set(metric_t *m, int64_t n);
+extern uint64_t metrics_now(void);
+extern void metrics_observe(metric_t *m, uint64_t ns);
+extern void metrics_write(FILE *f);
+extern metrics_server_t *metrics_serve(const char *where);
+extern void metrics_server_stop(metrics_server_t *ms);
+
+#endif /* __METRICS_H__ */
+
@@ -0,0 +1,145 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* The registry maps (type, callsign) to an object. Objects are kept in a
+ * dense array in the order they were added, so they can still be walked
+ * by index, with an open addressing hash table of array positions on top
+ * for lookups. Objects are never removed.
+ *
+ * Callsigns must be interned, they're hashed and compared by pointer.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "registry.h"
+
+/* Initial sizes */
+#define REGISTRY_MIN_ENTRIES (64)
+#define REGISTRY_MIN_INDEX   (128)
+
+static uint32_t _hash(int type, const char *callsign)
+{
+	/* Mix the pointer and type, the low bits of the pointer are
+	 * mostly zero so take the high half of the product */
+	uint64_t h = ((uintptr_t) callsign ^ (uint64_t) type) * 0x9E3779B97F4A7C15ULL;
+	return(h >> 32);
+}
+
+/* Find the hash table slot for a key -- either the one holding
+ * it, or the empty slot where it would be inserted */
+static unsigned int _slot(registry_t *r, int type, const char *callsign, uint32_t hash)
+{
+	unsigned int mask = r->index_size - 1;
+	unsigned int i = hash & mask;
+	
+	while(r->index[i])
+	{
+		registry_entry_t *e = &r->entries[r->index[i] - 1];
+		
+		if(e->callsign == callsign && e->type == type) break;
+		
+		i = (i + 1) & mask; /* Linear probing */
+	}
+	
+	return(i);
+}
+
+static int _grow_index(registry_t *r)
+{
+	unsigned int size = (r->index_size ? r->index_size * 2 : REGISTRY_MIN_INDEX);
+	int *index, *old = r->index;
+	int i;
+	
+	index = calloc(sizeof(int), size);
+	if(!index) return(-1);
+	
+	r->index = index;
+	r->index_size = size;
+	
+	/* Re-insert every entry, using the stored hashes */
+	for(i = 0; i < r->count; i++)
+	{
+		registry_entry_t *e = &r->entries[i];
+		index[_slot(r, e->type, e->callsign, e->hash)] = i + 1;
+	}
+	
+	free(old);
+	
+	return(0);
+}
+
+void *registry_find(registry_t *r, int type, const char *callsign)
+{
+	unsigned int i;
+	
+	/* No objects yet */
+	if(r->count == 0) return(NULL);
+	
+	i = _slot(r, type, callsign, _hash(type, callsign));
+	if(!r->index[i]) return(NULL);
+	
+	return(r->entries[r->index[i] - 1].data);
+}
+
+/* Add a new object, with an interned callsign. Returns
+ * the new object's index, or -1 if out of memory */
+int registry_add(registry_t *r, int type, const char *callsign, void *data)
+{
+	registry_entry_t *e;
+	uint32_t hash = _hash(type, callsign);
+	
+	/* Grow the entries array by doubling */
+	if(r->count == r->size)
+	{
+		int size = (r->size ? r->size * 2 : REGISTRY_MIN_ENTRIES);
+		
+		e = realloc(r->entries, sizeof(registry_entry_t) * size);
+		if(!e) return(-1); /* Out of memory! */
+		
+		r->entries = e;
+		r->size = size;
+	}
+	
+	/* Keep the hash table no more than half full */
+	if((unsigned int) (r->count + 1) * 2 > r->index_size &&
+	   _grow_index(r) != 0) return(-1);
+	
+	e = &r->entries[r->count];
+	e->type = type;
+	e->callsign = callsign;
+	e->hash = hash;
+	e->data = data;
+	
+	r->index[_slot(r, type, callsign, hash)] = ++r->count;
+	
+	return(r->count - 1);
+}
+
+void *registry_get(registry_t *r, int index)
+{
+	/* Return an object by its index number */
+	if(index < 0 || index >= r->count) return(NULL);
+	return(r->entries[index].data);
+}
+
+void registry_free(registry_t *r)
+{
+	free(r->entries);
+	free(r->index);
+	memset(r, 0, sizeof(registry_t));
+}
+
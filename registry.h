@@ -0,0 +1,50 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __REGISTRY_H__
+#define __REGISTRY_H__
+
+#include <stdint.h>
+
+typedef struct {
+	int type;
+	const char *callsign;
+	uint32_t hash;
+	void *data;
+} registry_entry_t;
+
+typedef struct {
+	
+	/* Dense array of entries, in the order they were added */
+	registry_entry_t *entries;
+	int count;
+	int size;
+	
+	/* Open addressing hash table of entry numbers + 1, 0 = empty.
+	 * The size is a power of two, and kept at most half full */
+	int *index;
+	unsigned int index_size;
+	
+} registry_t;
+
+extern void *registry_find(registry_t *r, int type, const char *callsign);
+extern int registry_add(registry_t *r, int type, const char *callsign, void *data);
+extern void *registry_get(registry_t *r, int index);
+extern void registry_free(registry_t *r);
+
+#endif /* __REGISTRY_H__ */
+
@@ -0,0 +1,262 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Plays back a recorded capture of the habitat changes feed, so the
+ * whole path from parsing to the map can be run without the server.
+ *
+ * A capture is a text file, optionally gzipped, of changes feed lines
+ * as sent by couchdb with include_docs=true. Each line may be prefixed
+ * with the time it was received, in seconds, and a tab:
+ *
+ *   1316808000.250\t{"seq":123,"id":"...","changes":[...],"doc":{...}}
+ *
+ * The gaps between lines are kept, divided by the speed, but no wait is
+ * longer than REPLAY_WAIT_MAX. Lines without a time are played straight
+ * away, as is everything at a speed of 0.
+ * Playing as fast as possible waits for room in the source's queue
+ * rather than dropping positions.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <curl/curl.h>
+#include "replay.h"
+#include "habitat.h"
+#include "core.h"
+#include "log.h"
+
+/* Longest line that can be read from a capture */
+#define REPLAY_LINE_MAX (65536)
+
+/* Longest wait between two lines, in seconds. Longer gaps in the
+ * capture, or times that have been mangled, are cut short to this */
+#define REPLAY_WAIT_MAX (10.0)
+
+static double _now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/* Sleep for up to timeout milliseconds, returning early if stopped */
+static void _sleep(src_replay_t *r, int timeout)
+{
+	struct pollfd pfd;
+	
+	pfd.fd = r->efd;
+	pfd.events = POLLIN;
+	
+	poll(&pfd, 1, timeout);
+}
+
+/* Wait until it's time to play a line recorded at time t */
+static void _wait(src_replay_t *r, double t)
+{
+	double delay;
+	
+	if(r->speed <= 0 || !isfinite(t)) return;
+	
+	/* Times are counted from the first line that has one */
+	if(!r->started)
+	{
+		r->first = t;
+		r->started = _now();
+		return;
+	}
+	
+	delay = r->started + (t - r->first) / r->speed - _now();
+	
+	/* Cut long gaps short, and play the rest of
+	 * the capture as if the gap had been that long */
+	if(delay > REPLAY_WAIT_MAX)
+	{
+		r->started -= delay - REPLAY_WAIT_MAX;
+		delay = REPLAY_WAIT_MAX;
+	}
+	
+	if(delay > 0) _sleep(r, delay * 1000);
+}
+
+static void _play(src_replay_t *r, char *line)
+{
+	couch_row_t *row;
+	hab_update_t u;
+	char *json = line, *tab;
+	
+	r->lines++;
+	
+	/* Pick off the time the line was received */
+	if((tab = strchr(line, '\t')))
+	{
+		*tab = '\0';
+		json = tab + 1;
+		_wait(r, strtod(line, NULL));
+	}
+	
+	/* Skip the heartbeats */
+	if(*json == '\0')
+	{
+		core_source_alive(r->source);
+		return;
+	}
+	
+	row = couch_parse(&r->parser, json, strlen(json));
+	if(!row || !row->has_doc) return;
+	
+	core_source_feed(r->source, row->has_seq ? row->seq : -1);
+	
+	if(habitat_document_update(row, &u) != 0) return;
+	
+	/* The capture is old, so how late it was uploaded means nothing now */
+	u.uploaded = 0;
+	
+	/* When playing flat out, wait for room in the queue
+	 * rather than have the update dropped */
+	while(r->speed <= 0 && !r->stopping &&
+	      core_source_depth(r->source) >= HABHOUND_QUEUE_SIZE) _sleep(r, 1);
+	
+	core_push(r->source, &u);
+	
+	r->docs++;
+}
+
+static void *replay_thread(void *arg)
+{
+	src_replay_t *r = (src_replay_t *) arg;
+	char *line;
+	double started = _now(), elapsed;
+	
+	line = malloc(REPLAY_LINE_MAX);
+	if(!line) return(NULL);
+	
+	habhound_set_status("Replaying %s", r->path);
+	
+	while(!r->stopping && gzgets(r->f, line, REPLAY_LINE_MAX))
+	{
+		size_t l = strlen(line);
+		
+		/* Lines longer than the buffer are skipped */
+		if(l > 0 && line[l - 1] != '\n' && !gzeof(r->f))
+		{
+			log_printf(LOG_LEVEL_WARN, "replay: skipping overlong line\n");
+			while(gzgets(r->f, line, REPLAY_LINE_MAX) && line[strlen(line) - 1] != '\n');
+			continue;
+		}
+		
+		while(l > 0 && (line[l - 1] == '\n' || line[l - 1] == '\r')) line[--l] = '\0';
+		
+		_play(r, line);
+	}
+	
+	elapsed = _now() - started;
+	
+	log_printf(LOG_LEVEL_INFO, "Replayed %lu lines, %lu positions in %.3f seconds (%.0f lines/s)\n",
+		r->lines, r->docs, elapsed, elapsed > 0 ? r->lines / elapsed : 0);
+	habhound_set_status("Replay of %s finished, %lu positions", r->path, r->docs);
+	
+	couch_parser_free(&r->parser);
+	free(line);
+	
+	return(NULL);
+}
+
+/* Start playing back the capture at path, pushing updates to source.
+ * speed is a multiple of the recorded speed, or 0 to play as fast as
+ * possible */
+src_replay_t *src_replay_start(const char *path, double speed, core_source_t *source)
+{
+	src_replay_t *r;
+	int e;
+	
+	r = calloc(sizeof(src_replay_t), 1);
+	if(!r) return(NULL);
+	
+	r->speed = speed;
+	r->source = source;
+	r->efd = -1;
+	
+	r->path = strdup(path);
+	if(!r->path)
+	{
+		free(r);
+		return(NULL);
+	}
+	
+	r->f = gzopen(path, "rb");
+	if(!r->f)
+	{
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		free(r->path);
+		free(r);
+		return(NULL);
+	}
+	
+	gzbuffer(r->f, 131072);
+	
+	/* Used to wake the thread when stopping */
+	r->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(r->efd == -1)
+	{
+		perror("eventfd");
+		gzclose(r->f);
+		free(r->path);
+		free(r);
+		return(NULL);
+	}
+	
+	/* Start the thread */
+	e = pthread_create(&r->t, NULL, replay_thread, (void *) r);
+	if(e != 0)
+	{
+		fprintf(stderr, "replay thread failed to start: %s\n", strerror(e));
+		close(r->efd);
+		gzclose(r->f);
+		free(r->path);
+		free(r);
+		return(NULL);
+	}
+	
+	return(r);
+}
+
+void src_replay_stop(src_replay_t *r)
+{
+	uint64_t one = 1;
+	
+	/* Signal to the thread we're stopping */
+	r->stopping = 1;
+	if(write(r->efd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
+	
+	/* Wait until it complies */
+	pthread_join(r->t, NULL);
+	
+	close(r->efd);
+	gzclose(r->f);
+	free(r->path);
+	free(r);
+}
+
@@ -0,0 +1,61 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <pthread.h>
+#include <zlib.h>
+#include "couchdoc.h"
+#include "core.h"
+
+typedef struct
+{
+	/* The capture file, read through zlib so it may be gzipped */
+	char *path;
+	gzFile f;
+	
+	/* Playback speed, 1.0 is as recorded and 0 as fast as possible */
+	double speed;
+	
+	/* Where updates are sent */
+	core_source_t *source;
+	
+	/* JSON field extractor */
+	couch_parser_t parser;
+	
+	/* Time of the first line in the capture that has one, and when
+	 * it was played. started is 0 until then */
+	double first;
+	double started;
+	
+	/* Statistics */
+	unsigned long lines;
+	unsigned long docs;
+	
+	/* Thread stuffs */
+	pthread_t t;
+	int efd; /* eventfd to wake the thread when stopping */
+	char stopping;
+	
+} src_replay_t;
+
+extern src_replay_t *src_replay_start(const char *path, double speed, core_source_t *source);
+extern void src_replay_stop(src_replay_t *r);
+
+#endif /* __REPLAY_H__ */
+
@@ -0,0 +1,135 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Starts and stops the sources given on the command line, each on its
+ * own thread with its own queue into the core. Only the first habitat
+ * server is given the store, as it alone is resumed from the stored
+ * sequence number. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "sources.h"
+#include "habitat.h"
+#include "replay.h"
+#include "udp.h"
+
+static const char *_type_name(source_type_t type)
+{
+	switch(type)
+	{
+	case SOURCE_HABITAT: return("habitat");
+	case SOURCE_REPLAY: return("replay");
+	case SOURCE_UDP: return("udp");
+	}
+	
+	return("unknown");
+}
+
+/* Add a source to be started. Returns 0 on success or -1 if there are
+ * too many */
+int sources_add(sources_t *s, source_type_t type, char *arg)
+{
+	if(s->count == CORE_MAX_SOURCES)
+	{
+		fprintf(stderr, "No more than %i sources can be used\n", CORE_MAX_SOURCES);
+		return(-1);
+	}
+	
+	s->list[s->count].type = type;
+	s->list[s->count].arg = arg;
+	s->list[s->count].src = NULL;
+	s->count++;
+	
+	return(0);
+}
+
+/* Number of sources of a type */
+int sources_count(sources_t *s, source_type_t type)
+{
+	int i, n = 0;
+	
+	for(i = 0; i < s->count; i++)
+		if(s->list[i].type == type) n++;
+	
+	return(n);
+}
+
+/* Start every source. Returns 0 on success, or -1 if any failed to
+ * start, in which case those that did should still be stopped */
+int sources_start(sources_t *s, store_t *store)
+{
+	int i;
+	
+	for(i = 0; i < s->count; i++)
+	{
+		source_t *src = &s->list[i];
+		core_source_t *cs;
+		char *name;
+		
+		name = sprintf_alloc("%s %s", _type_name(src->type), src->arg);
+		if(!name) return(-1); /* Out of memory! */
+		
+		cs = core_add_source(name);
+		free(name);
+		
+		if(!cs) return(-1);
+		
+		switch(src->type)
+		{
+		case SOURCE_HABITAT:
+			src->src = src_habitat_start(src->arg, store, cs);
+			store = NULL;
+			break;
+		
+		case SOURCE_REPLAY:
+			src->src = src_replay_start(src->arg, s->speed, cs);
+			break;
+		
+		case SOURCE_UDP:
+			src->src = src_udp_start(src->arg, cs);
+			break;
+		}
+		
+		if(!src->src) return(-1);
+	}
+	
+	return(0);
+}
+
+void sources_stop(sources_t *s)
+{
+	int i;
+	
+	for(i = 0; i < s->count; i++)
+	{
+		source_t *src = &s->list[i];
+		
+		if(!src->src) continue;
+		
+		switch(src->type)
+		{
+		case SOURCE_HABITAT: src_habitat_stop(src->src); break;
+		case SOURCE_REPLAY: src_replay_stop(src->src); break;
+		case SOURCE_UDP: src_udp_stop(src->src); break;
+		}
+		
+		src->src = NULL;
+	}
+}
+
@@ -0,0 +1,58 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __SOURCES_H__
+#define __SOURCES_H__
+
+#include "core.h"
+#include "store.h"
+
+typedef enum {
+	SOURCE_HABITAT,
+	SOURCE_REPLAY,
+	SOURCE_UDP,
+} source_type_t;
+
+typedef struct {
+	source_type_t type;
+	
+	/* The URL, capture file or UDP address, from the command line */
+	char *arg;
+	
+	/* The running source, NULL if not started */
+	void *src;
+	
+} source_t;
+
+/* The sources given on the command line */
+typedef struct {
+	
+	source_t list[CORE_MAX_SOURCES];
+	int count;
+	
+	/* Playback speed for captures */
+	double speed;
+	
+} sources_t;
+
+extern int sources_add(sources_t *s, source_type_t type, char *arg);
+extern int sources_count(sources_t *s, source_type_t type);
+extern int sources_start(sources_t *s, store_t *store);
+extern void sources_stop(sources_t *s);
+
+#endif /* __SOURCES_H__ */
+
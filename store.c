@@ -0,0 +1,393 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* An append-only log of every position received, so the map and tracks
+ * survive a restart and the changes feed can carry on where it stopped.
+ *
+ * The file is a header followed by records, each a multiple of 8 bytes:
+ *
+ *   STORE_NAME  - gives a callsign an id, the name follows the record
+ *   STORE_POINT - one position, for the callsign with an id
+ *
+ * Callsigns are stored once, so replaying a point needs no string
+ * handling at all. The header holds the last changes feed sequence
+ * number and the URL of the server it's from, rewritten each time the
+ * buffer is flushed. A sequence number is only any use to the server
+ * it came from, another is started from its own update_seq.
+ *
+ * At startup the file is mapped and read in one pass, calling back for
+ * each point. Anything after the last complete record, left by a crash
+ * part way through a write, is cut off. Records are then appended with
+ * ordinary buffered writes by the habitat thread.
+ *
+ * If a write fails the buffer is kept and written again on the next
+ * flush. Records that don't fit while it can't be written are lost, and
+ * the sequence number stops advancing so their documents are read from
+ * the changes feed again on the next start.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "store.h"
+#include "intern.h"
+
+#define STORE_MAGIC   "HABHOUND"
+#define STORE_VERSION (2)
+
+enum {
+	STORE_NAME = 1,
+	STORE_POINT,
+};
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	int32_t seq;
+	char source[STORE_SOURCE];
+} store_header_t;
+
+typedef struct {
+	uint8_t kind;
+	uint8_t type;
+	uint16_t length; /* Length of the name, STORE_NAME only */
+	uint32_t id;
+	int64_t timestamp;
+	double latitude;
+	double longitude;
+	double altitude;
+} store_record_t;
+
+/* Round a name length up to a multiple of 8 bytes */
+#define STORE_PAD(n) (((n) + 7) & ~7)
+
+/* Write the header with the current sequence number and server. It's
+ * written in one go so the two always agree. Returns 0 on success, or
+ * -1 on error */
+static int _write_header(store_t *st)
+{
+	store_header_t h;
+	
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, STORE_MAGIC, 8);
+	h.version = STORE_VERSION;
+	h.seq = st->seq;
+	memcpy(h.source, st->source, STORE_SOURCE);
+	
+	if(pwrite(st->fd, &h, sizeof(h), 0) != sizeof(h))
+	{
+		fprintf(stderr, "Error writing to %s: %s\n", st->path, strerror(errno));
+		return(-1);
+	}
+	
+	st->stored_seq = st->seq;
+	st->source_changed = 0;
+	
+	return(0);
+}
+
+static int _write(store_t *st, const void *data, size_t length)
+{
+	if(st->buffered + length > STORE_BUFFER && store_flush(st) != 0)
+		return(-1);
+	
+	memcpy(st->buffer + st->buffered, data, length);
+	st->buffered += length;
+	
+	return(0);
+}
+
+/* Read the whole log, calling back for each point. Returns
+ * the length of the valid part of the file, or -1 on error */
+static int64_t _replay(store_t *st, const char *data, uint64_t length,
+	void (*callback)(void *, hab_update_t *), void *user)
+{
+	const store_header_t *h = (const store_header_t *) data;
+	uint64_t offset = sizeof(store_header_t);
+	hab_update_t u;
+	
+	memset(&u, 0, sizeof(u));
+	
+	if(memcmp(h->magic, STORE_MAGIC, 8) != 0 || h->version != STORE_VERSION)
+	{
+		fprintf(stderr, "%s is not a habhound store, or is the wrong version\n", st->path);
+		return(-1);
+	}
+	
+	st->seq = st->stored_seq = h->seq;
+	memcpy(st->source, h->source, STORE_SOURCE);
+	st->source[STORE_SOURCE - 1] = '\0';
+	
+	while(offset + sizeof(store_record_t) <= length)
+	{
+		const store_record_t *r = (const store_record_t *) (data + offset);
+		
+		if(r->kind == STORE_NAME)
+		{
+			const char *name = (const char *) (r + 1);
+			
+			if(offset + sizeof(store_record_t) + STORE_PAD(r->length) > length) break;
+			if(r->id != (uint32_t) st->names.count) break;
+			
+			name = intern_n(name, r->length);
+			if(!name || registry_add(&st->names, 0, name, (void *) (uintptr_t) (r->id + 1)) < 0)
+				return(-1); /* Out of memory! */
+			
+			offset += sizeof(store_record_t) + STORE_PAD(r->length);
+		}
+		else if(r->kind == STORE_POINT)
+		{
+			if(r->id >= (uint32_t) st->names.count) break;
+			
+			u.callsign  = st->names.entries[r->id].callsign;
+			u.type      = r->type;
+			u.timestamp = r->timestamp;
+			u.latitude  = r->latitude;
+			u.longitude = r->longitude;
+			u.altitude  = r->altitude;
+			
+			if(callback) callback(user, &u);
+			
+			offset += sizeof(store_record_t);
+		}
+		else break;
+	}
+	
+	return(offset);
+}
+
+/* Open the log at path, creating it if needed, and replay every point
+ * stored through callback. Returns NULL on error */
+store_t *store_open(const char *path, void (*callback)(void *, hab_update_t *), void *user)
+{
+	store_t *st;
+	struct stat sb;
+	int64_t length = sizeof(store_header_t);
+	
+	st = calloc(1, sizeof(store_t));
+	if(!st) return(NULL);
+	
+	st->path = strdup(path);
+	st->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(!st->path || st->fd == -1 || fstat(st->fd, &sb) == -1)
+	{
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		store_close(st);
+		return(NULL);
+	}
+	
+	if(sb.st_size == 0)
+	{
+		/* A new file, write the header */
+		if(_write_header(st) != 0)
+		{
+			store_close(st);
+			return(NULL);
+		}
+	}
+	else
+	{
+		char *data;
+		
+		if(sb.st_size < (off_t) sizeof(store_header_t))
+		{
+			fprintf(stderr, "%s is not a habhound store\n", path);
+			store_close(st);
+			return(NULL);
+		}
+		
+		data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, st->fd, 0);
+		if(data == MAP_FAILED)
+		{
+			fprintf(stderr, "Can't map %s: %s\n", path, strerror(errno));
+			store_close(st);
+			return(NULL);
+		}
+		
+		madvise(data, sb.st_size, MADV_SEQUENTIAL);
+		length = _replay(st, data, sb.st_size, callback, user);
+		munmap(data, sb.st_size);
+		
+		if(length < 0)
+		{
+			store_close(st);
+			return(NULL);
+		}
+		
+		/* Drop anything after the last complete record */
+		if(length < sb.st_size)
+		{
+			fprintf(stderr, "Truncating %s to the last complete record\n", path);
+			if(ftruncate(st->fd, length) != 0) perror("ftruncate");
+		}
+	}
+	
+	st->length = length;
+	
+	return(st);
+}
+
+/* Add a position to the log. Returns 0 on success, or -1 on error */
+int store_append(store_t *st, hab_update_t *u)
+{
+	store_record_t r;
+	uintptr_t id;
+	
+	memset(&r, 0, sizeof(r));
+	
+	/* Store the callsign first if this is its first time */
+	id = (uintptr_t) registry_find(&st->names, 0, u->callsign);
+	if(!id)
+	{
+		char name[sizeof(r) + STORE_PAD(256)];
+		size_t l = strlen(u->callsign);
+		int i;
+		
+		if(l > 255) return(-1);
+		
+		r.kind = STORE_NAME;
+		r.length = l;
+		r.id = st->names.count;
+		
+		memset(name, 0, sizeof(name));
+		memcpy(name, &r, sizeof(r));
+		memcpy(name + sizeof(r), u->callsign, l);
+		
+		/* The id is only taken once the record is in the buffer, so
+		 * the ids in the file always follow on from one another */
+		if(_write(st, name, sizeof(r) + STORE_PAD(l)) != 0)
+		{
+			st->lost = 1;
+			return(-1);
+		}
+		
+		i = registry_add(&st->names, 0, u->callsign, (void *) (uintptr_t) (st->names.count + 1));
+		if(i < 0)
+		{
+			/* Out of memory! Take the record back out, it's
+			 * the last thing in the buffer */
+			st->buffered -= sizeof(r) + STORE_PAD(l);
+			st->lost = 1;
+			return(-1);
+		}
+		
+		id = i + 1;
+	}
+	
+	r.kind      = STORE_POINT;
+	r.type      = u->type;
+	r.length    = 0;
+	r.id        = id - 1;
+	r.timestamp = u->timestamp;
+	r.latitude  = u->latitude;
+	r.longitude = u->longitude;
+	r.altitude  = u->altitude;
+	
+	if(_write(st, &r, sizeof(r)) != 0)
+	{
+		st->lost = 1;
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/* The stored sequence number to resume source from, or 0 if
+ * there isn't one or it's from a different server */
+int store_seq(store_t *st, const char *source)
+{
+	if(strcmp(st->source, source) != 0) return(0);
+	return(st->seq);
+}
+
+/* Set the server the sequence number is from. If it's not the one
+ * stored the sequence number is reset, the new server sets its own.
+ * A URL too long to store is stored as none, so never matches */
+void store_set_source(store_t *st, const char *source)
+{
+	if(strlen(source) >= STORE_SOURCE) source = "";
+	if(strcmp(st->source, source) == 0) return;
+	
+	strcpy(st->source, source);
+	st->source_changed = 1;
+	st->seq = 0;
+}
+
+/* Record the last changes feed sequence number processed. It's
+ * written to the file on the next flush. Once a record has been
+ * lost it no longer moves, so the feed is read again from there */
+void store_set_seq(store_t *st, int seq)
+{
+	if(!st->lost) st->seq = seq;
+}
+
+/* Write out any buffered records, and then the sequence number.
+ * Returns 0 on success, or -1 on error */
+int store_flush(store_t *st)
+{
+	if(st->buffered > 0)
+	{
+		ssize_t r = pwrite(st->fd, st->buffer, st->buffered, st->length);
+		
+		if(r != (ssize_t) st->buffered)
+		{
+			/* Only say so once, this is tried on every flush */
+			if(!st->failed) fprintf(stderr, "Error writing to %s: %s\n", st->path, r < 0 ? strerror(errno) : "Short write");
+			st->failed = 1;
+			
+			/* Keep the buffer to write again at the same place. It only
+			 * grows, so covers any part written. If it never is, the
+			 * next replay cuts that part off at the last whole record */
+			return(-1);
+		}
+		
+		if(st->failed) fprintf(stderr, "Writing to %s again\n", st->path);
+		st->failed = 0;
+		
+		st->length += st->buffered;
+		st->buffered = 0;
+	}
+	
+	/* The records are written before the sequence number that covers them */
+	if(st->seq != st->stored_seq || st->source_changed)
+		return(_write_header(st));
+	
+	return(0);
+}
+
+void store_close(store_t *st)
+{
+	if(!st) return;
+	
+	if(st->fd != -1)
+	{
+		store_flush(st);
+		close(st->fd);
+	}
+	
+	registry_free(&st->names);
+	free(st->path);
+	free(st);
+}
+
@@ -0,0 +1,72 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include <stdint.h>
+#include "registry.h"
+#include "updq.h"
+
+/* Size of the write buffer */
+#define STORE_BUFFER (65536)
+
+/* Longest server URL the sequence number can be stored against */
+#define STORE_SOURCE (240)
+
+typedef struct {
+	
+	/* The log file */
+	int fd;
+	char *path;
+	
+	/* Bytes in the file, and waiting in the buffer */
+	uint64_t length;
+	char buffer[STORE_BUFFER];
+	size_t buffered;
+	
+	/* Callsigns and their ids, in the order they were first stored */
+	registry_t names;
+	
+	/* Last changes feed sequence number processed, and the
+	 * one last written to the file */
+	int seq;
+	int stored_seq;
+	
+	/* The server the sequence number is from, and whether it's
+	 * changed since last written to the file */
+	char source[STORE_SOURCE];
+	char source_changed;
+	
+	/* Set if the last flush couldn't write the buffer */
+	char failed;
+	
+	/* Set once a record couldn't be buffered, which holds seq back */
+	char lost;
+	
+} store_t;
+
+extern store_t *store_open(const char *path, void (*callback)(void *, hab_update_t *), void *user);
+extern int store_append(store_t *st, hab_update_t *u);
+extern int store_seq(store_t *st, const char *source);
+extern void store_set_source(store_t *st, const char *source);
+extern void store_set_seq(store_t *st, int seq);
+extern int store_flush(store_t *st);
+extern void store_close(store_t *st);
+
+#endif /* __STORE_H__ */
+
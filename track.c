@@ -0,0 +1,251 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Payload tracks. Every position is kept at full resolution in a
+ * compact array, but the line given to osm-gps-map is simplified so
+ * that no point is further from it than epsilon metres. habhound sets
+ * epsilon to about a pixel at the current zoom level.
+ *
+ * New points are added with an opening window: the line's last vertex
+ * moves along with the latest point for as long as every point since
+ * the vertex before it stays within epsilon of the segment between
+ * them. When one doesn't, the previous point is fixed as a vertex and
+ * the window starts again from there. Each point costs at most
+ * TRACK_WINDOW_MAX distance checks.
+ *
+ * When epsilon changes the whole line is rebuilt from the history
+ * with Douglas-Peucker.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "track.h"
+#include "metrics.h"
+
+/* Metres per degree of latitude */
+#define METRES_PER_DEGREE (6378137.0 * M_PI / 180.0)
+
+/* Distance in metres of point p from the segment a-b. k is the
+ * cosine of a's latitude, which is the same for a whole window */
+static double _distance(const track_point_t *p, const track_point_t *a, const track_point_t *b, double k)
+{
+	double bx = (b->longitude - a->longitude) * k;
+	double by = (b->latitude - a->latitude);
+	double px = (p->longitude - a->longitude) * k;
+	double py = (p->latitude - a->latitude);
+	double l = bx * bx + by * by;
+	double u = 0;
+	
+	/* Find the nearest point on the segment */
+	if(l > 0)
+	{
+		u = (px * bx + py * by) / l;
+		if(u < 0) u = 0;
+		else if(u > 1) u = 1;
+	}
+	
+	px -= u * bx;
+	py -= u * by;
+	
+	return(sqrt(px * px + py * py) * METRES_PER_DEGREE);
+}
+
+static OsmGpsMapPoint *_point(OsmGpsMapPoint *dst, const track_point_t *p)
+{
+	osm_gps_map_point_set_degrees(dst, p->latitude, p->longitude);
+	return(dst);
+}
+
+/* Add point i of the history as a new vertex at the end of the line */
+static int _show(track_t *t, int i)
+{
+	OsmGpsMapPoint p;
+	
+	if(t->shown_count == t->shown_size)
+	{
+		int size = (t->shown_size ? t->shown_size * 2 : 64);
+		int *s = realloc(t->shown, sizeof(int) * size);
+		if(!s) return(-1); /* Out of memory! */
+		
+		t->shown = s;
+		t->shown_size = size;
+	}
+	
+	t->shown[t->shown_count++] = i;
+	osm_gps_map_track_add_point(t->line, _point(&p, &t->points[i]));
+	
+	return(0);
+}
+
+track_t *track_new(OsmGpsMap *map, double epsilon)
+{
+	track_t *t = calloc(1, sizeof(track_t));
+	if(!t) return(NULL);
+	
+	t->map = map;
+	t->epsilon = epsilon;
+	t->line = osm_gps_map_track_new();
+	osm_gps_map_track_add(map, t->line);
+	
+	return(t);
+}
+
+/* Add a position to the end of the track. Returns 0 on success,
+ * or -1 if out of memory */
+int track_add(track_t *t, double latitude, double longitude, double altitude)
+{
+	track_point_t *a, *b;
+	int i, k;
+	
+	if(t->count == t->size)
+	{
+		int size = (t->size ? t->size * 2 : 256);
+		track_point_t *p = realloc(t->points, sizeof(track_point_t) * size);
+		if(!p) return(-1); /* Out of memory! */
+		
+		t->points = p;
+		t->size = size;
+	}
+	
+	k = t->count++;
+	metrics_add(&metric_track_points, 1);
+	
+	t->points[k].latitude  = latitude;
+	t->points[k].longitude = longitude;
+	t->points[k].altitude  = altitude;
+	
+	/* The first two points are always shown */
+	if(t->shown_count < 2) return(_show(t, k));
+	
+	/* Can the line's last vertex move to the new point? */
+	a = &t->points[t->shown[t->shown_count - 2]];
+	b = &t->points[k];
+	
+	i = t->shown[t->shown_count - 2] + 1;
+	if(k - i < TRACK_WINDOW_MAX)
+	{
+		double c = cos(a->latitude * M_PI / 180.0);
+		
+		for(; i < k; i++)
+			if(_distance(&t->points[i], a, b, c) > t->epsilon) break;
+	}
+	
+	if(i == k)
+	{
+		GSList *l = g_slist_last(osm_gps_map_track_get_points(t->line));
+		
+		/* The points in between are all close enough. Move the
+		 * vertex in place, the map is redrawn by the caller */
+		t->shown[t->shown_count - 1] = k;
+		_point(l->data, b);
+		
+		return(0);
+	}
+	
+	/* The previous point becomes fixed, start a new segment */
+	return(_show(t, k));
+}
+
+/* Rebuild the line shown for a new epsilon, in metres. Returns 0 on
+ * success or -1 if out of memory */
+int track_simplify(track_t *t, double epsilon)
+{
+	char *keep;
+	int *stack;
+	int n = 0, i;
+	
+	t->epsilon = epsilon;
+	
+	/* Replace the line on the map with a new one */
+	osm_gps_map_track_remove(t->map, t->line);
+	g_object_unref(G_OBJECT(t->line));
+	t->line = osm_gps_map_track_new();
+	osm_gps_map_track_add(t->map, t->line);
+	t->shown_count = 0;
+	
+	if(t->count < 3)
+	{
+		for(i = 0; i < t->count; i++)
+			if(_show(t, i) != 0) return(-1);
+		
+		return(0);
+	}
+	
+	keep = calloc(t->count, 1);
+	stack = malloc(sizeof(int) * t->count * 2);
+	if(!keep || !stack)
+	{
+		/* Out of memory! */
+		free(keep);
+		free(stack);
+		return(-1);
+	}
+	
+	/* Douglas-Peucker, with a stack of the ranges still to check */
+	keep[0] = keep[t->count - 1] = 1;
+	stack[n++] = 0;
+	stack[n++] = t->count - 1;
+	
+	while(n > 0)
+	{
+		int last = stack[--n];
+		int first = stack[--n];
+		double c = cos(t->points[first].latitude * M_PI / 180.0);
+		double max = 0;
+		int f = 0;
+		
+		for(i = first + 1; i < last; i++)
+		{
+			double d = _distance(&t->points[i], &t->points[first], &t->points[last], c);
+			if(d > max)
+			{
+				max = d;
+				f = i;
+			}
+		}
+		
+		if(max <= epsilon) continue;
+		
+		keep[f] = 1;
+		stack[n++] = first;
+		stack[n++] = f;
+		stack[n++] = f;
+		stack[n++] = last;
+	}
+	
+	for(i = 0; i < t->count; i++)
+		if(keep[i] && _show(t, i) != 0) break;
+	
+	free(keep);
+	free(stack);
+	
+	return(i < t->count ? -1 : 0);
+}
+
+void track_free(track_t *t)
+{
+	if(!t) return;
+	
+	osm_gps_map_track_remove(t->map, t->line);
+	g_object_unref(G_OBJECT(t->line));
+	free(t->points);
+	free(t->shown);
+	free(t);
+}
+
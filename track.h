@@ -0,0 +1,62 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __TRACK_H__
+#define __TRACK_H__
+
+#include <osm-gps-map.h>
+
+/* Longest run of points that can be replaced by one line segment */
+#define TRACK_WINDOW_MAX (128)
+
+/* One position in the track history */
+typedef struct {
+	float latitude;
+	float longitude;
+	float altitude;
+} track_point_t;
+
+typedef struct {
+	
+	/* The map the track is shown on */
+	OsmGpsMap *map;
+	
+	/* Every position added, oldest first */
+	track_point_t *points;
+	int count;
+	int size;
+	
+	/* The simplified line shown on the map, and the index in
+	 * points of each of its vertices. The last vertex is always
+	 * the latest point and moves along as points are added */
+	OsmGpsMapTrack *line;
+	int *shown;
+	int shown_count;
+	int shown_size;
+	
+	/* How far a point may be from the line, in metres */
+	double epsilon;
+	
+} track_t;
+
+extern track_t *track_new(OsmGpsMap *map, double epsilon);
+extern int track_add(track_t *t, double latitude, double longitude, double altitude);
+extern int track_simplify(track_t *t, double epsilon);
+extern void track_free(track_t *t);
+
+#endif /* __TRACK_H__ */
+
@@ -0,0 +1,330 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Receives UKHAS telemetry sentences as UDP datagrams, from a local
+ * receiver or gateway. Each datagram holds one or more sentences, one
+ * per line:
+ *
+ *   $$CALLSIGN,123,12:34:56,51.12345,-1.23456,12345*1A2B
+ *
+ * The five fields after the callsign are taken as the sentence number,
+ * time, latitude and longitude in decimal degrees and altitude in
+ * metres. The checksum, CRC16-CCITT as four hex digits or XOR as two,
+ * must be present and correct. Payloads that send anything else in
+ * those fields need habitat's parser, and can't be received this way.
+ *
+ * Only the loopback address is listened on unless another is given,
+ * as "address:port", as anyone who can reach the socket can plot
+ * whatever they like.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "udp.h"
+#include "intern.h"
+#include "metrics.h"
+#include "log.h"
+
+static uint16_t _crc16(const char *s, size_t length)
+{
+	/* CRC16-CCITT, 0xFFFF initial value */
+	uint16_t crc = 0xFFFF;
+	int i;
+	
+	while(length--)
+	{
+		crc ^= (uint16_t) (unsigned char) *(s++) << 8;
+		for(i = 0; i < 8; i++)
+			crc = (crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1);
+	}
+	
+	return(crc);
+}
+
+static uint8_t _xor(const char *s, size_t length)
+{
+	uint8_t x = 0;
+	while(length--) x ^= *(s++);
+	return(x);
+}
+
+/* Parse a number field, which must be all number */
+static int _number(const char *s, double *value)
+{
+	char *end;
+	
+	*value = strtod(s, &end);
+	
+	return(end == s || *end != '\0' ? -1 : 0);
+}
+
+/* Fill in a position update from a UKHAS sentence. The sentence is
+ * modified. Returns 0 on success, or -1 if it's not a valid sentence */
+int ukhas_parse(char *s, hab_update_t *u)
+{
+	char *f[6], *star, *end;
+	unsigned long check;
+	double sentence_id;
+	int n;
+	
+	/* Skip the $$ */
+	if(*s != '$') return(-1);
+	while(*s == '$') s++;
+	
+	/* The checksum covers everything between the $$ and * */
+	star = strrchr(s, '*');
+	if(!star) return(-1);
+	
+	check = strtoul(star + 1, &end, 16);
+	n = end - (star + 1);
+	
+	if(n == 4 && check != _crc16(s, star - s)) return(-1);
+	else if(n == 2 && check != _xor(s, star - s)) return(-1);
+	else if(n != 4 && n != 2) return(-1);
+	
+	*star = '\0';
+	
+	/* Split off the fields that are needed */
+	for(n = 0; n < 6 && s; n++)
+	{
+		f[n] = s;
+		if((s = strchr(s, ','))) *(s++) = '\0';
+	}
+	
+	if(n < 6 || *f[0] == '\0') return(-1);
+	
+	if(_number(f[1], &sentence_id) != 0 ||
+	   _number(f[3], &u->latitude) != 0 ||
+	   _number(f[4], &u->longitude) != 0 ||
+	   _number(f[5], &u->altitude) != 0) return(-1);
+	
+	u->callsign  = intern(f[0]);
+	u->type      = HAB_PAYLOAD;
+	u->timestamp = time(NULL);
+	
+	/* The same key habitat documents get, so a sentence
+	 * heard here and through habitat is only used once */
+	u->sentence  = core_sentence_key((int) sentence_id, f[2]);
+	u->uploaded  = 0;
+	
+	return(u->callsign ? 0 : -1);
+}
+
+/* Parse and pass on each sentence in a datagram */
+static void _datagram(src_udp_t *us, char *data)
+{
+	char *line, *next;
+	hab_update_t u;
+	size_t l;
+	
+	for(line = data; line; line = next)
+	{
+		if((next = strchr(line, '\n'))) *(next++) = '\0';
+		
+		l = strlen(line);
+		while(l > 0 && (line[l - 1] == '\r' || line[l - 1] == ' ')) line[--l] = '\0';
+		if(l == 0) continue;
+		
+		us->sentences++;
+		core_source_feed(us->source, -1);
+		
+		if(ukhas_parse(line, &u) != 0)
+		{
+			us->bad++;
+			continue;
+		}
+		
+		core_push(us->source, &u);
+	}
+}
+
+static void *udp_thread(void *arg)
+{
+	src_udp_t *us = (src_udp_t *) arg;
+	char data[UDP_DATAGRAM_MAX + 1];
+	struct pollfd pfd[2];
+	ssize_t n;
+	
+	habhound_set_status("Listening for telemetry on UDP %s", us->where);
+	
+	pfd[0].fd = us->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = us->efd;
+	pfd[1].events = POLLIN;
+	
+	while(!us->stopping)
+	{
+		if(poll(pfd, 2, -1) == -1)
+		{
+			if(errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+		
+		if(!(pfd[0].revents & POLLIN)) continue;
+		
+		n = recv(us->fd, data, UDP_DATAGRAM_MAX, 0);
+		if(n <= 0) continue;
+		
+		metrics_add(&metric_bytes_received, n);
+		
+		data[n] = '\0';
+		_datagram(us, data);
+	}
+	
+	log_printf(LOG_LEVEL_INFO, "udp thread ending, %lu sentences, %lu bad\n", us->sentences, us->bad);
+	
+	return(NULL);
+}
+
+/* Read "port" or "address:port" into addr. The address is
+ * loopback if not given. Returns 0 on success, or -1 if invalid */
+static int _address(struct sockaddr_in *addr, const char *where)
+{
+	const char *colon = strrchr(where, ':');
+	const char *port = where;
+	char *end;
+	long p;
+	
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	
+	if(colon)
+	{
+		char host[INET_ADDRSTRLEN];
+		
+		if(colon - where >= INET_ADDRSTRLEN) return(-1);
+		memcpy(host, where, colon - where);
+		host[colon - where] = '\0';
+		
+		if(inet_pton(AF_INET, host, &addr->sin_addr) != 1) return(-1);
+		
+		port = colon + 1;
+	}
+	
+	p = strtol(port, &end, 10);
+	if(end == port || *end != '\0' || p < 1 || p > 65535) return(-1);
+	
+	addr->sin_port = htons(p);
+	
+	return(0);
+}
+
+/* Start listening for sentences on a UDP port, given as "port" for the
+ * loopback address or "address:port", pushing updates to source */
+src_udp_t *src_udp_start(const char *where, core_source_t *source)
+{
+	src_udp_t *us;
+	struct sockaddr_in addr;
+	char host[INET_ADDRSTRLEN];
+	int one = 1;
+	int e;
+	
+	if(_address(&addr, where) != 0)
+	{
+		fprintf(stderr, "Bad UDP address %s, expected <port> or <address>:<port>\n", where);
+		return(NULL);
+	}
+	
+	us = calloc(sizeof(src_udp_t), 1);
+	if(!us) return(NULL);
+	
+	inet_ntop(AF_INET, &addr.sin_addr, host, sizeof(host));
+	us->where = sprintf_alloc("%s:%i", host, ntohs(addr.sin_port));
+	if(!us->where)
+	{
+		free(us);
+		return(NULL);
+	}
+	
+	us->source = source;
+	
+	us->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(us->fd == -1)
+	{
+		perror("socket");
+		free(us->where);
+		free(us);
+		return(NULL);
+	}
+	
+	setsockopt(us->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	
+	if(bind(us->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+	{
+		fprintf(stderr, "Can't listen on UDP %s: %s\n", us->where, strerror(errno));
+		close(us->fd);
+		free(us->where);
+		free(us);
+		return(NULL);
+	}
+	
+	/* Used to wake the thread when stopping */
+	us->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(us->efd == -1)
+	{
+		perror("eventfd");
+		close(us->fd);
+		free(us->where);
+		free(us);
+		return(NULL);
+	}
+	
+	/* Start the thread */
+	e = pthread_create(&us->t, NULL, udp_thread, (void *) us);
+	if(e != 0)
+	{
+		fprintf(stderr, "udp thread failed to start: %s\n", strerror(e));
+		close(us->efd);
+		close(us->fd);
+		free(us->where);
+		free(us);
+		return(NULL);
+	}
+	
+	return(us);
+}
+
+void src_udp_stop(src_udp_t *us)
+{
+	uint64_t one = 1;
+	
+	/* Signal to the thread we're stopping */
+	us->stopping = 1;
+	if(write(us->efd, &one, sizeof(one)) != sizeof(one))
+		perror("write");
+	
+	/* Wait until it complies */
+	pthread_join(us->t, NULL);
+	
+	close(us->efd);
+	close(us->fd);
+	free(us->where);
+	free(us);
+}
+
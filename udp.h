@@ -0,0 +1,52 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __UDP_H__
+#define __UDP_H__
+
+#include <pthread.h>
+#include "core.h"
+
+/* Largest datagram accepted */
+#define UDP_DATAGRAM_MAX (4096)
+
+typedef struct
+{
+	/* The address and port listened on, for messages, and the socket */
+	char *where;
+	int fd;
+	
+	/* Where updates are sent */
+	core_source_t *source;
+	
+	/* Statistics */
+	unsigned long sentences;
+	unsigned long bad; /* Sentences that failed to parse or checksum */
+	
+	/* Thread stuffs */
+	pthread_t t;
+	int efd; /* eventfd to wake the thread when stopping */
+	char stopping;
+	
+} src_udp_t;
+
+extern src_udp_t *src_udp_start(const char *where, core_source_t *source);
+extern void src_udp_stop(src_udp_t *u);
+extern int ukhas_parse(char *s, hab_update_t *u);
+
+#endif /* __UDP_H__ */
+
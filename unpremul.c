@@ -0,0 +1,243 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* Conversion of cairo's premultiplied ARGB32 pixels to the straight RGBA
+ * bytes used by GdkPixbuf. The result for each channel is
+ *
+ *   (c * 255 + a / 2) / a, truncated to 8 bits, or 0 where a is 0
+ *
+ * Rather than divide, the numerator is multiplied by a float reciprocal
+ * of the alpha, taken from a table. Each reciprocal is nudged up by 2^-20
+ * so that exact quotients don't round down. The numerator never exceeds
+ * 65152, so the nudge can't reach the next integer either, and the
+ * truncated product is always the same as the integer division. The
+ * table entry for an alpha of 0 is 0, which gives the 0 needed there.
+ *
+ * SSE2 and AVX2 versions work on 4 and 8 pixels at a time, and the one
+ * used is chosen on the first call by what the CPU supports. The pixels
+ * left over at the end of a row go through a scalar version of the same
+ * thing. On its own that's slower than the divide loop, so a CPU with
+ * neither SSE2 nor AVX2 falls back to the original loop that divides.
+ * The tests and benchmarks in bench/ pick each in turn with
+ * unpremultiply_use(), and compare them with the divide loop.
+*/
+
+#include <stdint.h>
+#include "unpremul.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UNPREMUL_X86
+#endif
+
+static float _rcp[256];
+
+/* The original conversion, kept as the reference */
+static void _unpremultiply_divide(uint8_t *dst, const uint32_t *src, int width)
+{
+	int x;
+	
+	for(x = 0; x < width; x++)
+	{
+		uint32_t a = src[x] >> 24;
+		
+		if(a == 0)
+		{
+			dst[x * 4 + 0] = 0;
+			dst[x * 4 + 1] = 0;
+			dst[x * 4 + 2] = 0;
+		}
+		else
+		{
+			dst[x * 4 + 0] = (((src[x] >> 16) & 0xFF) * 255 + a / 2) / a;
+			dst[x * 4 + 1] = (((src[x] >>  8) & 0xFF) * 255 + a / 2) / a;
+			dst[x * 4 + 2] = (((src[x] >>  0) & 0xFF) * 255 + a / 2) / a;
+		}
+		dst[x * 4 + 3] = a;
+	}
+}
+
+/* The reciprocal a pixel at a time, for the ends of rows in the SIMD
+ * versions. Slower than dividing, so not used for whole rows */
+static void _unpremultiply_scalar(uint8_t *dst, const uint32_t *src, int width)
+{
+	int x;
+	
+	for(x = 0; x < width; x++)
+	{
+		uint32_t p = src[x];
+		uint32_t a = p >> 24;
+		float r = _rcp[a];
+		
+		dst[x * 4 + 0] = (uint32_t) ((float) (((p >> 16) & 0xFF) * 255 + a / 2) * r);
+		dst[x * 4 + 1] = (uint32_t) ((float) (((p >>  8) & 0xFF) * 255 + a / 2) * r);
+		dst[x * 4 + 2] = (uint32_t) ((float) (((p >>  0) & 0xFF) * 255 + a / 2) * r);
+		dst[x * 4 + 3] = a;
+	}
+}
+
+#ifdef UNPREMUL_X86
+
+/* Unpremultiply one channel of each pixel, already shifted down to
+ * the low byte of each lane. Returns the result in the low byte */
+__attribute__((target("sse2")))
+static inline __m128i _channel_sse2(__m128i c, __m128i half, __m128 r)
+{
+	__m128i n;
+	
+	/* c * 255 + a / 2 */
+	c = _mm_and_si128(c, _mm_set1_epi32(0xFF));
+	n = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(c, 8), c), half);
+	
+	n = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(n), r));
+	
+	return(_mm_and_si128(n, _mm_set1_epi32(0xFF)));
+}
+
+__attribute__((target("sse2")))
+static void _unpremultiply_sse2(uint8_t *dst, const uint32_t *src, int width)
+{
+	int x;
+	
+	for(x = 0; x + 4 <= width; x += 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *) &src[x]);
+		__m128i a = _mm_srli_epi32(p, 24);
+		__m128i half = _mm_srli_epi32(a, 1);
+		__m128i o;
+		__m128 r;
+		
+		/* SSE2 has no gather */
+		r = _mm_set_ps(_rcp[src[x + 3] >> 24], _rcp[src[x + 2] >> 24],
+		               _rcp[src[x + 1] >> 24], _rcp[src[x + 0] >> 24]);
+		
+		o = _channel_sse2(_mm_srli_epi32(p, 16), half, r);
+		o = _mm_or_si128(o, _mm_slli_epi32(_channel_sse2(_mm_srli_epi32(p, 8), half, r), 8));
+		o = _mm_or_si128(o, _mm_slli_epi32(_channel_sse2(p, half, r), 16));
+		o = _mm_or_si128(o, _mm_slli_epi32(a, 24));
+		
+		_mm_storeu_si128((__m128i *) &dst[x * 4], o);
+	}
+	
+	_unpremultiply_scalar(dst + x * 4, src + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _channel_avx2(__m256i c, __m256i half, __m256 r)
+{
+	__m256i n;
+	
+	/* c * 255 + a / 2 */
+	c = _mm256_and_si256(c, _mm256_set1_epi32(0xFF));
+	n = _mm256_add_epi32(_mm256_sub_epi32(_mm256_slli_epi32(c, 8), c), half);
+	
+	n = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(n), r));
+	
+	return(_mm256_and_si256(n, _mm256_set1_epi32(0xFF)));
+}
+
+__attribute__((target("avx2")))
+static void _unpremultiply_avx2(uint8_t *dst, const uint32_t *src, int width)
+{
+	int x;
+	
+	for(x = 0; x + 8 <= width; x += 8)
+	{
+		__m256i p = _mm256_loadu_si256((const __m256i *) &src[x]);
+		__m256i a = _mm256_srli_epi32(p, 24);
+		__m256i half = _mm256_srli_epi32(a, 1);
+		__m256i o;
+		__m256 r;
+		
+		r = _mm256_i32gather_ps(_rcp, a, 4);
+		
+		o = _channel_avx2(_mm256_srli_epi32(p, 16), half, r);
+		o = _mm256_or_si256(o, _mm256_slli_epi32(_channel_avx2(_mm256_srli_epi32(p, 8), half, r), 8));
+		o = _mm256_or_si256(o, _mm256_slli_epi32(_channel_avx2(p, half, r), 16));
+		o = _mm256_or_si256(o, _mm256_slli_epi32(a, 24));
+		
+		_mm256_storeu_si256((__m256i *) &dst[x * 4], o);
+	}
+	
+	_unpremultiply_scalar(dst + x * 4, src + x, width - x);
+}
+
+#endif /* UNPREMUL_X86 */
+
+static void _unpremultiply_init(uint8_t *dst, const uint32_t *src, int width);
+
+static void (*_unpremultiply)(uint8_t *, const uint32_t *, int) = _unpremultiply_init;
+
+static void _init_rcp(void)
+{
+	int a;
+	
+	_rcp[0] = 0;
+	for(a = 1; a < 256; a++)
+		_rcp[a] = (float) (1.0 / a * (1.0 + 1.0 / (1 << 20)));
+}
+
+static void _unpremultiply_init(uint8_t *dst, const uint32_t *src, int width)
+{
+	_init_rcp();
+	
+	/* Without SSE2 or AVX2 the reciprocal is no faster than dividing */
+	_unpremultiply = _unpremultiply_divide;
+
+#ifdef UNPREMUL_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) _unpremultiply = _unpremultiply_avx2;
+	else if(__builtin_cpu_supports("sse2")) _unpremultiply = _unpremultiply_sse2;
+#endif
+	
+	_unpremultiply(dst, src, width);
+}
+
+/* Use one conversion from now on, rather than the best the CPU has.
+ * Returns 0 on success, or -1 if the CPU can't run it */
+int unpremultiply_use(unpremul_kernel_t kernel)
+{
+	_init_rcp();
+	
+	switch(kernel)
+	{
+	case UNPREMUL_DIVIDE: _unpremultiply = _unpremultiply_divide; return(0);
+	case UNPREMUL_SCALAR: _unpremultiply = _unpremultiply_scalar; return(0);
+#ifdef UNPREMUL_X86
+	case UNPREMUL_SSE2:
+		__builtin_cpu_init();
+		if(!__builtin_cpu_supports("sse2")) return(-1);
+		_unpremultiply = _unpremultiply_sse2;
+		return(0);
+	
+	case UNPREMUL_AVX2:
+		__builtin_cpu_init();
+		if(!__builtin_cpu_supports("avx2")) return(-1);
+		_unpremultiply = _unpremultiply_avx2;
+		return(0);
+#endif
+	default: return(-1);
+	}
+}
+
+/* Convert a row of width premultiplied ARGB32 pixels at src
+ * to straight RGBA bytes at dst. Only called from the GTK thread */
+void unpremultiply_row(uint8_t *dst, const uint32_t *src, int width)
+{
+	_unpremultiply(dst, src, width);
+}
+
@@ -0,0 +1,35 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __UNPREMUL_H__
+#define __UNPREMUL_H__
+
+#include <stdint.h>
+
+/* The conversions, for unpremultiply_use() */
+typedef enum {
+	UNPREMUL_DIVIDE, /* The original loop, dividing for each channel */
+	UNPREMUL_SCALAR, /* The float reciprocal a pixel at a time, for the SIMD row tails */
+	UNPREMUL_SSE2,
+	UNPREMUL_AVX2,
+} unpremul_kernel_t;
+
+extern void unpremultiply_row(uint8_t *dst, const uint32_t *src, int width);
+extern int unpremultiply_use(unpremul_kernel_t kernel);
+
+#endif /* __UNPREMUL_H__ */
+
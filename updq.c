@@ -0,0 +1,111 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+/* A queue of position updates between one source thread and the
+ * main loop. It's a fixed ring of update records with one writer and
+ * one reader, so head and tail are each only written by one side and
+ * no locks are needed -- just acquire/release ordering on the indexes.
+ * The counters run freely and wrap; the slot is index & (size - 1).
+ *
+ * When the ring is full the new update is dropped and counted, the
+ * producer never waits for the main loop.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "updq.h"
+
+int updq_init(updq_t *q, unsigned int size)
+{
+	unsigned int s;
+	
+	/* Round the size up to a power of two */
+	for(s = 1; s < size; s <<= 1);
+	
+	memset(q, 0, sizeof(updq_t));
+	
+	q->slots = calloc(sizeof(hab_update_t), s);
+	if(!q->slots) return(-1);
+	
+	q->size = s;
+	
+	return(0);
+}
+
+void updq_free(updq_t *q)
+{
+	free(q->slots);
+	memset(q, 0, sizeof(updq_t));
+}
+
+/* Called by the producer only. Returns 0 on success or
+ * -1 if the ring was full and the update dropped */
+int updq_push(updq_t *q, const hab_update_t *u)
+{
+	unsigned int head = q->head;
+	unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	
+	if(head - tail >= q->size)
+	{
+		__atomic_add_fetch(&q->drops, 1, __ATOMIC_RELAXED);
+		return(-1);
+	}
+	
+	q->slots[head & (q->size - 1)] = *u;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	
+	if(head + 1 - tail > q->max_depth)
+		__atomic_store_n(&q->max_depth, head + 1 - tail, __ATOMIC_RELAXED);
+	
+	return(0);
+}
+
+/* Called by the consumer only. Returns 0 and copies the
+ * oldest update into u, or -1 if the ring is empty */
+int updq_pop(updq_t *q, hab_update_t *u)
+{
+	unsigned int tail = q->tail;
+	unsigned int head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	
+	if(head == tail) return(-1);
+	
+	*u = q->slots[tail & (q->size - 1)];
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	
+	return(0);
+}
+
+/* Called by the consumer only. Returns the oldest update
+ * without removing it, or NULL if the ring is empty */
+hab_update_t *updq_peek(updq_t *q)
+{
+	unsigned int tail = q->tail;
+	unsigned int head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	
+	if(head == tail) return(NULL);
+	
+	return(&q->slots[tail & (q->size - 1)]);
+}
+
+/* Number of updates waiting, safe to call from either side */
+unsigned int updq_depth(updq_t *q)
+{
+	unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	unsigned int head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	return(head - tail);
+}
+
@@ -0,0 +1,50 @@
+/* habhound - High Altitude Balloon tracking                              */
+/*======================================================================= */
+/* Copyright 2011 Philip Heron <phil@sanslogic.co.uk>                     */
+/*                                                                        */
+/* This program is free software: you can redistribute it and/or modify   */
+/* it under the terms of the GNU General Public License as published by   */
+/* the Free Software Foundation, either version 3 of the License, or      */
+/* (at your option) any later version.                                    */
+/*                                                                        */
+/* This program is distributed in the hope that it will be useful,        */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of         */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the           */
+/* GNU General Public License for more details.                           */
+/*                                                                        */
+/* You should have received a copy of the GNU General Public License      */
+/* along with this program. If not, see <http://www.gnu.org/licenses/>.   */
+
+#ifndef __UPDQ_H__
+#define __UPDQ_H__
+
+#include "core.h"
+
+/* A bounded single-producer, single-consumer ring of updates */
+typedef struct {
+	
+	/* The ring, size is a power of two */
+	hab_update_t *slots;
+	unsigned int size;
+	
+	/* Next slot to write, only changed by the producer */
+	unsigned int head;
+	
+	/* Next slot to read, only changed by the consumer */
+	unsigned int tail;
+	
+	/* Statistics */
+	unsigned int drops; /* Updates lost because the ring was full */
+	unsigned int max_depth; /* Deepest the ring has been */
+	
+} updq_t;
+
+extern int updq_init(updq_t *q, unsigned int size);
+extern void updq_free(updq_t *q);
+extern int updq_push(updq_t *q, const hab_update_t *u);
+extern int updq_pop(updq_t *q, hab_update_t *u);
+extern hab_update_t *updq_peek(updq_t *q);
+extern unsigned int updq_depth(updq_t *q);
+
+#endif /* __UPDQ_H__ */
+